@@ -0,0 +1,26 @@
+/*
+** fake-08 overrides, included at the end of luaconf.h. llimits.h,
+** ltable.c and lstate.c only use these when they are defined, so the rest
+** of the interpreter is stock lua 5.3.2.
+*/
+
+#ifndef fake08conf_h
+#define fake08conf_h
+
+/*
+** A cart given the same input has to run the same way every time for
+** recorded input to replay, so table order can't depend on where things
+** are in memory. Every lua state lives in one block aligned to
+** LUAI_HEAPSPAN (source/luaArena.h), and pointers are hashed by their
+** offset inside it, which is the same wherever the block ended up. Keys
+** from outside the block, like the addresses of C statics some libraries
+** use as registry keys, move with every run, so they all hash alike.
+** String hashes start from a fixed seed instead of the time and addresses.
+*/
+#define LUAI_HEAPSPAN		(4 * 1024 * 1024)
+#define point2uint(p)	((unsigned int)((size_t)(p) & (LUAI_HEAPSPAN - 1)))
+#define hashpointer(t,p)	hashmod(t, \
+	((size_t)(p) ^ (size_t)(t)) < LUAI_HEAPSPAN ? point2uint(p) : 0)
+#define LUAI_FIXEDSEED		0x0f08a5edu
+
+#endif
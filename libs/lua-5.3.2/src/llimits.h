@@ -56,7 +56,9 @@ typedef unsigned char lu_byte;
 ** this is for hashing only; there is no problem if the integer
 ** cannot hold the whole pointer value
 */
+#if !defined(point2uint)
 #define point2uint(p)	((unsigned int)((size_t)(p) & UINT_MAX))
+#endif
 
 
 
@@ -78,6 +78,12 @@ typedef struct LG {
   { size_t t = cast(size_t, e); \
     memcpy(b + p, &t, sizeof(t)); p += sizeof(t); }
 
+#if defined(LUAI_FIXEDSEED)
+static unsigned int makeseed (lua_State *L) {
+  UNUSED(L);
+  return LUAI_FIXEDSEED;
+}
+#else
 static unsigned int makeseed (lua_State *L) {
   char buff[4 * sizeof(size_t)];
   unsigned int h = luai_makeseed();
@@ -89,6 +95,7 @@ static unsigned int makeseed (lua_State *L) {
   lua_assert(p == sizeof(buff));
   return luaS_hash(buff, p, h);
 }
+#endif
 
 
 /*
@@ -69,7 +69,9 @@
 #define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
 
 
+#if !defined(hashpointer)
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
+#endif
 
 
 #define dummynode		(&dummynode_)
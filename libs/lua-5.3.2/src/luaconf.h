@@ -760,6 +760,8 @@
 ** without modifying the main part of the file.
 */
 
+#include "fake08conf.h"
+
 
 
 
@@ -22,8 +22,9 @@ namespace fs = std::filesystem;
 #define SCREEN_2_HEIGHT 240;
 
 #define SAMPLERATE 22050
-#define SAMPLESPERBUF (SAMPLERATE / 30)
-#define NUM_BUFFERS 2
+//biggest buffer AudioOutput can ask for, the rest of each one goes unused
+#define SAMPLESPERBUF 2048
+#define NUM_BUFFERS 4
 
 const int __3ds_TopScreenWidth = SCREEN_WIDTH;
 const int __3ds_TopScreenHeight = SCREEN_HEIGHT;
@@ -37,10 +38,6 @@ const int PicoScreenHeight = 128;
 
 
 StretchOption stretch = StretchAndOverflow;
-u64 last_time;
-u64 now_time;
-u64 frame_time;
-double targetFrameTimeMs;
 
 u32 currKDown;
 u32 currKHeld;
@@ -89,24 +86,11 @@ void postFlipFunction(){
 }
 
 
-void init_fill_buffer(void *audioBuffer,size_t offset, size_t size) {
-
-	u32 *dest = (u32*)audioBuffer;
-
-	for (size_t i=0; i<size; i++) {
-		dest[i] = 0;
-	}
-
-	DSP_FlushDataCache(audioBuffer,size);
-
-}
-
 bool audioInitialized = false;
 u32 *audioBuffer;
 u32 audioBufferSize;
-ndspWaveBuf waveBuf[2];
-bool fillBlock = false;
-u32 currPos;
+ndspWaveBuf waveBuf[NUM_BUFFERS];
+int fillBlock = 0;
 
 
 void audioCleanup(){
@@ -146,22 +130,15 @@ void audioSetup(){
 	mix[1] = 1.0;
 	ndspChnSetMix(0, mix);
 
+	//buffers start out free, the main loop fills and queues all of them on
+	//its first pass
+	memset(audioBuffer, 0, audioBufferSize);
 	memset(waveBuf,0,sizeof(waveBuf));
-	waveBuf[0].data_vaddr = &audioBuffer[0];
-	waveBuf[0].nsamples = SAMPLESPERBUF;
-	waveBuf[1].data_vaddr = &audioBuffer[SAMPLESPERBUF];
-	waveBuf[1].nsamples = SAMPLESPERBUF;
-
-
-	size_t stream_offset = 0;
-
-	//not sure if this is necessary? if it is, memset might be better?
-	init_fill_buffer(audioBuffer,stream_offset, SAMPLESPERBUF * 2);
-
-	stream_offset += SAMPLESPERBUF;
-
-	ndspChnWaveBufAdd(0, &waveBuf[0]);
-	ndspChnWaveBufAdd(0, &waveBuf[1]);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		waveBuf[i].data_vaddr = &audioBuffer[i * SAMPLESPERBUF];
+		waveBuf[i].nsamples = SAMPLESPERBUF;
+	}
+	fillBlock = 0;
 
 	audioInitialized = true;
 }
@@ -177,11 +154,6 @@ void Host::oneTimeSetup(){
     audioSetup();
 
     gfxInitDefault();
-    
-    last_time = 0;
-    now_time = 0;
-    frame_time = 0;
-    targetFrameTimeMs = 0;
 }
 
 void Host::oneTimeCleanup(){
@@ -190,11 +162,7 @@ void Host::oneTimeCleanup(){
 	gfxExit();
 }
 
-void Host::setTargetFps(int targetFps){
-    targetFrameTimeMs = 1000.0 / (double)targetFps;
-}
-
-void Host::changeStretch(){
+bool Host::changeStretch(){
     if (currKDown & KEY_R) {
         if (stretch == PixelPerfect) {
             stretch = StretchToFit;
@@ -205,7 +173,11 @@ void Host::changeStretch(){
         else if (stretch == StretchAndOverflow) {
             stretch = PixelPerfect;
         }
+
+        return true;
     }
+
+    return false;
 }
 
 void Host::scanInput(){
@@ -224,6 +196,19 @@ uint8_t Host::getKeysHeld(){
 }
 
 
+bool Host::rewindHeld(){
+    return currKHeld & KEY_Y;
+}
+
+//about a minute of most carts on new models. Old ones give apps half the
+//memory, the vm's 4MB lua heap included, so they get a few seconds less
+size_t Host::getRewindBufferSize(){
+    bool isNew3ds = false;
+    APT_CheckNew3DS(&isNew3ds);
+
+    return (isNew3ds ? 8 : 3) * 1024 * 1024;
+}
+
 bool Host::shouldQuit() {
     bool lpressed = currKHeld & KEY_L;
 	bool rpressed = currKDown & KEY_R;
@@ -232,23 +217,62 @@ bool Host::shouldQuit() {
 }
 
 
-void Host::waitForTargetFps(){
-    now_time = svcGetSystemTick();
-    frame_time = now_time - last_time;
-	last_time = now_time;
+static uint64_t pacerNow(){
+    return (uint64_t)(svcGetSystemTick() / (CPU_TICKS_PER_MSEC / 1000.0));
+}
+
+static void pacerSleepUntil(uint64_t us){
+    uint64_t now = pacerNow();
+    if (us > now) {
+        svcSleepThread((us - now) * 1000);
+    }
+}
+
+//svcSleepThread wakes on time, and spinning would keep the audio thread off
+//the core it shares with this one
+pacerClock Host::getPacerClock(){
+    pacerClock clock = {pacerNow, pacerSleepUntil, 0};
+    return clock;
+}
+
 
-	double frameTimeMs = frame_time / CPU_TICKS_PER_MSEC;
+//old models only give apps the one core, where a second thread just takes
+//turns with the vm. The New 3DS has a core apps get to themselves, the
+//presenter goes there
+int Host::getPresenterFrameCount(){
+    bool isNew3ds = false;
+    APT_CheckNew3DS(&isNew3ds);
 
-	//sleep for remainder of time
-	if (frameTimeMs < targetFrameTimeMs) {
-		double msToSleep = targetFrameTimeMs - frameTimeMs;
+    return isNew3ds ? 2 : 0;
+}
 
-		svcSleepThread(msToSleep * 1000 * 1000);
+#define PRESENTER_CORE 2
+#define PRESENTER_STACK_SIZE (64 * 1024)
 
-		last_time += CPU_TICKS_PER_MSEC * msToSleep;
-	}
+struct hostThread {
+    Thread thread;
+};
+
+//threads without a core given to them share the vm's, so no std::thread
+//here. osSetSpeedupEnable in oneTimeSetup clocks the extra cores up with
+//the main one
+hostThread* Host::startPresenterThread(void (*entry)(void*), void* arg){
+    s32 priority = 0x30;
+    svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
+
+    Thread thread = threadCreate(entry, arg, PRESENTER_STACK_SIZE, priority, PRESENTER_CORE, false);
+    if (!thread) {
+        return nullptr;
+    }
+
+    return new hostThread{thread};
 }
 
+void Host::joinPresenterThread(hostThread* thread){
+    threadJoin(thread->thread, U64_MAX);
+    threadFree(thread->thread);
+    delete thread;
+}
 
 void Host::drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors){
     int bgcolor = 0;
@@ -350,8 +374,29 @@ void Host::drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteC
     postFlipFunction();
 }
 
+int Host::getAudioSampleRate(){
+    return SAMPLERATE;
+}
+
+int Host::getAudioBufferCount(){
+    return NUM_BUFFERS;
+}
+
+int Host::getAudioBuffersQueued(){
+    int queued = 0;
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        if (waveBuf[i].status == NDSP_WBUF_QUEUED || waveBuf[i].status == NDSP_WBUF_PLAYING) {
+            queued++;
+        }
+    }
+
+    return queued;
+}
+
+//buffers are queued in order, so the next one to fill is always the oldest
 bool Host::shouldFillAudioBuff(){
-    return waveBuf[fillBlock].status == NDSP_WBUF_DONE;
+    return audioInitialized &&
+        (waveBuf[fillBlock].status == NDSP_WBUF_FREE || waveBuf[fillBlock].status == NDSP_WBUF_DONE);
 }
 
 void* Host::getAudioBufferPointer(){
@@ -359,40 +404,25 @@ void* Host::getAudioBufferPointer(){
 }
 
 size_t Host::getAudioBufferSize(){
-    return waveBuf[fillBlock].nsamples;
+    return SAMPLESPERBUF;
 }
 
-void Host::playFilledAudioBuffer(){
-    DSP_FlushDataCache(waveBuf[fillBlock].data_pcm16, waveBuf[fillBlock].nsamples);
+void Host::playFilledAudioBuffer(size_t samples){
+    waveBuf[fillBlock].nsamples = samples;
+    DSP_FlushDataCache(waveBuf[fillBlock].data_pcm16, samples * sizeof(u32));
 
 	ndspChnWaveBufAdd(0, &waveBuf[fillBlock]);
 
-	fillBlock = !fillBlock;
+	fillBlock = (fillBlock + 1) % NUM_BUFFERS;
 }
 
 bool Host::mainLoop(){
     return aptMainLoop();
 }
 
-vector<string> Host::listcarts(){
-    vector<string> carts;
-
+string Host::getCartDirectory(){
     //force to SD card root
     chdir("sdmc:/");
 
-    DIR* dir = opendir("/p8carts");
-
-    if (dir) {
-        for(auto& p: fs::directory_iterator("/p8carts")){
-            auto ext = p.path().extension().string();
-            if (ext == ".p8" || ext == ".png"){
-                carts.push_back(p.path().string());
-            }
-        }
-
-        closedir(dir);
-    }
-
-    
-    return carts;
+    return "/p8carts";
 }
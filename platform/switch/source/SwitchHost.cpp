@@ -3,10 +3,13 @@
 #include <string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <malloc.h>
 
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <thread>
 using namespace std;
 namespace fs = std::filesystem;
 
@@ -16,9 +19,10 @@ namespace fs = std::filesystem;
 #define FB_WIDTH  1280
 #define FB_HEIGHT 720
 
-#define SAMPLERATE 22050
-#define SAMPLESPERBUF (SAMPLERATE / 30)
-#define NUM_BUFFERS 2
+#define SAMPLERATE 48000
+//biggest buffer AudioOutput can ask for, 100ms at 48khz
+#define SAMPLESPERBUF 4800
+#define NUM_BUFFERS 4
 
 const int __screenWidth = FB_WIDTH;
 const int __screenHeight = FB_HEIGHT;
@@ -28,10 +32,6 @@ const int PicoScreenHeight = 128;
 
 
 StretchOption stretch;
-u64 last_time;
-u64 now_time;
-u64 frame_time;
-double targetFrameTimeMs;
 
 u32 currKDown;
 u32 currKHeld;
@@ -82,83 +82,76 @@ void postFlipFunction(){
 }
 
 
-void init_fill_buffer(void *audioBuffer,size_t offset, size_t size) {
-
-	u32 *dest = (u32*)audioBuffer;
-
-	for (size_t i=0; i<size; i++) {
-		dest[i] = 0;
-	}
-
-	//DSP_FlushDataCache(audioBuffer,size);
-
-}
-
 bool audioInitialized = false;
-u32 *audioBuffer;
-u32 audioBufferSize;
-//ndspWaveBuf waveBuf[2];
-bool fillBlock = false;
-u32 currPos;
+u32 audioSampleRate = SAMPLERATE;
+AudioOutBuffer audioBuffers[NUM_BUFFERS];
+//audout hands buffers back one at a time as it finishes them
+bool audioBufferQueued[NUM_BUFFERS];
+int fillBlock = 0;
 
 
 void audioCleanup(){
+    if (audioInitialized) {
+        audoutStopAudioOut();
+        audoutExit();
+    }
     audioInitialized = false;
 
-    //ndspExit();
-
-    if(audioBuffer != nullptr) {
-        //linearFree(audioBuffer);
-        audioBuffer = nullptr;
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        if (audioBuffers[i].buffer != nullptr) {
+            free(audioBuffers[i].buffer);
+            audioBuffers[i].buffer = nullptr;
+        }
     }
 }
 
 void audioSetup(){
-    /*
-    if(R_FAILED(ndspInit())) {
+    memset(audioBuffers, 0, sizeof(audioBuffers));
+    memset(audioBufferQueued, 0, sizeof(audioBufferQueued));
+    fillBlock = 0;
+
+    if (R_FAILED(audoutInitialize())) {
         return;
     }
 
-	//audio setup
-	audioBufferSize = SAMPLESPERBUF * NUM_BUFFERS * sizeof(u32);
-	audioBuffer = (u32*)linearAlloc(audioBufferSize);
-	if(audioBuffer == nullptr) {
-        audioCleanup();
+    if (R_FAILED(audoutStartAudioOut())) {
+        audoutExit();
         return;
     }
-	
-
-	ndspSetOutputMode(NDSP_OUTPUT_STEREO);
-
-	ndspChnSetInterp(0, NDSP_INTERP_LINEAR);
-	ndspChnSetRate(0, SAMPLERATE);
-	ndspChnSetFormat(0, NDSP_FORMAT_STEREO_PCM16);
-
-	float mix[12];
-	memset(mix, 0, sizeof(mix));
-	mix[0] = 1.0;
-	mix[1] = 1.0;
-	ndspChnSetMix(0, mix);
-
-	memset(waveBuf,0,sizeof(waveBuf));
-	waveBuf[0].data_vaddr = &audioBuffer[0];
-	waveBuf[0].nsamples = SAMPLESPERBUF;
-	waveBuf[1].data_vaddr = &audioBuffer[SAMPLESPERBUF];
-	waveBuf[1].nsamples = SAMPLESPERBUF;
-
-
-	size_t stream_offset = 0;
-
-	//not sure if this is necessary? if it is, memset might be better?
-	init_fill_buffer(audioBuffer,stream_offset, SAMPLESPERBUF * 2);
+    audioInitialized = true;
+
+    //almost always 48000, AudioOutput resamples to whatever it is
+    audioSampleRate = audoutGetSampleRate();
+
+    //audout wants page aligned buffers
+    u64 bufferSize = (SAMPLESPERBUF * sizeof(u32) + 0xfff) & ~0xfff;
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        void* data = memalign(0x1000, bufferSize);
+        if (data == nullptr) {
+            audioCleanup();
+            return;
+        }
+        memset(data, 0, bufferSize);
 
-	stream_offset += SAMPLESPERBUF;
+        audioBuffers[i].next = nullptr;
+        audioBuffers[i].buffer = data;
+        audioBuffers[i].buffer_size = bufferSize;
+        audioBuffers[i].data_size = 0;
+        audioBuffers[i].data_offset = 0;
+    }
+}
 
-	ndspChnWaveBufAdd(0, &waveBuf[0]);
-	ndspChnWaveBufAdd(0, &waveBuf[1]);
+void collectReleasedAudioBuffers(){
+    AudioOutBuffer* released = nullptr;
+    u32 count = 0;
 
-	audioInitialized = true;
-    */
+    while (R_SUCCEEDED(audoutGetReleasedAudioOutBuffer(&released, &count)) && count > 0) {
+        for (int i = 0; i < NUM_BUFFERS; i++) {
+            if (released == &audioBuffers[i]) {
+                audioBufferQueued[i] = false;
+            }
+        }
+    }
 }
 
 
@@ -174,11 +167,6 @@ void Host::oneTimeSetup(){
 
     framebufferCreate(&fb, win, FB_WIDTH, FB_HEIGHT, PIXEL_FORMAT_RGBA_8888, 2);
     framebufferMakeLinear(&fb);
-    
-    last_time = 0;
-    now_time = 0;
-    frame_time = 0;
-    targetFrameTimeMs = 0;
 }
 
 void Host::oneTimeCleanup(){
@@ -187,11 +175,7 @@ void Host::oneTimeCleanup(){
 	framebufferClose(&fb);
 }
 
-void Host::setTargetFps(int targetFps){
-    targetFrameTimeMs = 1000.0 / (double)targetFps;
-}
-
-void Host::changeStretch(){
+bool Host::changeStretch(){
     if (currKDown & KEY_R) {
         if (stretch == PixelPerfect) {
             stretch = PixelPerfectStretch;
@@ -199,7 +183,11 @@ void Host::changeStretch(){
         else if (stretch == PixelPerfectStretch) {
             stretch = PixelPerfect;
         }
+
+        return true;
     }
+
+    return false;
 }
 
 void Host::scanInput(){
@@ -218,6 +206,15 @@ uint8_t Host::getKeysHeld(){
 }
 
 
+bool Host::rewindHeld(){
+    return currKHeld & KEY_Y;
+}
+
+//plenty of memory to spare for a few minutes of most carts
+size_t Host::getRewindBufferSize(){
+    return 32 * 1024 * 1024;
+}
+
 bool Host::shouldQuit() {
     bool lpressed = currKHeld & KEY_L;
 	bool rpressed = currKDown & KEY_R;
@@ -225,27 +222,43 @@ bool Host::shouldQuit() {
 	return lpressed && rpressed;
 }
 
-const double NANOSECONDS_TO_MILLISECONDS = 1.0 / 1000000.0;
+static uint64_t pacerNow(){
+    return armTicksToNs(armGetSystemTick()) / 1000;
+}
+
+static void pacerSleepUntil(uint64_t us){
+    uint64_t now = pacerNow();
+    if (us > now) {
+        svcSleepThread((us - now) * 1000);
+    }
+}
 
-void Host::waitForTargetFps(){
-    now_time = armGetSystemTick();
-    frame_time = now_time - last_time;
-	last_time = now_time;
+//sleeps can overshoot by a scheduler tick, the main thread has a core to
+//itself so the last millisecond is spun instead
+pacerClock Host::getPacerClock(){
+    pacerClock clock = {pacerNow, pacerSleepUntil, 1000};
+    return clock;
+}
 
-    u64 frameTimeNs = armTicksToNs(frame_time);
-	double frameTimeMs = frameTimeNs * NANOSECONDS_TO_MILLISECONDS;
 
-	//sleep for remainder of time
-	if (frameTimeMs < targetFrameTimeMs) {
-		double msToSleep = targetFrameTimeMs - frameTimeMs;
-        u64 nsToSleep = msToSleep * 1000 * 1000;
+//scaling up to 1280x720 takes a good part of a frame, and there are cores
+//to spare for it
+int Host::getPresenterFrameCount(){
+    return 3;
+}
 
-		svcSleepThread(nsToSleep);
+struct hostThread {
+    std::thread thread;
+};
 
-		last_time += armNsToTicks(nsToSleep);
-	}
+hostThread* Host::startPresenterThread(void (*entry)(void*), void* arg){
+    return new hostThread{std::thread(entry, arg)};
 }
 
+void Host::joinPresenterThread(hostThread* thread){
+    thread->thread.join();
+    delete thread;
+}
 
 void Host::drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors){
 	u32 stride;
@@ -287,49 +300,61 @@ void Host::drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteC
     postFlipFunction();
 }
 
+int Host::getAudioSampleRate(){
+    return audioSampleRate;
+}
+
+int Host::getAudioBufferCount(){
+    return NUM_BUFFERS;
+}
+
+int Host::getAudioBuffersQueued(){
+    collectReleasedAudioBuffers();
+
+    int queued = 0;
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        if (audioBufferQueued[i]) {
+            queued++;
+        }
+    }
+
+    return queued;
+}
+
+//buffers are appended in order, so the next one to fill is always the oldest
 bool Host::shouldFillAudioBuff(){
-    //return waveBuf[fillBlock].status == NDSP_WBUF_DONE;
-    return false;
+    if (!audioInitialized) {
+        return false;
+    }
+
+    collectReleasedAudioBuffers();
+
+    return !audioBufferQueued[fillBlock];
 }
 
 void* Host::getAudioBufferPointer(){
-    //return waveBuf[fillBlock].data_pcm16;
-    return nullptr;
+    return audioBuffers[fillBlock].buffer;
 }
 
 size_t Host::getAudioBufferSize(){
-    //return waveBuf[fillBlock].nsamples;
-    return 0;
+    return SAMPLESPERBUF;
 }
 
-void Host::playFilledAudioBuffer(){
-    //DSP_FlushDataCache(waveBuf[fillBlock].data_pcm16, waveBuf[fillBlock].nsamples);
+void Host::playFilledAudioBuffer(size_t samples){
+    audioBuffers[fillBlock].data_size = samples * sizeof(u32);
+    armDCacheFlush(audioBuffers[fillBlock].buffer, audioBuffers[fillBlock].data_size);
 
-	//ndspChnWaveBufAdd(0, &waveBuf[fillBlock]);
+    if (R_SUCCEEDED(audoutAppendAudioOutBuffer(&audioBuffers[fillBlock]))) {
+        audioBufferQueued[fillBlock] = true;
+    }
 
-	fillBlock = !fillBlock;
+    fillBlock = (fillBlock + 1) % NUM_BUFFERS;
 }
 
 bool Host::mainLoop(){
     return appletMainLoop();
 }
 
-vector<string> Host::listcarts(){
-    vector<string> carts;
-
-    DIR* dir = opendir("/p8carts");
-
-    if (dir) {
-        for(auto& p: fs::directory_iterator("/p8carts")){
-            auto ext = p.path().extension().string();
-            if (ext == ".p8" || ext == ".png"){
-                carts.push_back(p.path().string());
-            }
-        }
-
-        closedir(dir);
-    }
-
-    
-    return carts;
+string Host::getCartDirectory(){
+    return "/p8carts";
 }
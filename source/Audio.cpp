@@ -1,12 +1,20 @@
 #include "Audio.h"
 #include "synth.h"
+#include "wavetable.h"
 #include "hostVmShared.h"
 
 #include <string>
-#include <sstream>
+#include <cstring>
 #include <algorithm> // std::max
 #include <cmath>
 #include <float.h> // std::max
+#include <chrono>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 //playback implemenation based on zetpo 8's
 //https://github.com/samhocevar/zepto8/blob/master/src/pico8/sfx.cpp
@@ -14,12 +22,50 @@
 Audio::Audio(PicoRam* memory){
     _memory = memory;
 
+    wavetable_init();
+
     for(int i = 0; i < 4; i++) {
         _memory->_sfxChannels[i].sfxId = -1;
     }
 }
 
+Audio::~Audio(){
+    StopThread();
+}
+
 void Audio::api_sfx(int sfx, int channel, int offset){
+    audioCommand command = {false, sfx, channel, offset};
+    if (!_commands.Push(command)) {
+        _droppedCommands++;
+    }
+}
+
+void Audio::api_music(int pattern, int16_t fade_len, int16_t mask){
+    audioCommand command = {true, pattern, fade_len, mask};
+    if (!_commands.Push(command)) {
+        _droppedCommands++;
+    }
+}
+
+void Audio::applyCommands(){
+    audioCommand command;
+    while (_commands.Pop(command)) {
+        if (command.music) {
+            play_music(command.id, (int16_t)command.arg1, (int16_t)command.arg2);
+        }
+        else {
+            play_sfx(command.id, command.arg1, command.arg2);
+        }
+    }
+}
+
+//every channel restarts its noise from the same point, so an sfx sounds the
+//same each time it plays
+static uint32_t noise_seed(int channel) {
+    return 0x2545f491u * (uint32_t)(channel + 1);
+}
+
+void Audio::play_sfx(int sfx, int channel, int offset){
 
     if (sfx < -2 || sfx > 63 || channel < -1 || channel > 3 || offset > 31) {
         return;
@@ -77,7 +123,10 @@ void Audio::api_sfx(int sfx, int channel, int offset){
         // Play this sound!
         _memory->_sfxChannels[channel].sfxId = sfx;
         _memory->_sfxChannels[channel].offset = std::max(0.f, (float)offset);
-        _memory->_sfxChannels[channel].phi = 0.f;
+        _memory->_sfxChannels[channel].phase = 0;
+        _memory->_sfxChannels[channel].phaser_phase = 0;
+        _memory->_sfxChannels[channel].noise_state = noise_seed(channel);
+        _memory->_sfxChannels[channel].instrument = instrumentVoice();
         _memory->_sfxChannels[channel].can_loop = true;
         _memory->_sfxChannels[channel].is_music = false;
         // Playing an instrument starting with the note C-2 and the
@@ -89,7 +138,7 @@ void Audio::api_sfx(int sfx, int channel, int offset){
     }      
 }
 
-void Audio::api_music(int pattern, int16_t fade_len, int16_t mask){
+void Audio::play_music(int pattern, int16_t fade_len, int16_t mask){
     if (pattern < -1 || pattern > 63) {
         return;
     }
@@ -116,9 +165,74 @@ void Audio::api_music(int pattern, int16_t fade_len, int16_t mask){
     set_music_pattern(pattern);
 }
 
+static float key_to_freq(float key)
+{
+    using std::exp2;
+    return 440.f * exp2((key - 33.f) / 12.f);
+}
+
+// PICO-8 exports instruments as 22050 Hz WAV files with 183 samples
+// per speed unit per note, so this is how much we should advance
+static float offset_per_sample(int speed)
+{
+    float const offset_per_second = 22050.f / (183.f * speed);
+    return offset_per_second / SAMPLES_PER_SECOND;
+}
+
+//Samples an sfx of this speed takes to play all 32 notes from the start. This
+//counts the same float steps the channel takes, so the music moves on exactly
+//when its fastest channel finishes. Inside a binade every step adds the same
+//amount unless the step rounds on a tie, so most of them are counted at once.
+static uint32_t samples_to_play(int speed) {
+    float const step = offset_per_sample(speed);
+    float offset = 0.f;
+    uint32_t samples = 0;
+
+    while (offset < 32.f) {
+        uint32_t run = 0;
+        if (offset > 0.f) {
+            int exponent;
+            std::frexp(offset, &exponent);
+            double const top = std::min(32.0, std::ldexp(1.0, exponent));
+            double const units = step / std::ldexp(1.0, exponent - 24);
+            double const increment = (offset + step) - offset;
+
+            if (units - std::floor(units) != 0.5) {
+                //stop a step short of the top, the ulp doubles past it
+                run = (uint32_t)((top - offset) / increment);
+                run = run > 0 ? run - 1 : 0;
+                offset = (float)(offset + run * increment);
+            }
+        }
+
+        if (run == 0) {
+            offset += step;
+            run = 1;
+        }
+        samples += run;
+    }
+
+    return samples;
+}
+
+static size_t samples_to_volume(float volume, float target, float volume_step) {
+    double const samples = std::ceil((double)(target - volume) * SAMPLES_PER_SECOND / volume_step);
+    return samples > 0.0 ? (size_t)std::min(samples, 1e9) : 0;
+}
+
 void Audio::set_music_pattern(int pattern) {
+    if (pattern < 0 || pattern > 63) {
+        //end of the song, there are no channels to read
+        for (int i = 0; i < 4; ++i) {
+            if (_memory->_sfxChannels[i].is_music) {
+                _memory->_sfxChannels[i].sfxId = -1;
+            }
+        }
+        _memory->_musicChannel.pattern = -1;
+        return;
+    }
+
     _memory->_musicChannel.pattern = pattern;
-    _memory->_musicChannel.offset = 0;
 
     //array to access song's channels. may be better to have this part of the struct?
     uint8_t channels[] = {
@@ -144,6 +258,7 @@ void Audio::set_music_pattern(int pattern) {
             _memory->_musicChannel.speed = std::max(1, (int)sfx.speed);
         }
     }
+    _memory->_musicChannel.samples_left = samples_to_play(_memory->_musicChannel.speed);
 
     // Play music sfx on active channels
     for (int i = 0; i < 4; ++i)
@@ -157,7 +272,10 @@ void Audio::set_music_pattern(int pattern) {
 
         _memory->_sfxChannels[i].sfxId = n;
         _memory->_sfxChannels[i].offset = 0.f;
-        _memory->_sfxChannels[i].phi = 0.f;
+        _memory->_sfxChannels[i].phase = 0;
+        _memory->_sfxChannels[i].phaser_phase = 0;
+        _memory->_sfxChannels[i].noise_state = noise_seed(i);
+        _memory->_sfxChannels[i].instrument = instrumentVoice();
         _memory->_sfxChannels[i].can_loop = false;
         _memory->_sfxChannels[i].is_music = true;
         _memory->_sfxChannels[i].prev_key = 24;
@@ -165,160 +283,708 @@ void Audio::set_music_pattern(int pattern) {
     }
 }
 
+//How many samples, up to count, the music plays before its next event: the
+//pattern ending or a fade finishing. Nothing about the music changes in
+//between except the fade, which channels ramp on their own.
+size_t Audio::musicRun(size_t count) {
+    musicChannel const &music = _memory->_musicChannel;
+    if (music.pattern == -1 || music.master < 0) {
+        return count;
+    }
+
+    count = std::min(count, (size_t)music.samples_left);
+    if (music.volume_step < 0) {
+        count = std::min(count, samples_to_volume(music.volume, 0.f, music.volume_step));
+    }
+    else if (music.volume_step > 0) {
+        count = std::min(count, samples_to_volume(music.volume, 1.f, music.volume_step));
+    }
+
+    return count;
+}
+
+//Moves the music on by a run from musicRun, handling the event at its end
+void Audio::advanceMusic(size_t count) {
+    musicChannel &music = _memory->_musicChannel;
+    if (music.pattern == -1 || music.master < 0) {
+        return;
+    }
+
+    bool faded_out = false;
+    if (music.volume_step < 0) {
+        faded_out = count >= samples_to_volume(music.volume, 0.f, music.volume_step);
+    }
+    else if (music.volume_step > 0 && count >= samples_to_volume(music.volume, 1.f, music.volume_step)) {
+        music.volume = 1.f;
+        music.volume_step = 0.f;
+    }
+    music.volume = std::clamp(music.volume + music.volume_step * count / SAMPLES_PER_SECOND, 0.f, 1.f);
+    music.samples_left -= (uint32_t)count;
+
+    if (faded_out)
+    {
+        // Fade out is finished, stop playing the current song
+        for (int i = 0; i < 4; ++i) {
+            if (_memory->_sfxChannels[i].is_music) {
+                _memory->_sfxChannels[i].sfxId = -1;
+            }
+        }
+        music.pattern = -1;
+    }
+    else if (music.samples_left == 0)
+    {
+        int16_t next_pattern = music.pattern + 1;
+        int16_t next_count = music.count + 1;
+        //todo: pull out these flags, get memory storage correct as well
+        if (_memory->songs[music.pattern].stop) //stop part of the loop flag
+        {
+            next_pattern = -1;
+            next_count = music.count;
+        }
+        else if (_memory->songs[music.pattern].loop){
+            while (--next_pattern > 0 && !_memory->songs[next_pattern].start)
+                ;
+        }
+
+        music.count = next_count;
+        set_music_pattern(next_pattern);
+    }
+}
+
+//Sums the channel blocks with int16 saturation into the stereo output, the
+//same mono sample going to both sides
+static void mixChannels(int16_t channels[4][AUDIO_BLOCK_SIZE], uint32_t* out, size_t count) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_adds_epi16(_mm_loadu_si128((const __m128i*)(channels[0] + i)),
+                                   _mm_loadu_si128((const __m128i*)(channels[1] + i)));
+        __m128i b = _mm_adds_epi16(_mm_loadu_si128((const __m128i*)(channels[2] + i)),
+                                   _mm_loadu_si128((const __m128i*)(channels[3] + i)));
+        __m128i mix = _mm_adds_epi16(a, b);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(mix, mix));
+        _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(mix, mix));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t a = vqaddq_s16(vld1q_s16(channels[0] + i), vld1q_s16(channels[1] + i));
+        int16x8_t b = vqaddq_s16(vld1q_s16(channels[2] + i), vld1q_s16(channels[3] + i));
+        int16x8_t mix = vqaddq_s16(a, b);
+        int16x8x2_t stereo = vzipq_s16(mix, mix);
+        vst1q_u32(out + i, vreinterpretq_u32_s16(stereo.val[0]));
+        vst1q_u32(out + i + 4, vreinterpretq_u32_s16(stereo.val[1]));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        int32_t sum = channels[0][i] + channels[1][i] + channels[2][i] + channels[3][i];
+        uint16_t sample = (uint16_t)std::clamp(sum, -32768, 32767);
+        out[i] = ((uint32_t)sample << 16) | sample;
+    }
+}
+
 void Audio::FillAudioBuffer(void *audioBuffer, size_t offset, size_t size){
     if (audioBuffer == nullptr) {
         return;
     }
 
+    applyCommands();
+
     uint32_t *buffer = (uint32_t *)audioBuffer;
+    int16_t channels[4][AUDIO_BLOCK_SIZE];
+
+    size_t done = 0;
+    while (done < size) {
+        size_t count = std::min(size - done, (size_t)AUDIO_BLOCK_SIZE);
+        memset(channels, 0, sizeof(channels));
+
+        //channels only depend on the music when it changes pattern, so the
+        //block renders a channel at a time between music events
+        size_t rendered = 0;
+        while (rendered < count) {
+            size_t run = musicRun(count - rendered);
+            for (int c = 0; c < 4; ++c) {
+                this->renderChannel(c, channels[c] + rendered, run);
+            }
+            advanceMusic(run);
+            rendered += run;
+        }
+
+        mixChannels(channels, buffer + done, count);
+
+        done += count;
+    }
+}
 
-    for (size_t i = 0; i < size; ++i){
-        int16_t sample = 0;
+void Audio::renderThread(){
+    uint32_t block[AUDIO_BLOCK_SIZE];
 
-        for (int c = 0; c < 4; ++c) {
-            //bit shifted 3 places to lower volume and avoid clipping
-            sample += this->getSampleForChannel(c) >> 3;
+    while (_threadRunning.load(std::memory_order_acquire)) {
+        //stay a little ahead of the host without piling up latency
+        if (_samples.Available() >= _ringTarget.load(std::memory_order_relaxed) || _samples.Free() < AUDIO_BLOCK_SIZE) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
         }
 
-        //buffer is stereo, so just send the mono sample to both channels
-        buffer[i] = (sample<<16) | (sample & 0xffff);
+        {
+            std::lock_guard<std::mutex> lock(_mixerLock);
+            FillAudioBuffer(block, 0, AUDIO_BLOCK_SIZE);
+        }
+        _samples.Push(block, AUDIO_BLOCK_SIZE);
     }
 }
 
-static float key_to_freq(float key)
-{
-    using std::exp2;
-    return 440.f * exp2((key - 33.f) / 12.f);
+void Audio::StartThread(){
+    if (_threadRunning) {
+        return;
+    }
+
+    _threadRunning = true;
+    _thread = std::thread(&Audio::renderThread, this);
 }
 
-//adapted from zepto8 sfx.cpp (wtfpl license)
-int16_t Audio::getSampleForChannel(int channel){
-    using std::fabs, std::fmod, std::floor, std::max;
+void Audio::StopThread(){
+    if (!_threadRunning) {
+        return;
+    }
 
-    int const samples_per_second = 22050;
+    _threadRunning = false;
+    _thread.join();
 
-    int16_t sample = 0;
+    //whatever was queued belongs to the cart that is going away
+    _samples.Clear();
+    _commands.Clear();
+}
 
-    const int index = _memory->_sfxChannels[channel].sfxId;
- 
-    // Advance music using the master channel
-    if (channel == _memory->_musicChannel.master && _memory->_musicChannel.pattern != -1)
-    {
-        float const offset_per_second = 22050.f / (183.f * _memory->_musicChannel.speed);
-        float const offset_per_sample = offset_per_second / samples_per_second;
-        _memory->_musicChannel.offset += offset_per_sample;
-        _memory->_musicChannel.volume += _memory->_musicChannel.volume_step / samples_per_second;
-        _memory->_musicChannel.volume = std::clamp(_memory->_musicChannel.volume, 0.f, 1.f);
+std::unique_lock<std::mutex> Audio::HoldMixer(){
+    std::unique_lock<std::mutex> lock(_mixerLock);
 
-        if (_memory->_musicChannel.volume_step < 0 && _memory->_musicChannel.volume <= 0)
-        {
-            // Fade out is finished, stop playing the current song
-            for (int i = 0; i < 4; ++i) {
-                if (_memory->_sfxChannels[i].is_music) {
-                    _memory->_sfxChannels[i].sfxId = -1;
-                }
-            }
-            _memory->_musicChannel.pattern = -1;
-        }
-        else if (_memory->_musicChannel.offset >= 32.f)
-        {
-            int16_t next_pattern = _memory->_musicChannel.pattern + 1;
-            int16_t next_count = _memory->_musicChannel.count + 1;
-            //todo: pull out these flags, get memory storage correct as well
-            if (_memory->songs[_memory->_musicChannel.pattern].stop) //stop part of the loop flag
-            {
-                next_pattern = -1;
-                next_count = _memory->_musicChannel.count;
-            }
-            else if (_memory->songs[_memory->_musicChannel.pattern].loop){
-                while (--next_pattern > 0 && !_memory->songs[next_pattern].start)
-                    ;
-            }
+    //only one side pops commands at a time, the lock sees to that
+    applyCommands();
 
-            _memory->_musicChannel.count = next_count;
-            set_music_pattern(next_pattern);
+    return lock;
+}
+
+void Audio::ReadAudioBuffer(void *audioBuffer, size_t size){
+    if (audioBuffer == nullptr) {
+        return;
+    }
+
+    uint32_t *buffer = (uint32_t *)audioBuffer;
+
+    //hosts fill several buffers back to back after a long frame. The thread
+    //only polls every millisecond, so give it a moment to catch up with a
+    //read it would have been able to keep ahead of
+    if (_threadRunning && size <= _ringTarget.load(std::memory_order_relaxed)) {
+        auto const giveUp = std::chrono::steady_clock::now() + std::chrono::milliseconds(AUDIO_READ_WAIT_MS);
+        while (_samples.Available() < size && std::chrono::steady_clock::now() < giveUp) {
+            std::this_thread::yield();
         }
     }
 
-    if (index < 0 || index > 63) {
-        //no (valid) sfx here. return silence
-        return 0;
+    size_t read = _samples.Pop(buffer, size);
+
+    if (read < size) {
+        memset(buffer + read, 0, (size - read) * sizeof(uint32_t));
+
+        if (_threadRunning) {
+            _underruns++;
+            _underrunSamples += (uint32_t)(size - read);
+        }
     }
+}
 
-    struct sfx const &sfx = _memory->sfx[index];
+void Audio::SetRingTarget(size_t samples){
+    samples = std::max(samples, (size_t)AUDIO_RING_TARGET);
+    samples = std::min(samples, (size_t)(AUDIO_RING_SIZE - AUDIO_BLOCK_SIZE));
 
-    // Speed must be 1—255 otherwise the SFX is invalid
-    int const speed = max(1, (int)sfx.speed);
+    _ringTarget.store(samples, std::memory_order_relaxed);
+}
 
-    float const offset = _memory->_sfxChannels[channel].offset;
-    float const phi = _memory->_sfxChannels[channel].phi;
+audioStats Audio::GetStats(){
+    audioStats stats;
+    stats.underruns = _underruns;
+    stats.underrunSamples = _underrunSamples;
+    stats.droppedCommands = _droppedCommands;
+    stats.bufferedSamples = _samples.Available();
+    stats.latencyMs = stats.bufferedSamples * 1000.f / SAMPLES_PER_SECOND;
 
-    // PICO-8 exports instruments as 22050 Hz WAV files with 183 samples
-    // per speed unit per note, so this is how much we should advance
-    float const offset_per_second = 22050.f / (183.f * speed);
-    float const offset_per_sample = offset_per_second / samples_per_second;
-    float next_offset = offset + offset_per_sample;
+    return stats;
+}
+
+//How far an sfx moves per sample and where it loops. The segment being
+//rendered ends once the offset reaches offset_end.
+struct sfxCursor {
+    float offset_per_sample;
+    bool looping;
+    float loop_start;
+    float loop_range;
+    float offset_end;
+};
+
+//Steps offset by one sample. Returns true when the segment is over, either
+//because the offset reached the end or looped back on itself.
+static inline bool advance(const sfxCursor &cursor, float &offset) {
+    using std::fmod;
+
+    float next_offset = offset + cursor.offset_per_sample;
 
     // Handle SFX loops. From the documentation: “Looping is turned
     // off when the start index >= end index”.
-    float const loop_range = float(sfx.loopRangeEnd - sfx.loopRangeStart);
-    if (loop_range > 0.f && next_offset >= sfx.loopRangeStart && _memory->_sfxChannels[channel].can_loop) {
-        next_offset = fmod(next_offset - sfx.loopRangeStart, loop_range)
-                    + sfx.loopRangeStart;
+    if (cursor.looping && next_offset >= cursor.loop_start) {
+        next_offset = fmod(next_offset - cursor.loop_start, cursor.loop_range) + cursor.loop_start;
     }
 
-    int const note_idx = (int)floor(offset);
-    int const next_note_idx = (int)floor(next_offset);
+    bool looped = next_offset < offset;
+    offset = next_offset;
+
+    return next_offset >= cursor.offset_end || looped;
+}
 
-    uint8_t key = sfx.notes[note_idx].key;
-    float volume = sfx.notes[note_idx].volume / 7.f;
-    float freq = key_to_freq(key);
+//Takes up to max steps of advance() at once, stopping after the one that
+//ends the segment, and returns how many were taken. Like samples_to_play,
+//steps inside a binade all add the same amount unless they round on a tie,
+//so the runs of them that can't reach the end are taken in one go. Inside
+//a loop the fmod is exact until it wraps, and it only wraps on a note end.
+static size_t advance_run(const sfxCursor &cursor, float &offset, size_t max) {
+    if (cursor.offset_per_sample == 0.f) {
+        //a still cursor never ends anything
+        return max;
+    }
 
-    if (volume == 0.f){
-        //volume all the way off. return silence, but make sure to set stuff
-        _memory->_sfxChannels[channel].offset = next_offset;
+    float const limit = cursor.looping ?
+        std::min(cursor.offset_end, cursor.loop_start + cursor.loop_range) : cursor.offset_end;
+    size_t taken = 0;
+
+    while (taken < max) {
+        size_t run = 0;
+        if (offset > 0.f && offset < limit) {
+            int exponent;
+            std::frexp(offset, &exponent);
+            double const top = std::min((double)limit, std::ldexp(1.0, exponent));
+            double const units = cursor.offset_per_sample / std::ldexp(1.0, exponent - 24);
+            double const increment = (offset + cursor.offset_per_sample) - offset;
+
+            if (units - std::floor(units) != 0.5 && increment > 0.0) {
+                //stop a step short of the top, the ulp doubles past it
+                double const fit = std::floor((top - offset) / increment);
+                run = fit > 1.0 ? (size_t)std::min(fit - 1.0, (double)(max - taken)) : 0;
+                offset = (float)(offset + run * increment);
+            }
+        }
 
-        if (next_offset >= 32.f){
-            _memory->_sfxChannels[channel].sfxId = -1;
+        if (run == 0) {
+            taken++;
+            if (advance(cursor, offset)) {
+                break;
+            }
+        }
+        taken += run;
+    }
+
+    return taken;
+}
+
+//Everything about a note that stays the same, or changes linearly, until the
+//next note or effect breakpoint. Effects turn into ramps on the phase step and
+//gain so nothing but adds happen per sample.
+struct noteSegment {
+    sfxCursor sfx;
+    //the custom instrument, when the note uses one
+    sfxCursor instrument;
+    bool silent;
+    //volume with 23 fractional bits, and its change per sample
+    int32_t gain;
+    int32_t gain_delta;
+    int32_t phase_step;
+    int32_t phase_step_delta;
+    //custom instruments and music fades multiply two ramps, which makes a
+    //curve. These are how much the deltas change per sample, with DELTA2_BITS fractional bits
+    //since they are often only a few units
+    int64_t gain_delta2;
+    int64_t phase_step_delta2;
+    const int16_t* table;
+};
+
+#define GAIN_ONE (1 << 23)
+#define DELTA2_BITS 16
+//noise is white and positive only, 0 to 0.4 like z8::synth's
+#define NOISE_AMPLITUDE 13107u
+
+//Renders the channel until the segment ends or count samples are done.
+//Returns the number of samples rendered. The cursors are moved to where the
+//segment stops before rendering, so the loop itself only steps the ramps.
+//Curved segments step the delta2 terms and the instrument cursor, the rest
+//skip both.
+template <int instrument, bool curved>
+static size_t renderNote(sfxChannel &channel, const noteSegment &seg, int16_t* out, size_t count) {
+    float offset = channel.offset;
+    float instrument_offset = channel.instrument.offset;
+    size_t n = advance_run(seg.sfx, offset, count);
+    if (curved) {
+        size_t const instrument_n = advance_run(seg.instrument, instrument_offset, n);
+        if (instrument_n < n) {
+            //the instrument's note ends first
+            offset = channel.offset;
+            n = advance_run(seg.sfx, offset, instrument_n);
+        }
+    }
+
+    uint32_t phase = channel.phase;
+    uint32_t phaser_phase = channel.phaser_phase;
+    uint32_t noise = channel.noise_state;
+    int32_t step = seg.phase_step;
+    int32_t step_delta = seg.phase_step_delta;
+    int32_t gain = seg.gain;
+    int32_t gain_delta = seg.gain_delta;
+    int64_t step_delta_fine = (int64_t)step_delta * ((int64_t)1 << DELTA2_BITS);
+    int64_t gain_delta_fine = (int64_t)gain_delta * ((int64_t)1 << DELTA2_BITS);
+    size_t i = 0;
+
+    //silence leaves the output alone and the ramps are only read here
+    if (seg.silent) {
+        i = n;
+    }
+
+    for (; i < n; i++) {
+        int32_t value;
+        if (instrument == z8::synth::INST_NOISE) {
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            value = (int32_t)(((noise >> 16) * NOISE_AMPLITUDE) >> 16);
         }
-        else if (next_note_idx != note_idx){
-            _memory->_sfxChannels[channel].prev_key = sfx.notes[note_idx].key;
-            _memory->_sfxChannels[channel].prev_vol = sfx.notes[note_idx].volume / 7.f;
+        else if (instrument == z8::synth::INST_PHASER) {
+            value = wavetable_phaser(seg.table, phase, phaser_phase);
+            phaser_phase += (uint32_t)(step >> 7);
         }
+        else {
+            value = wavetable_sample(seg.table, phase);
+        }
+        phase += (uint32_t)step;
+
+        //bit shifted 3 places to lower volume and avoid clipping
+        out[i] = (int16_t)((value * (gain >> 8)) >> 15) >> 3;
+
+        step += step_delta;
+        gain += gain_delta;
+        if (curved) {
+            step_delta_fine += seg.phase_step_delta2;
+            gain_delta_fine += seg.gain_delta2;
+            step_delta = (int32_t)(step_delta_fine >> DELTA2_BITS);
+            gain_delta = (int32_t)(gain_delta_fine >> DELTA2_BITS);
+        }
+    }
 
-        return 0;
+    //the phaser modulation keeps running under other instruments, so catch
+    //it up with the sum of the steps taken
+    if (instrument != z8::synth::INST_PHASER && !seg.silent) {
+        int64_t const steps = (int64_t)i;
+        int64_t const advanced = steps * seg.phase_step + (int64_t)seg.phase_step_delta * steps * (steps - 1) / 2 +
+            ((seg.phase_step_delta2 * steps * (steps - 1) * (steps - 2) / 6) >> DELTA2_BITS);
+        phaser_phase += (uint32_t)(advanced >> 7);
     }
-    
-    //TODO: apply effects
-    //int const fx = sfx.notes[note_id].effect;
 
-    // Play note
-    float waveform = z8::synth::waveform(sfx.notes[note_idx].waveform, phi);
+    channel.offset = offset;
+    channel.instrument.offset = instrument_offset;
+    channel.phase = phase;
+    channel.phaser_phase = phaser_phase;
+    channel.noise_state = noise;
 
-    // Apply master music volume from fade in/out
-    // FIXME: check whether this should be done after distortion
-    //if (_sfxChannels[chan].is_music) {
-    //    volume *= _musicChannel.volume;
-    //}
+    return i;
+}
 
-    sample = (int16_t)(32767.99f * volume * waveform);
+//The lowest offset where scale * offset / offs_per_second reaches target.
+//Effects that step on that value (arpeggios, vibrato corners) end their
+//segment there, on exactly the sample the per sample formula would step.
+static float offset_reaching(float target, float scale, float offs_per_second) {
+    float offset = target * offs_per_second / scale;
+    while (offset > 0.f && scale * offset / offs_per_second >= target) {
+        offset = std::nextafter(offset, 0.f);
+    }
+    while (scale * offset / offs_per_second < target) {
+        offset = std::nextafter(offset, 64.f);
+    }
+    return offset;
+}
 
-    // TODO: Apply hardware effects
-    //if (m_ram.hw_state.distort & (1 << chan)) {
-    //    sample = sample / 0x1000 * 0x1249;
-    //}
+//pitch and volume of a note as ramps
+struct noteRamp {
+    float freq;
+    float freq_delta;
+    float freq_delta2;
+    float vol;
+    float vol_delta;
+    float vol_delta2;
+    float table_key;
+};
+
+static sfxCursor sfx_cursor(struct sfx const &sfx, float offset, bool can_loop) {
+    // Speed must be 1—255 otherwise the SFX is invalid
+    int const speed = std::max(1, (int)sfx.speed);
 
-    _memory->_sfxChannels[channel].phi = phi + freq / samples_per_second;
+    sfxCursor cursor;
+    cursor.offset_per_sample = offset_per_sample(speed);
+    cursor.loop_start = sfx.loopRangeStart;
+    cursor.loop_range = float(sfx.loopRangeEnd - sfx.loopRangeStart);
+    cursor.looping = cursor.loop_range > 0.f && can_loop;
+    cursor.offset_end = std::min(std::floor(offset) + 1.f, 32.f);
 
-    _memory->_sfxChannels[channel].offset = next_offset;
+    return cursor;
+}
 
-    if (next_offset >= 32.f){
-        _memory->_sfxChannels[channel].sfxId = -1;
+//Applies the effect of the note at offset. Keys are moved by key_offset,
+//which is how custom instruments are transposed. May pull cursor.offset_end
+//in to where the effect next steps.
+//adapted from zepto8 sfx.cpp (wtfpl license)
+static noteRamp note_ramp(struct sfx const &sfx, float offset, int prev_key, float prev_vol, float key_offset, sfxCursor &cursor) {
+    using z8::synth;
+
+    int const speed = std::max(1, (int)sfx.speed);
+    float const offs_per_second = 22050.f / (183.f * speed);
+    int const note_idx = (int)std::floor(offset);
+    note const &n = sfx.notes[note_idx];
+    float const volume = n.volume / 7.f;
+
+    //Ramps follow the offset as it is actually stepped in float, which stays
+    //the same within a note past the first one.
+    float const t = offset - note_idx;
+    float const ops = (offset + cursor.offset_per_sample) - offset;
+
+    noteRamp ramp;
+    ramp.table_key = n.key + key_offset;
+    ramp.freq = key_to_freq(ramp.table_key);
+    ramp.freq_delta = 0.f;
+    ramp.freq_delta2 = 0.f;
+    ramp.vol = volume;
+    ramp.vol_delta = 0.f;
+    ramp.vol_delta2 = 0.f;
+
+    switch (n.effect) {
+        case synth::FX_SLIDE:
+        {
+            // From the documentation: “Slide to the next note and volume”,
+            // but it’s actually _from_ the _prev_ note and volume.
+            float const prev_freq = key_to_freq(prev_key + key_offset);
+            ramp.freq_delta = (ramp.freq - prev_freq) * ops;
+            ramp.freq = prev_freq + (ramp.freq - prev_freq) * t;
+            if (prev_vol > 0.f) {
+                ramp.vol_delta = (volume - prev_vol) * ops;
+                ramp.vol = prev_vol + (volume - prev_vol) * t;
+            }
+            ramp.table_key = std::max(ramp.table_key, prev_key + key_offset);
+            break;
+        }
+        case synth::FX_VIBRATO:
+        {
+            // 7.5f and 0.25f were found empirically by matching
+            // frequency graphs of PICO-8 instruments. The triangle is
+            // linear between its corners, so ramp up to the next one.
+            float const x = 7.5f * offset / offs_per_second;
+            float const dx = 7.5f * ops / offs_per_second;
+            float const fx = x - std::floor(x);
+            float const lfo = std::fabs(fx - 0.5f) - 0.25f;
+            // Vibrato half a semi-tone, so multiply by pow(2,1/12)
+            float const depth = ramp.freq * (1.059463094359f - 1.f);
+            ramp.freq_delta = depth * (fx < 0.5f ? -dx : dx);
+            ramp.freq += depth * lfo;
+            float const corner = std::floor(x) + (fx < 0.5f ? 0.5f : 1.f);
+            cursor.offset_end = std::min(cursor.offset_end, offset_reaching(corner, 7.5f, offs_per_second));
+            break;
+        }
+        case synth::FX_DROP:
+            ramp.freq_delta = -ramp.freq * ops;
+            ramp.freq *= 1.f - t;
+            break;
+        case synth::FX_FADE_IN:
+            ramp.vol_delta = volume * ops;
+            ramp.vol = volume * t;
+            break;
+        case synth::FX_FADE_OUT:
+            ramp.vol_delta = -volume * ops;
+            ramp.vol = volume * (1.f - t);
+            break;
+        case synth::FX_ARP_FAST:
+        case synth::FX_ARP_SLOW:
+        {
+            // From the documentation:
+            // 6 arpeggio fast  //  Iterate over groups of 4 notes at speed of 4
+            // 7 arpeggio slow  //  Iterate over groups of 4 notes at speed of 8
+            // “If the SFX speed is <= 8, arpeggio speeds are halved to 2, 4”
+            int const m = (speed <= 8 ? 32 : 16) / (n.effect == synth::FX_ARP_FAST ? 4 : 8);
+            float const y = m * 7.5f * offset / offs_per_second;
+            int const arp_note = (note_idx & ~3) | ((int)y & 3);
+            ramp.table_key = sfx.notes[arp_note].key + key_offset;
+            ramp.freq = key_to_freq(ramp.table_key);
+            cursor.offset_end = std::min(cursor.offset_end, offset_reaching(std::floor(y) + 1.f, m * 7.5f, offs_per_second));
+            break;
+        }
+    }
+
+    return ramp;
+}
+
+//Sets up the custom instrument a note plays, restarting it when the note
+//changes unless the new note slides on the same instrument. Fills seg and
+//returns the instrument's ramp with the note's own ramp applied on top.
+static noteRamp instrument_ramp(struct sfx const *sfxs, sfxChannel &chan, note const &n, int note_idx, noteRamp const &outer, noteSegment &seg) {
+    instrumentVoice &voice = chan.instrument;
+
+    if (voice.note_idx != note_idx) {
+        if (voice.sfxId != n.waveform || n.effect != z8::synth::FX_SLIDE) {
+            voice.sfxId = n.waveform;
+            voice.offset = 0.f;
+            voice.prev_key = 24;
+            voice.prev_vol = 0.f;
+        }
+        voice.note_idx = note_idx;
     }
-    else if (next_note_idx != note_idx){
-        _memory->_sfxChannels[channel].prev_key = sfx.notes[note_idx].key;
-        _memory->_sfxChannels[channel].prev_vol = sfx.notes[note_idx].volume / 7.f;
+
+    noteRamp ramp = {outer.freq, 0.f, 0.f, 0.f, 0.f, 0.f, outer.table_key};
+    seg.instrument = {0.f, false, 0.f, 0.f, 64.f};
+
+    if (voice.offset >= 32.f) {
+        //the instrument finished, it stays quiet until the next note
+        return ramp;
     }
 
-    return sample;
+    struct sfx const &sfx = sfxs[voice.sfxId];
+    seg.instrument = sfx_cursor(sfx, voice.offset, true);
+    //the instrument plays its notes relative to c-2
+    float const key_offset = n.key - 24;
+    noteRamp inner = note_ramp(sfx, voice.offset, voice.prev_key, voice.prev_vol, key_offset, seg.instrument);
+
+    //the note's effects scale the instrument's pitch and volume
+    float const base_freq = key_to_freq(n.key);
+    float const ratio = outer.freq / base_freq;
+    float const ratio_delta = outer.freq_delta / base_freq;
+
+    //(a + a'i)(b + b'i) steps by ab' + a'b + a'b' at first, and that step
+    //grows by 2a'b' every sample
+    ramp.freq = inner.freq * ratio;
+    ramp.freq_delta = inner.freq_delta * ratio + inner.freq * ratio_delta + inner.freq_delta * ratio_delta;
+    ramp.freq_delta2 = 2.f * inner.freq_delta * ratio_delta;
+    ramp.vol = inner.vol * outer.vol;
+    ramp.vol_delta = inner.vol_delta * outer.vol + inner.vol * outer.vol_delta + inner.vol_delta * outer.vol_delta;
+    ramp.vol_delta2 = 2.f * inner.vol_delta * outer.vol_delta;
+    ramp.table_key = inner.table_key + (outer.table_key - n.key);
+
+    return ramp;
+}
+
+void Audio::renderChannel(int channel, int16_t* out, size_t count){
+    using z8::synth;
+
+    sfxChannel &chan = _memory->_sfxChannels[channel];
+    size_t done = 0;
+
+    while (done < count && chan.sfxId >= 0 && chan.sfxId <= 63) {
+        struct sfx const &sfx = _memory->sfx[chan.sfxId];
+
+        noteSegment seg;
+        seg.sfx = sfx_cursor(sfx, chan.offset, chan.can_loop);
+
+        int const note_idx = (int)std::floor(chan.offset);
+        note const &n = sfx.notes[note_idx];
+        noteRamp ramp = note_ramp(sfx, chan.offset, chan.prev_key, chan.prev_vol, 0.f, seg.sfx);
+
+        size_t left = count - done;
+        int waveform = n.waveform;
+        bool const custom = n.custom;
+        int instrument_note = -1;
+        bool silent = false;
+
+        if (custom) {
+            ramp = instrument_ramp(_memory->sfx, chan, n, note_idx, ramp, seg);
+            if (chan.instrument.offset < 32.f) {
+                instrument_note = (int)std::floor(chan.instrument.offset);
+                note const &inner = _memory->sfx[chan.instrument.sfxId].notes[instrument_note];
+                //instruments can't nest, their custom notes play the base waveform
+                waveform = inner.waveform;
+            }
+            else {
+                silent = true;
+            }
+        }
+        else {
+            chan.instrument = instrumentVoice();
+        }
+
+        //music fades multiply the volume by another ramp
+        bool curved = custom;
+        musicChannel const &music = _memory->_musicChannel;
+        if (chan.is_music && music.pattern != -1 && (music.volume != 1.f || music.volume_step != 0.f)) {
+            float const music_delta = music.volume_step / SAMPLES_PER_SECOND;
+            float const music_vol = music.volume + music_delta * done;
+            //custom instruments already curve, the cubic term that makes is
+            //too small to hear over one segment
+            ramp.vol_delta2 = ramp.vol_delta2 * music_vol + 2.f * ramp.vol_delta * music_delta;
+            ramp.vol_delta = ramp.vol_delta * music_vol + ramp.vol * music_delta + ramp.vol_delta * music_delta;
+            ramp.vol *= music_vol;
+            curved = true;
+        }
+
+        if (!custom) {
+            //curved rendering steps an instrument too, keep it still
+            seg.instrument = {0.f, false, 0.f, 0.f, FLT_MAX};
+        }
+
+        seg.silent = silent || (ramp.vol == 0.f && ramp.vol_delta == 0.f);
+        seg.gain = (int32_t)(GAIN_ONE * ramp.vol);
+        seg.gain_delta = (int32_t)std::lround(GAIN_ONE * ramp.vol_delta);
+        seg.phase_step = (int32_t)wavetable_phase_step(ramp.freq, SAMPLES_PER_SECOND);
+        seg.phase_step_delta = (int32_t)std::lround(ramp.freq_delta / SAMPLES_PER_SECOND * 4294967296.0);
+        seg.gain_delta2 = std::llround((double)GAIN_ONE * (1 << DELTA2_BITS) * ramp.vol_delta2);
+        seg.phase_step_delta2 = std::llround(ramp.freq_delta2 / SAMPLES_PER_SECOND * 4294967296.0 * (1 << DELTA2_BITS));
+        seg.table = wavetable_get(waveform, ramp.table_key);
+
+        // TODO: Apply hardware effects
+        //if (m_ram.hw_state.distort & (1 << chan)) {
+        //    sample = sample / 0x1000 * 0x1249;
+        //}
+
+        int16_t* segOut = out + done;
+        if (curved) {
+            switch (waveform) {
+                case synth::INST_TRIANGLE:   done += renderNote<synth::INST_TRIANGLE, true>(chan, seg, segOut, left); break;
+                case synth::INST_TILTED_SAW: done += renderNote<synth::INST_TILTED_SAW, true>(chan, seg, segOut, left); break;
+                case synth::INST_SAW:        done += renderNote<synth::INST_SAW, true>(chan, seg, segOut, left); break;
+                case synth::INST_SQUARE:     done += renderNote<synth::INST_SQUARE, true>(chan, seg, segOut, left); break;
+                case synth::INST_PULSE:      done += renderNote<synth::INST_PULSE, true>(chan, seg, segOut, left); break;
+                case synth::INST_ORGAN:      done += renderNote<synth::INST_ORGAN, true>(chan, seg, segOut, left); break;
+                case synth::INST_NOISE:      done += renderNote<synth::INST_NOISE, true>(chan, seg, segOut, left); break;
+                default:                     done += renderNote<synth::INST_PHASER, true>(chan, seg, segOut, left); break;
+            }
+        }
+        else {
+            switch (waveform) {
+                case synth::INST_TRIANGLE:   done += renderNote<synth::INST_TRIANGLE, false>(chan, seg, segOut, left); break;
+                case synth::INST_TILTED_SAW: done += renderNote<synth::INST_TILTED_SAW, false>(chan, seg, segOut, left); break;
+                case synth::INST_SAW:        done += renderNote<synth::INST_SAW, false>(chan, seg, segOut, left); break;
+                case synth::INST_SQUARE:     done += renderNote<synth::INST_SQUARE, false>(chan, seg, segOut, left); break;
+                case synth::INST_PULSE:      done += renderNote<synth::INST_PULSE, false>(chan, seg, segOut, left); break;
+                case synth::INST_ORGAN:      done += renderNote<synth::INST_ORGAN, false>(chan, seg, segOut, left); break;
+                case synth::INST_NOISE:      done += renderNote<synth::INST_NOISE, false>(chan, seg, segOut, left); break;
+                default:                     done += renderNote<synth::INST_PHASER, false>(chan, seg, segOut, left); break;
+            }
+        }
+
+        if (instrument_note >= 0) {
+            instrumentVoice &voice = chan.instrument;
+            if ((int)std::floor(voice.offset) != instrument_note) {
+                note const &inner = _memory->sfx[voice.sfxId].notes[instrument_note];
+                voice.prev_key = inner.key;
+                voice.prev_vol = inner.volume / 7.f;
+            }
+        }
+
+        if (chan.offset >= 32.f) {
+            chan.sfxId = -1;
+        }
+        else if ((int)std::floor(chan.offset) != note_idx) {
+            chan.prev_key = n.key;
+            chan.prev_vol = n.volume / 7.f;
+        }
+    }
 }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "PicoRam.h"
+#include "spscRing.h"
 
 #include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #define MAX_SFX = 64
 #define BYTES_PER_SFX = 68;
@@ -74,19 +78,98 @@ note is encoded in 16 bits, LSB first, like so:
 //this is also defined in audio? should probably consolidate
 
 
+#define SAMPLES_PER_SECOND 22050
+
+//samples rendered per channel at a time
+#define AUDIO_BLOCK_SIZE 256
+
+//stereo samples the render thread can get ahead of the host by, and how far
+//ahead it tries to stay by default. Anything queued is latency for sfx()
+//calls. Hosts with bigger buffers raise the target with SetRingTarget.
+#define AUDIO_RING_SIZE 8192
+#define AUDIO_RING_TARGET 1024
+
+//longest a host read waits for the render thread before padding with silence
+#define AUDIO_READ_WAIT_MS 4
+
+#define AUDIO_COMMAND_QUEUE_SIZE 64
+
+//an sfx() or music() call on its way from the vm to the mixer
+struct audioCommand {
+    bool music;
+    int id;
+    //channel and offset for sfx, fade length and channel mask for music
+    int arg1;
+    int arg2;
+};
+
+struct audioStats {
+    //host reads the ring couldn't fill, and the silent samples they got
+    uint32_t underruns;
+    uint32_t underrunSamples;
+    //sfx() and music() calls lost to a full queue
+    uint32_t droppedCommands;
+    size_t bufferedSamples;
+    float latencyMs;
+};
+
 class Audio {
     PicoRam* _memory;
 
-    int16_t getSampleForChannel(int channel);
+    SpscRing<audioCommand, AUDIO_COMMAND_QUEUE_SIZE> _commands;
+    SpscRing<uint32_t, AUDIO_RING_SIZE> _samples;
 
+    std::thread _thread;
+    std::atomic<bool> _threadRunning{false};
+    //held by the render thread for each block it mixes
+    std::mutex _mixerLock;
+    std::atomic<size_t> _ringTarget{AUDIO_RING_TARGET};
+
+    std::atomic<uint32_t> _underruns{0};
+    std::atomic<uint32_t> _underrunSamples{0};
+    std::atomic<uint32_t> _droppedCommands{0};
+
+    void renderThread();
+    void applyCommands();
+
+    size_t musicRun(size_t count);
+    void advanceMusic(size_t count);
+    void renderChannel(int channel, int16_t* out, size_t count);
+
+    void play_sfx(int sfx, int channel, int offset);
+    void play_music(int pattern, int16_t fade_len, int16_t mask);
     void set_music_pattern(int pattern);
     
     public:
     Audio(PicoRam* memory);
+    ~Audio();
 
+    //vm side. These only queue the call, it takes effect when the mixer
+    //renders its next block
     void api_sfx(int sfx, int channel, int offset);
     void api_music(int pattern, int16_t fade_len, int16_t mask);
 
+    //renders straight into audioBuffer on the calling thread. Only use this
+    //while the render thread is stopped
     void FillAudioBuffer(void *audioBuffer,size_t offset, size_t size);
+
+    //the render thread owns the sfx channels and music state in PicoRam while
+    //it runs, so stop it before resetting or reloading them
+    void StartThread();
+    void StopThread();
+    //keeps the render thread from starting another block and applies calls
+    //still queued, so PicoRam holds all of the audio state for as long as
+    //the lock is held
+    std::unique_lock<std::mutex> HoldMixer();
+
+    //host side, copies size rendered samples out of the ring, padding with
+    //silence if the render thread has fallen behind
+    void ReadAudioBuffer(void *audioBuffer, size_t size);
+
+    //how many samples the render thread keeps queued. Needs to cover the
+    //biggest single read the host makes
+    void SetRingTarget(size_t samples);
+
+    audioStats GetStats();
 };
 
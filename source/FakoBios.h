@@ -9,8 +9,7 @@ const char * fake08BiosP8 = R"#(
 pico-8 cartridge // http://www.pico-8.com
 version 27
 __lua__
---carts hardcoded for now
-local carts={}
+--cart info is paged in from the cart index as needed
 local numcarts = 0
 
 local cidx=0
@@ -20,20 +19,31 @@ local linebuffer=""
 local line
 local bgcolor=5
 local runcmd=false
+local showstats=false
 
 
 function _init()
-	if __listcarts then
-		carts = __listcarts()
-		numcarts = #carts
+	if __cartcount then
+		numcarts = __cartcount()
 	end
 
 	if __getbioserror then
 		linebuffer = __getbioserror()
 	end
 
+	if __profiling then
+		showstats = __profiling()
+	end
+
 	cls(bgcolor)
 	spr(0, 1, 5, 6, 1)
+	drawtop()
+	-- 18 pixels from cursor() call, then 
+	-- 11 lines of text
+	line=84
+end
+
+function drawwelcome()
 	color(6)
 	cursor(0, 6*3)
 	print("welcome to fake-08")
@@ -50,10 +60,39 @@ function _init()
 	end
 	print("r to cycle screen sizes")
 	print("l + r to exit")
-	print("")
-	-- 18 pixels from cursor() call, then 
-	-- 24 more from 4 print calls
-	line=84
+	print("⬇️ to toggle profiling")
+end
+
+--api calls per frame of the last cart loaded with profiling on
+function drawstats()
+	color(6)
+	cursor(0, 6*3)
+	local stats = __apistats()
+	if not stats then
+		print("profiling on")
+		print("carts loaded from now on are")
+		print("profiled. come back here to")
+		print("see their api calls. lua")
+		print("stacks go in lastprofile.folded")
+		return
+	end
+	print("api calls/frame, "..stats.frames.." frames")
+	color(7)
+	for i = 1, min(#stats, 10) do
+		local s = stats[i]
+		print(s.name, 0, 18 + i * 6)
+		print(flr(s.calls * 10) / 10, 48, 18 + i * 6)
+		print(flr(s.ms * 1000) / 1000 .. "ms", 84, 18 + i * 6)
+	end
+end
+
+function drawtop()
+	rectfill(0, 6*3, 127, 83, bgcolor)
+	if showstats then
+		drawstats()
+	else
+		drawwelcome()
+	end
 end
 
 function _update60()
@@ -70,6 +109,10 @@ function _update60()
 		--ls()
 		linebuffer = "ls"
 	end
+	if btnp(3) and __profiling then
+		showstats = __profiling(not __profiling())
+		drawtop()
+	end
 	if btnp(4) then
 		linebuffer = ""
 	end
@@ -79,7 +122,7 @@ function _update60()
 	end
 	
 	if cidx > 0 and cidx <= numcarts then
-		carttoload = carts[cidx]
+		carttoload = __cartinfo(cidx)
 		linebuffer = "load " .. carttoload
 	else
 		carttoload = ""
@@ -97,7 +140,14 @@ function _update60()
 end
 
 function _draw()
-	rectfill(0, line, 128, line+5, bgcolor)
+	rectfill(0, line, 128, 127, bgcolor)
+	if cidx > 0 and cidx <= numcarts then
+		local path, title, author = __cartinfo(cidx)
+		__drawcartlabel(cidx, 92, 92, 32)
+		color(6)
+		print(sub(title, 1, 22), 0, line+8)
+		print(sub(author, 1, 22), 0, line+14)
+	end
 	color(7)
 	print("> "..linebuffer, 0, line)
 	if t%30<15 then
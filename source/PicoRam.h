@@ -46,7 +46,9 @@ struct note {
             uint16_t key : 6;
             uint16_t waveform : 3;
             uint16_t volume : 3;
-            uint16_t effect : 4;
+            uint16_t effect : 3;
+            //waveform is one of sfx 0-7 played as an instrument
+            uint16_t custom : 1;
         };
         
         uint8_t data[2];
@@ -77,18 +79,38 @@ struct musicChannel {
     uint8_t mask = 0xf;
     uint8_t speed = 0;
     float volume = 0.f;
+    //volume change per second while fading
     float volume_step = 0.f;
-    float offset = 0.f;
+    //samples until the fastest sfx of the pattern plays its last note
+    uint32_t samples_left = 0;
+};
+
+//An sfx played as a custom instrument by the note a channel is on. Notes
+//inside an instrument can't use custom instruments themselves, so a channel
+//never needs more than this one voice and mixing never has to allocate.
+struct instrumentVoice {
+    int8_t sfxId = -1;
+    //note of the channel's sfx that started this voice
+    int8_t note_idx = -1;
+    float offset = 0;
+    int8_t prev_key = 24;
+    float prev_vol = 0;
 };
 
 struct sfxChannel {
     int16_t sfxId = -1;
     float offset = 0;
-    float phi = 0;
+    //oscillator phase, 1 << 32 is one cycle
+    uint32_t phase = 0;
+    //phaser modulation, runs at 1/128th of phase
+    uint32_t phaser_phase = 0;
+    //xorshift state for the noise instrument, never 0
+    uint32_t noise_state = 1;
     bool can_loop = true;
     bool is_music = false;
     int8_t prev_key = 0;
     float prev_vol = 0;
+    instrumentVoice instrument;
 };
 
 
@@ -129,4 +151,7 @@ struct PicoRam
 	int _gfxState_line_y;
 	bool _gfxState_line_valid;
 
+	//rnd() generator, hardware state at 0x5f44 on pico 8
+	uint32_t _rngState[2];
+
 };
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "apiProfiler.h"
+
+#include <chrono>
+
+ApiProfiler::ApiProfiler(){
+    _enabled = false;
+    _active = false;
+    _frames = 0;
+}
+
+void ApiProfiler::SetEnabled(bool enabled){
+    _enabled = enabled;
+}
+
+bool ApiProfiler::IsEnabled(){
+    return _enabled;
+}
+
+void ApiProfiler::Start(){
+    _ids.clear();
+    _frame.clear();
+    _lastFrame.clear();
+    _totals.clear();
+    _frames = 0;
+    _active = true;
+}
+
+void ApiProfiler::Stop(){
+    _active = false;
+}
+
+bool ApiProfiler::IsActive(){
+    return _active;
+}
+
+void ApiProfiler::AddFunction(const char* name, lua_CFunction f){
+    if (_ids.count(f)) {
+        return;
+    }
+
+    apiCallStats const empty = {name, 0, 0};
+
+    _ids[f] = _frame.size();
+    _frame.push_back(empty);
+    _lastFrame.push_back(empty);
+    _totals.push_back(empty);
+}
+
+uint64_t ApiProfiler::Now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ApiProfiler::Record(lua_CFunction f, uint64_t ns){
+    //a save state from a profiled session brings the wrapped functions back
+    //even into one that isn't
+    if (!_active) {
+        return;
+    }
+
+    auto const id = _ids.find(f);
+    if (id == _ids.end()) {
+        return;
+    }
+
+    _frame[id->second].calls++;
+    _frame[id->second].ns += ns;
+}
+
+void ApiProfiler::EndFrame(){
+    if (!_active) {
+        return;
+    }
+
+    for (size_t i = 0; i < _frame.size(); i++) {
+        _totals[i].calls += _frame[i].calls;
+        _totals[i].ns += _frame[i].ns;
+        _lastFrame[i] = _frame[i];
+        _frame[i].calls = 0;
+        _frame[i].ns = 0;
+    }
+    _frames++;
+}
+
+std::vector<apiCallStats> ApiProfiler::GetLastFrame(){
+    return _lastFrame;
+}
+
+std::vector<apiCallStats> ApiProfiler::GetTotals(){
+    return _totals;
+}
+
+uint32_t ApiProfiler::GetFrames(){
+    return _frames;
+}
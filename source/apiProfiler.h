@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+extern "C" {
+  #include <lua.h>
+}
+
+//calls to one api function and the time spent in them
+struct apiCallStats {
+    const char* name;
+    uint32_t calls;
+    uint64_t ns;
+};
+
+//Counts calls to each pico 8 api function and how long they took, per frame
+//and over the whole cart. Off by default: carts loaded while it is off get
+//the plain functions and pay nothing. Carts loaded while it is on get every
+//api function wrapped in one that times it (see registerApiFunction in
+//picoluaapi.h). The bios is never profiled, so what it shows is the last
+//cart that was.
+class ApiProfiler {
+    bool _enabled;
+    bool _active;
+
+    std::unordered_map<lua_CFunction, int> _ids;
+    //indexed by _ids
+    std::vector<apiCallStats> _frame;
+    std::vector<apiCallStats> _lastFrame;
+    std::vector<apiCallStats> _totals;
+    uint32_t _frames;
+
+    public:
+    ApiProfiler();
+
+    //takes effect from the next cart load
+    void SetEnabled(bool enabled);
+    bool IsEnabled();
+
+    //a profiled cart is loading, forgets the last one's numbers
+    void Start();
+    //the profiled cart closed, its numbers stay readable
+    void Stop();
+    //whether the running cart is being profiled
+    bool IsActive();
+
+    //a function registered under several names is counted under the first
+    void AddFunction(const char* name, lua_CFunction f);
+    static uint64_t Now();
+    void Record(lua_CFunction f, uint64_t ns);
+    void EndFrame();
+
+    //every function the cart has, in AddFunction order, including ones it
+    //never called
+    std::vector<apiCallStats> GetLastFrame();
+    std::vector<apiCallStats> GetTotals();
+    uint32_t GetFrames();
+};
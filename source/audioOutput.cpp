@@ -0,0 +1,148 @@
+#include "audioOutput.h"
+#include "Audio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+//underruns widen the margin over the worst interval, up to a point
+#define AUDIO_OUTPUT_HEADROOM 1.5
+#define AUDIO_OUTPUT_HEADROOM_STEP 0.25
+#define AUDIO_OUTPUT_MAX_HEADROOM 3.0
+//and come back down a step at a time with this long between underruns
+#define AUDIO_OUTPUT_HEADROOM_DECAY_MS 5000.0
+
+//per Service() call, a long frame is forgotten over a few seconds
+#define AUDIO_OUTPUT_INTERVAL_DECAY 0.99
+
+AudioOutput::AudioOutput(int deviceRate, int bufferCount, size_t maxBufferSamples, audioSource source){
+    _deviceRate = deviceRate;
+    _bufferCount = std::max(bufferCount, 2);
+    _maxBufferSamples = std::max(maxBufferSamples, (size_t)AUDIO_OUTPUT_GRANULARITY);
+    _source = source;
+
+    //until there's something to measure, assume 30fps
+    _worstIntervalMs = 1000.0 / 30;
+    _headroom = AUDIO_OUTPUT_HEADROOM;
+    _calmMs = 0.0;
+    _bufferSamples = _maxBufferSamples;
+
+    _started = false;
+    _lastServiceUs = 0;
+    _buffersQueued = 0;
+    _underruns = 0;
+
+    _step = (uint32_t)(((uint64_t)SAMPLES_PER_SECOND << 16) / deviceRate);
+    _position = 0;
+    _previous = 0;
+    _next = 0;
+    if (_step != 1 << 16) {
+        _sourceBuffer.resize((((uint64_t)_maxBufferSamples * _step + 0xffff) >> 16) + 1);
+    }
+
+    Service(_worstIntervalMs, 0);
+}
+
+void AudioOutput::Service(int buffersQueued){
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    double intervalMs = _lastServiceUs ? (now - _lastServiceUs) / 1000.0 : 0.0;
+    _lastServiceUs = now;
+
+    Service(intervalMs, buffersQueued);
+}
+
+void AudioOutput::Service(double intervalMs, int buffersQueued){
+    _buffersQueued = buffersQueued;
+
+    if (_started && buffersQueued == 0) {
+        _underruns++;
+        _calmMs = 0.0;
+        //like a cart loading, no margin would have covered it
+        if (intervalMs <= AUDIO_OUTPUT_MAX_INTERVAL_MS) {
+            _headroom = std::min(_headroom + AUDIO_OUTPUT_HEADROOM_STEP, AUDIO_OUTPUT_MAX_HEADROOM);
+        }
+    }
+    else if (_headroom > AUDIO_OUTPUT_HEADROOM) {
+        _calmMs += intervalMs;
+        if (_calmMs >= AUDIO_OUTPUT_HEADROOM_DECAY_MS) {
+            _headroom = std::max(_headroom - AUDIO_OUTPUT_HEADROOM_STEP, AUDIO_OUTPUT_HEADROOM);
+            _calmMs = 0.0;
+        }
+    }
+
+    intervalMs = std::min(intervalMs, AUDIO_OUTPUT_MAX_INTERVAL_MS);
+    _worstIntervalMs = std::max(intervalMs, _worstIntervalMs * AUDIO_OUTPUT_INTERVAL_DECAY);
+
+    //the buffer playing when the host comes back may be almost done, so the
+    //others have to cover the whole gap between passes on their own
+    double samples = _worstIntervalMs * _headroom * _deviceRate / 1000.0 / (_bufferCount - 1);
+
+    size_t size = (size_t)std::ceil(samples / AUDIO_OUTPUT_GRANULARITY) * AUDIO_OUTPUT_GRANULARITY;
+    size = std::max(size, (size_t)AUDIO_OUTPUT_MIN_BUFFER);
+    _bufferSamples = std::min(size, _maxBufferSamples);
+}
+
+size_t AudioOutput::NextBufferSize(){
+    return _bufferSamples;
+}
+
+size_t AudioOutput::SourceSamplesPerBuffer(){
+    return (((uint64_t)_bufferSamples * _step) >> 16) + 1;
+}
+
+static inline uint32_t lerpStereo(uint32_t a, uint32_t b, uint32_t position) {
+    //15 bits of position keeps the products inside an int32
+    int32_t t = position >> 1;
+
+    int32_t leftA = (int16_t)(a & 0xffff);
+    int32_t leftB = (int16_t)(b & 0xffff);
+    int32_t rightA = (int16_t)(a >> 16);
+    int32_t rightB = (int16_t)(b >> 16);
+
+    int32_t left = leftA + (((leftB - leftA) * t) >> 15);
+    int32_t right = rightA + (((rightB - rightA) * t) >> 15);
+
+    return ((uint32_t)(uint16_t)right << 16) | (uint16_t)left;
+}
+
+void AudioOutput::Fill(void* deviceBuffer, size_t count){
+    uint32_t* out = (uint32_t*)deviceBuffer;
+    count = std::min(count, _maxBufferSamples);
+    _started = true;
+
+    if (_step == 1 << 16) {
+        _source(out, count);
+        return;
+    }
+
+    //exactly the source samples the position steps over
+    size_t needed = ((uint64_t)_position + (uint64_t)count * _step) >> 16;
+    _source(_sourceBuffer.data(), needed);
+
+    const uint32_t* source = _sourceBuffer.data();
+    for (size_t i = 0; i < count; i++) {
+        out[i] = lerpStereo(_previous, _next, _position);
+
+        _position += _step;
+        while (_position >= 1 << 16) {
+            _previous = _next;
+            _next = *source++;
+            _position -= 1 << 16;
+        }
+    }
+}
+
+audioOutputStats AudioOutput::GetStats(){
+    audioOutputStats stats;
+    stats.underruns = _underruns;
+    stats.bufferCount = _bufferCount;
+    stats.bufferSamples = _bufferSamples;
+    stats.deviceRate = _deviceRate;
+    stats.latencyMs = _buffersQueued * _bufferSamples * 1000.f / _deviceRate;
+    stats.worstIntervalMs = _worstIntervalMs;
+    stats.headroom = _headroom;
+
+    return stats;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+//device buffers are sized in steps of this many samples
+#define AUDIO_OUTPUT_GRANULARITY 64
+#define AUDIO_OUTPUT_MIN_BUFFER 256
+
+//frames longer than this glitch no matter what, so they don't grow buffers
+#define AUDIO_OUTPUT_MAX_INTERVAL_MS 100.0
+
+//fills count stereo samples at 22050hz
+typedef std::function<void(uint32_t* samples, size_t count)> audioSource;
+
+struct audioOutputStats {
+    //times the device had nothing left to play when the host came back to it
+    uint32_t underruns;
+    int bufferCount;
+    size_t bufferSamples;
+    int deviceRate;
+    //queued on the device as of the last Service()
+    float latencyMs;
+    //longest recent gap between Service() calls the buffers are sized for
+    float worstIntervalMs;
+    //multiple of that gap the queue covers
+    float headroom;
+};
+
+//Everything about feeding a host's audio device that isn't specific to the
+//device. The host owns bufferCount buffers of up to maxBufferSamples stereo
+//int16 samples at deviceRate. Once per main loop pass it reports how many
+//are still queued, then fills and queues each free one with NextBufferSize()
+//samples from Fill(). Buffers grow when passes are far apart or the device
+//runs dry, and shrink back slowly once the frame rate is steady and the
+//device has stopped running dry.
+class AudioOutput {
+    int _deviceRate;
+    int _bufferCount;
+    size_t _maxBufferSamples;
+    audioSource _source;
+
+    size_t _bufferSamples;
+    double _worstIntervalMs;
+    //multiple of the worst interval the queue covers, raised by underruns
+    double _headroom;
+    //since the last underrun or the last time headroom came down
+    double _calmMs;
+
+    bool _started;
+    uint64_t _lastServiceUs;
+    int _buffersQueued;
+    uint32_t _underruns;
+
+    //linear resampler, 16.16 position between the previous and next source
+    //samples. Unused when the device runs at 22050hz
+    uint32_t _step;
+    uint32_t _position;
+    uint32_t _previous;
+    uint32_t _next;
+    std::vector<uint32_t> _sourceBuffer;
+
+    public:
+    AudioOutput(int deviceRate, int bufferCount, size_t maxBufferSamples, audioSource source);
+
+    //measures the time since the last call itself
+    void Service(int buffersQueued);
+    void Service(double intervalMs, int buffersQueued);
+
+    size_t NextBufferSize();
+    //source samples a buffer of NextBufferSize() takes, for sizing whatever
+    //the source reads from
+    size_t SourceSamplesPerBuffer();
+
+    void Fill(void* deviceBuffer, size_t count);
+
+    audioOutputStats GetStats();
+};
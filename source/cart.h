@@ -1,22 +1,25 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 #include "graphics.h"
 
 
 class Cart {
-    std::string fullCartText;
-
     void initCartRom();
 
-    void setSpriteSheet(std::string spriteSheetString);
-	void setSpriteFlags(std::string spriteFlagsString);
-	void setMapData(std::string mapString);
+    void appendLua(std::string_view luaText);
+    void setSpriteSheet(std::string_view spriteSheetString);
+	void setSpriteFlags(std::string_view spriteFlagsString);
+	void setMapData(std::string_view mapString);
+    void setLabel(std::string_view labelString);
 
-    void setSfx(std::string sfxString);
-    void setMusic(std::string musicString);
+    void setSfx(std::string_view sfxString);
+    void setMusic(std::string_view musicString);
 
+    void setSection(std::string_view name, std::string_view data);
+    void loadCartFromP8(std::string_view cartText);
     bool loadCartFromPng(std::string filename);
 
     public:
@@ -29,12 +32,6 @@ class Cart {
 
     std::string LoadError;
 
-    std::string SpriteSheetString;
-    std::string SpriteFlagsString;
-    std::string MapString;
-    std::string SfxString;
-    std::string MusicString;
-
     uint8_t SpriteSheetData[128 * 64];
     uint8_t SpriteFlagsData[256];
     uint8_t MapData[128 * 32];
@@ -42,4 +39,8 @@ class Cart {
     struct sfx SfxData[64];
     uint8_t CartLuaData[15616];
 
+    //128x128 label, packed two pixels per byte like the sprite sheet
+    bool HasLabel;
+    uint8_t LabelData[128 * 64];
+
 };
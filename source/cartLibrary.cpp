@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "cartLibrary.h"
+#include "cart.h"
+#include "utils.h"
+#include "logger.h"
+
+#define INDEX_FILENAME ".fake08-cartindex"
+#define INDEX_VERSION 1
+#define LABEL_BYTES (128 * 64)
+
+static const char indexMagic[4] = {'F', '8', 'C', 'I'};
+
+static bool isCartFile(std::string const &filename) {
+    auto endsWith = [&](std::string const &ending) {
+        return filename.length() >= ending.length() &&
+            filename.compare(filename.length() - ending.length(), ending.length(), ending) == 0;
+    };
+
+    return endsWith(".p8") || endsWith(".png");
+}
+
+//FNV-1a over the whole file, read in chunks so big carts don't need a full copy
+static uint32_t hashFile(std::string const &path) {
+    uint32_t hash = 2166136261u;
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return hash;
+    }
+
+    uint8_t buf[4096];
+    size_t read;
+    while ((read = fread(buf, 1, sizeof(buf), file)) > 0) {
+        for (size_t i = 0; i < read; i++) {
+            hash = (hash ^ buf[i]) * 16777619u;
+        }
+    }
+
+    fclose(file);
+
+    return hash;
+}
+
+static bool readValue(FILE* file, void* value, size_t size) {
+    return fread(value, 1, size, file) == size;
+}
+
+static bool readString(FILE* file, std::string &str, size_t len) {
+    str.resize(len);
+    return len == 0 || fread(&str[0], 1, len, file) == len;
+}
+
+static void writeValue(FILE* file, const void* value, size_t size) {
+    fwrite(value, 1, size, file);
+}
+
+//title and author come from the pico 8 convention of starting a cart with
+//-- title
+//-- by author
+static void readTitleAndAuthor(std::string const &lua, std::string &title, std::string &author) {
+    size_t pos = 0;
+
+    for (int lineNum = 0; lineNum < 2 && pos < lua.length(); lineNum++) {
+        size_t end = lua.find('\n', pos);
+        std::string line = utils::trimboth(lua.substr(pos, end == std::string::npos ? std::string::npos : end - pos), " \t\r");
+
+        if (line.compare(0, 2, "--") != 0) {
+            break;
+        }
+
+        std::string text = utils::trimboth(line.substr(2), " \t-");
+        if (lineNum == 0) {
+            title = text.substr(0, 255);
+        }
+        else {
+            if (text.compare(0, 3, "by ") == 0) {
+                text = utils::trimleft(text.substr(3));
+            }
+            author = text.substr(0, 255);
+        }
+
+        if (end == std::string::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+}
+
+
+CartLibrary::CartLibrary(std::string cartDirectory) {
+    _cartDirectory = cartDirectory;
+    _indexPath = cartDirectory + "/" + INDEX_FILENAME;
+    _cachedLabelIdx = -1;
+}
+
+bool CartLibrary::readIndex(std::vector<CartIndexEntry>& entries) {
+    entries.clear();
+
+    FILE* file = fopen(_indexPath.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    uint32_t count = 0;
+    bool valid = readValue(file, magic, sizeof(magic)) &&
+        memcmp(magic, indexMagic, sizeof(magic)) == 0 &&
+        readValue(file, &version, sizeof(version)) &&
+        version == INDEX_VERSION &&
+        readValue(file, &count, sizeof(count));
+
+    for (uint32_t i = 0; valid && i < count; i++) {
+        CartIndexEntry entry;
+        uint16_t pathLen = 0;
+        uint8_t titleLen = 0;
+        uint8_t authorLen = 0;
+        uint8_t hasLabel = 0;
+
+        valid = readValue(file, &pathLen, sizeof(pathLen)) &&
+            readString(file, entry.Path, pathLen) &&
+            readValue(file, &entry.Mtime, sizeof(entry.Mtime)) &&
+            readValue(file, &entry.Size, sizeof(entry.Size)) &&
+            readValue(file, &entry.Hash, sizeof(entry.Hash)) &&
+            readValue(file, &titleLen, sizeof(titleLen)) &&
+            readString(file, entry.Title, titleLen) &&
+            readValue(file, &authorLen, sizeof(authorLen)) &&
+            readString(file, entry.Author, authorLen) &&
+            readValue(file, &hasLabel, sizeof(hasLabel));
+
+        entry.HasLabel = hasLabel;
+        entry.LabelOffset = 0;
+        if (valid && entry.HasLabel) {
+            //skip over the label, it is only read when the bios asks for it
+            entry.LabelOffset = (uint32_t)ftell(file);
+            valid = fseek(file, LABEL_BYTES, SEEK_CUR) == 0;
+        }
+
+        if (valid) {
+            entries.push_back(entry);
+        }
+    }
+
+    fclose(file);
+
+    if (!valid) {
+        Logger::Write("Cart index %s is invalid, rebuilding\n", _indexPath.c_str());
+        entries.clear();
+    }
+
+    return valid;
+}
+
+bool CartLibrary::parseCart(CartIndexEntry& entry, uint8_t* label) {
+    Logger::Write("Indexing cart %s\n", entry.Path.c_str());
+
+    Cart cart(entry.Path);
+
+    entry.Hash = hashFile(entry.Path);
+    entry.Title = "";
+    entry.Author = "";
+    readTitleAndAuthor(cart.LuaString, entry.Title, entry.Author);
+
+    entry.HasLabel = cart.HasLabel;
+    if (cart.HasLabel) {
+        memcpy(label, cart.LabelData, LABEL_BYTES);
+    }
+
+    return cart.LoadError == "";
+}
+
+void CartLibrary::Refresh() {
+    std::vector<CartIndexEntry> previous;
+    readIndex(previous);
+
+    std::map<std::string, size_t> previousByPath;
+    for (size_t i = 0; i < previous.size(); i++) {
+        previousByPath[previous[i].Path] = i;
+    }
+
+    //only stat the files here. carts are parsed below if they are new or changed
+    std::vector<CartIndexEntry> found;
+    DIR* dir = opendir(_cartDirectory.c_str());
+    if (dir) {
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != nullptr) {
+            std::string name = ent->d_name;
+            if (name.length() == 0 || name[0] == '.' || !isCartFile(name)) {
+                continue;
+            }
+
+            CartIndexEntry entry;
+            entry.Path = _cartDirectory + "/" + name;
+
+            struct stat st;
+            if (stat(entry.Path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+
+            entry.Mtime = (int64_t)st.st_mtime;
+            entry.Size = (uint64_t)st.st_size;
+            entry.Hash = 0;
+            entry.HasLabel = false;
+            entry.LabelOffset = 0;
+            found.push_back(entry);
+        }
+
+        closedir(dir);
+    }
+
+    std::sort(found.begin(), found.end(), [](const CartIndexEntry& a, const CartIndexEntry& b) {
+        return a.Path < b.Path;
+    });
+
+    bool changed = found.size() != previous.size();
+    std::vector<int> reuse(found.size(), -1);
+    for (size_t i = 0; i < found.size(); i++) {
+        auto prev = previousByPath.find(found[i].Path);
+        if (prev != previousByPath.end() &&
+            previous[prev->second].Mtime == found[i].Mtime &&
+            previous[prev->second].Size == found[i].Size)
+        {
+            reuse[i] = (int)prev->second;
+        }
+        else {
+            changed = true;
+        }
+    }
+
+    _cachedLabelIdx = -1;
+
+    if (!changed) {
+        Logger::Write("Cart index up to date (%d carts)\n", (int)previous.size());
+        _entries = previous;
+        return;
+    }
+
+    //write the new index next to the old one, streaming labels across so
+    //only one label is in memory at a time
+    std::string tmpPath = _indexPath + ".tmp";
+    FILE* oldIndex = fopen(_indexPath.c_str(), "rb");
+    FILE* out = fopen(tmpPath.c_str(), "wb");
+
+    if (!out) {
+        Logger::Write("Unable to write cart index %s\n", tmpPath.c_str());
+    }
+    else {
+        uint32_t version = INDEX_VERSION;
+        uint32_t count = (uint32_t)found.size();
+        writeValue(out, indexMagic, sizeof(indexMagic));
+        writeValue(out, &version, sizeof(version));
+        writeValue(out, &count, sizeof(count));
+    }
+
+    _entries.clear();
+    uint8_t label[LABEL_BYTES];
+
+    for (size_t i = 0; i < found.size(); i++) {
+        CartIndexEntry entry = found[i];
+
+        if (reuse[i] >= 0) {
+            entry = previous[reuse[i]];
+            if (entry.HasLabel) {
+                entry.HasLabel = oldIndex &&
+                    fseek(oldIndex, entry.LabelOffset, SEEK_SET) == 0 &&
+                    fread(label, 1, LABEL_BYTES, oldIndex) == LABEL_BYTES;
+            }
+        }
+        else {
+            parseCart(entry, label);
+        }
+
+        if (out) {
+            uint16_t pathLen = (uint16_t)entry.Path.length();
+            uint8_t titleLen = (uint8_t)entry.Title.length();
+            uint8_t authorLen = (uint8_t)entry.Author.length();
+            uint8_t hasLabel = entry.HasLabel;
+
+            writeValue(out, &pathLen, sizeof(pathLen));
+            writeValue(out, entry.Path.c_str(), pathLen);
+            writeValue(out, &entry.Mtime, sizeof(entry.Mtime));
+            writeValue(out, &entry.Size, sizeof(entry.Size));
+            writeValue(out, &entry.Hash, sizeof(entry.Hash));
+            writeValue(out, &titleLen, sizeof(titleLen));
+            writeValue(out, entry.Title.c_str(), titleLen);
+            writeValue(out, &authorLen, sizeof(authorLen));
+            writeValue(out, entry.Author.c_str(), authorLen);
+            writeValue(out, &hasLabel, sizeof(hasLabel));
+
+            if (entry.HasLabel) {
+                entry.LabelOffset = (uint32_t)ftell(out);
+                writeValue(out, label, LABEL_BYTES);
+            }
+        }
+        else {
+            //nowhere to read labels back from
+            entry.HasLabel = false;
+        }
+
+        _entries.push_back(entry);
+    }
+
+    if (oldIndex) {
+        fclose(oldIndex);
+    }
+
+    if (out) {
+        fclose(out);
+        //rename won't replace an existing file on every platform
+        remove(_indexPath.c_str());
+        if (rename(tmpPath.c_str(), _indexPath.c_str()) != 0) {
+            Logger::Write("Unable to replace cart index %s\n", _indexPath.c_str());
+            for (auto& entry : _entries) {
+                entry.HasLabel = false;
+            }
+        }
+    }
+
+    Logger::Write("Cart index rebuilt (%d carts)\n", (int)_entries.size());
+}
+
+size_t CartLibrary::GetCartCount() {
+    return _entries.size();
+}
+
+const CartIndexEntry* CartLibrary::GetEntry(size_t idx) {
+    if (idx >= _entries.size()) {
+        return nullptr;
+    }
+
+    return &_entries[idx];
+}
+
+const uint8_t* CartLibrary::GetLabel(size_t idx) {
+    if (idx >= _entries.size() || !_entries[idx].HasLabel) {
+        return nullptr;
+    }
+
+    if (_cachedLabelIdx == (int)idx) {
+        return _cachedLabel;
+    }
+
+    FILE* file = fopen(_indexPath.c_str(), "rb");
+    if (!file) {
+        return nullptr;
+    }
+
+    bool read = fseek(file, _entries[idx].LabelOffset, SEEK_SET) == 0 &&
+        fread(_cachedLabel, 1, LABEL_BYTES, file) == LABEL_BYTES;
+
+    fclose(file);
+
+    if (!read) {
+        _cachedLabelIdx = -1;
+        return nullptr;
+    }
+
+    _cachedLabelIdx = (int)idx;
+
+    return _cachedLabel;
+}
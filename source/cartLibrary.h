@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//one cart in the library index. Labels stay on disk until asked for
+struct CartIndexEntry {
+    std::string Path;
+    int64_t Mtime;
+    uint64_t Size;
+    uint32_t Hash;
+
+    std::string Title;
+    std::string Author;
+
+    bool HasLabel;
+    //offset of the packed 128x128 label inside the index file
+    uint32_t LabelOffset;
+};
+
+//Persistent index of the carts in the cart directory, so startup doesn't
+//have to parse every cart. Refresh() only re-parses carts whose mtime or
+//size changed since the index was written; everything else (including the
+//label thumbnails) is copied over from the previous index file.
+class CartLibrary {
+    std::string _cartDirectory;
+    std::string _indexPath;
+
+    std::vector<CartIndexEntry> _entries;
+
+    int _cachedLabelIdx;
+    uint8_t _cachedLabel[128 * 64];
+
+    bool readIndex(std::vector<CartIndexEntry>& entries);
+    bool parseCart(CartIndexEntry& entry, uint8_t* label);
+
+    public:
+    CartLibrary(std::string cartDirectory);
+
+    //loads the index file and brings it up to date with the cart directory
+    void Refresh();
+
+    size_t GetCartCount();
+    const CartIndexEntry* GetEntry(size_t idx);
+
+    //reads the label for the entry from the index file. returns nullptr if the cart has none
+    const uint8_t* GetLabel(size_t idx);
+};
@@ -61,7 +61,7 @@ const char * patchLuaFunction = R"#(
 )#";
 
 
-const char* getPatchedLua(const char* unpatchedLua){
+std::string getPatchedLua(const std::string& unpatchedLua){
 
     lua_State* L;
 
@@ -72,11 +72,14 @@ const char* getPatchedLua(const char* unpatchedLua){
 
     lua_getglobal(L, "patch_lua");
 
-    lua_pushstring(L, unpatchedLua);
+    lua_pushlstring(L, unpatchedLua.c_str(), unpatchedLua.length());
 
-    lua_pcall(L, 1, 1, 0);
+    int error = lua_pcall(L, 1, 1, 0);
 
-    const char* result = lua_tostring(L, -1);
+    //copy the result out before the state (and the string with it) is freed
+    size_t length = 0;
+    const char* patched = error ? nullptr : lua_tolstring(L, -1, &length);
+    std::string result = patched ? std::string(patched, length) : unpatchedLua;
 
     lua_pop(L,1);
 
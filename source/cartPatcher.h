@@ -1,3 +1,5 @@
 #pragma once
 
-const char* getPatchedLua(const char* unpatchedLua);
+#include <string>
+
+std::string getPatchedLua(const std::string& unpatchedLua);
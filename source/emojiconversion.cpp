@@ -1,10 +1,14 @@
 #include <string>
-#include <map>
+#include <string_view>
+#include <cstring>
 
 #include "emojiconversion.h"
-#include "utf8-util.h"
 
-std::map<char32_t, uint8_t> emoji = {
+//utf8 codepoints of the p8scii characters, as pico 8 writes them in .p8 files
+static const struct {
+    char32_t codepoint;
+    uint8_t p8scii;
+} emoji[] = {
     {0x025ae, 0x10}, {0x025a0, 0x11}, {0x025a1, 0x12}, {0x02059, 0x13}, {0x02058, 0x14},
     {0x02016, 0x15}, {0x025c0, 0x16}, {0x025b6, 0x17}, {0x0300c, 0x18}, {0x0300d, 0x19},
     {0x000a5, 0x1a}, {0x02022, 0x1b}, {0x03001, 0x1c}, {0x03002, 0x1d}, {0x0309b, 0x1e},
@@ -55,17 +59,173 @@ std::map<char32_t, uint8_t> emoji = {
     {0x030e3, 0xfb}, {0x030e5, 0xfc}, {0x030e7, 0xfd}, {0x025dc, 0xfe}, {0x025dd, 0xff},
 };
 
-std::string convert_emojis(const std::string& lua) {
-	std::string res;
-	for (char32_t codepoint : utf8::CodepointIterator(lua)) {
-		if (codepoint < 0x80) {
-			res.push_back(uint8_t(codepoint));
-		} else {
-			auto i = emoji.find(codepoint);
-			if (i != emoji.end()) {
-				res.push_back(i->second);
-			}
-		}
-	}
-	return res;
-}
\ No newline at end of file
+//every mapped codepoint is below this
+#define EMOJI_CODEPOINT_LIMIT 0x20000
+#define EMOJI_BLOCK_COUNT 24
+
+//Two level direct lookup. codepoint >> 8 picks a 256 entry block and the low
+//byte indexes into it. Only blocks with mapped characters are stored, the rest
+//share block 0, which is all zeros (0 means no p8scii character).
+struct emoji_tables {
+    uint8_t blockIndex[EMOJI_CODEPOINT_LIMIT >> 8];
+    uint8_t blocks[EMOJI_BLOCK_COUNT][256];
+
+    //reverse direction, utf8 bytes for each p8scii character
+    char utf8[256][4];
+    uint8_t utf8Length[256];
+
+    emoji_tables() {
+        memset(blockIndex, 0, sizeof(blockIndex));
+        memset(blocks, 0, sizeof(blocks));
+
+        int blockCount = 1;
+        for (auto& e : emoji) {
+            uint32_t high = e.codepoint >> 8;
+            if (blockIndex[high] == 0) {
+                blockIndex[high] = (uint8_t)blockCount++;
+            }
+            blocks[blockIndex[high]][e.codepoint & 0xff] = e.p8scii;
+        }
+
+        //printable ascii stays as it is, the table only changes the glyphs
+        for (int i = 0; i < 256; i++) {
+            utf8[i][0] = (char)i;
+            utf8Length[i] = 1;
+        }
+        for (auto& e : emoji) {
+            if (e.p8scii >= 0x20 && e.p8scii < 0x7f) {
+                continue;
+            }
+            utf8Length[e.p8scii] = (uint8_t)encode(e.codepoint, utf8[e.p8scii]);
+        }
+    }
+
+    static int encode(char32_t cp, char* out) {
+        if (cp < 0x80) {
+            out[0] = (char)cp;
+            return 1;
+        }
+        if (cp < 0x800) {
+            out[0] = (char)(0xc0 | (cp >> 6));
+            out[1] = (char)(0x80 | (cp & 0x3f));
+            return 2;
+        }
+        if (cp < 0x10000) {
+            out[0] = (char)(0xe0 | (cp >> 12));
+            out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+            out[2] = (char)(0x80 | (cp & 0x3f));
+            return 3;
+        }
+        out[0] = (char)(0xf0 | (cp >> 18));
+        out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+        out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[3] = (char)(0x80 | (cp & 0x3f));
+        return 4;
+    }
+};
+
+static const emoji_tables& tables() {
+    static const emoji_tables t;
+    return t;
+}
+
+void convert_emojis(std::string_view utf8, std::string &out) {
+    const emoji_tables& t = tables();
+
+    //p8scii is never longer than the utf8 it came from
+    size_t start = out.length();
+    out.resize(start + utf8.length());
+    char* dst = &out[start];
+
+    const uint8_t* src = (const uint8_t*)utf8.data();
+    const uint8_t* end = src + utf8.length();
+
+    while (src < end) {
+        //copy plain ascii 8 bytes at a time
+        while (end - src >= 8) {
+            uint64_t word;
+            memcpy(&word, src, sizeof(word));
+            if (word & 0x8080808080808080ull) {
+                break;
+            }
+            memcpy(dst, &word, sizeof(word));
+            src += 8;
+            dst += 8;
+        }
+
+        if (src == end) {
+            break;
+        }
+
+        uint8_t c = *src;
+        if (c < 0x80) {
+            *dst++ = (char)c;
+            src++;
+            continue;
+        }
+
+        //multi byte sequence. stray continuation bytes, invalid lead bytes
+        //and broken sequences are dropped
+        int extra = c >= 0xf8 ? -1 : c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : -1;
+        if (extra < 0) {
+            src++;
+            continue;
+        }
+        if (end - src <= extra) {
+            break;
+        }
+
+        char32_t cp = c & (0x3f >> extra);
+        bool valid = true;
+        for (int i = 1; i <= extra; i++) {
+            valid &= (src[i] & 0xc0) == 0x80;
+            cp = (cp << 6) | (src[i] & 0x3f);
+        }
+        if (!valid) {
+            src++;
+            continue;
+        }
+        src += extra + 1;
+
+        if (cp < 0x80) {
+            *dst++ = (char)cp;
+        }
+        else if (cp < EMOJI_CODEPOINT_LIMIT) {
+            uint8_t p8scii = t.blocks[t.blockIndex[cp >> 8]][cp & 0xff];
+            if (p8scii) {
+                *dst++ = (char)p8scii;
+            }
+        }
+    }
+
+    out.resize(dst - out.data());
+}
+
+std::string convert_emojis(std::string_view utf8) {
+    std::string res;
+    convert_emojis(utf8, res);
+    return res;
+}
+
+void p8scii_to_utf8(std::string_view p8scii, std::string &out) {
+    const emoji_tables& t = tables();
+
+    //every character is at most 4 bytes of utf8
+    size_t start = out.length();
+    out.resize(start + p8scii.length() * 4);
+    char* dst = &out[start];
+
+    for (char c : p8scii) {
+        uint8_t i = (uint8_t)c;
+        memcpy(dst, t.utf8[i], 4);
+        dst += t.utf8Length[i];
+    }
+
+    out.resize(dst - out.data());
+}
+
+std::string p8scii_to_utf8(std::string_view p8scii) {
+    std::string res;
+    p8scii_to_utf8(p8scii, res);
+    return res;
+}
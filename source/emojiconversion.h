@@ -1,3 +1,13 @@
+#pragma once
+
 #include <string>
+#include <string_view>
+
+//utf8 to p8scii. characters with no p8scii equivalent are dropped. The
+//overload taking out appends to it.
+std::string convert_emojis(std::string_view utf8);
+void convert_emojis(std::string_view utf8, std::string &out);
 
-std::string convert_emojis(const std::string& lua);
\ No newline at end of file
+//p8scii to utf8, for logging and exporting text
+std::string p8scii_to_utf8(std::string_view p8scii);
+void p8scii_to_utf8(std::string_view p8scii, std::string &out);
@@ -1,3 +1,5 @@
 #include <string>
+#include <vector>
 
 std::string get_file_contents(std::string filename);
+std::vector<unsigned char> get_file_buffer(std::string filename);
@@ -0,0 +1,30 @@
+#include "frameHash.h"
+
+#include <string.h>
+
+#define FRAME_HASH_SEED 0xcbf29ce484222325ull
+#define FRAME_HASH_MULTIPLIER 0x9e3779b97f4a7c15ull
+
+//a word at a time, sizes here are all multiples of 8
+static uint64_t hashWords(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+
+        hash = (hash ^ word) * FRAME_HASH_MULTIPLIER;
+        hash ^= hash >> 32;
+    }
+
+    return hash;
+}
+
+uint64_t hashFrame(const uint8_t* picoFb, const uint8_t* screenPaletteMap, const Color* paletteColors) {
+    uint64_t hash = FRAME_HASH_SEED;
+    hash = hashWords(hash, picoFb, 128 * 128);
+    hash = hashWords(hash, screenPaletteMap, 16);
+    hash = hashWords(hash, paletteColors, 16 * sizeof(Color));
+
+    return hash;
+}
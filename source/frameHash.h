@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hostVmShared.h"
+
+//Everything that decides what a frame looks like on screen: the pico
+//framebuffer, the screen palette map and the 16 palette colors. Cheap enough
+//to run every frame, frames that hash the same look the same.
+uint64_t hashFrame(const uint8_t* picoFb, const uint8_t* screenPaletteMap, const Color* paletteColors);
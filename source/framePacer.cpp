@@ -0,0 +1,97 @@
+#include "framePacer.h"
+
+#include <string.h>
+
+FramePacer::FramePacer(pacerClock clock){
+    _clock = clock;
+    _targetFps = 30;
+
+    _epoch = 0;
+    _scheduledFrames = 0;
+    _started = false;
+    _lastFrameStart = 0;
+
+    ResetStats();
+}
+
+uint64_t FramePacer::deadline(uint64_t frame){
+    return _epoch + frame * 1000000 / _targetFps;
+}
+
+void FramePacer::restart(uint64_t now){
+    _epoch = now;
+    _scheduledFrames = 0;
+}
+
+void FramePacer::SetTargetFps(int fps){
+    if (fps <= 0 || fps == _targetFps) {
+        return;
+    }
+
+    _targetFps = fps;
+    //the new rate starts from the last frame, not from when the schedule began
+    if (_started) {
+        restart(_lastFrameStart);
+    }
+}
+
+void FramePacer::Wait(){
+    uint64_t now = _clock.now();
+
+    if (!_started) {
+        restart(now);
+        _started = true;
+        _lastFrameStart = now;
+        return;
+    }
+
+    _scheduledFrames++;
+    uint64_t const target = deadline(_scheduledFrames);
+
+    if (now > target) {
+        _stats.missedDeadlines++;
+
+        //the frames in between are lost either way, running the next few
+        //back to back to catch up would only make it stutter twice
+        if (now - target > deadline(PACER_RESYNC_FRAMES) - _epoch) {
+            _stats.resyncs++;
+            restart(now);
+        }
+    }
+    else {
+        if (target - now > _clock.spinUs) {
+            _clock.sleepUntil(target - _clock.spinUs);
+        }
+
+        while ((now = _clock.now()) < target) { }
+    }
+
+    record(now - _lastFrameStart);
+    _lastFrameStart = now;
+}
+
+void FramePacer::record(uint64_t frameUs){
+    _stats.frames++;
+    _stats.lastFrameUs = frameUs;
+    if (frameUs > _stats.worstFrameUs) {
+        _stats.worstFrameUs = frameUs;
+    }
+
+    _totalFrameUs += frameUs;
+    _stats.averageFrameUs = _totalFrameUs / _stats.frames;
+
+    uint64_t bucket = frameUs / PACER_BUCKET_US;
+    if (bucket >= PACER_HISTOGRAM_BUCKETS) {
+        bucket = PACER_HISTOGRAM_BUCKETS - 1;
+    }
+    _stats.histogram[bucket]++;
+}
+
+framePacerStats FramePacer::GetStats(){
+    return _stats;
+}
+
+void FramePacer::ResetStats(){
+    memset(&_stats, 0, sizeof(_stats));
+    _totalFrameUs = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+//frame times are counted in 1ms buckets, the last one also holds everything
+//longer than it
+#define PACER_HISTOGRAM_BUCKETS 40
+#define PACER_BUCKET_US 1000
+
+//a frame that far behind schedule gives up on catching up and starts the
+//schedule over from now, after cart loads and other stalls
+#define PACER_RESYNC_FRAMES 2
+
+//the clock a pacer runs against, each host provides its own
+struct pacerClock {
+    //microseconds since any fixed point
+    uint64_t (*now)();
+    //sleeps until roughly the given time. Waking a little late is fine as
+    //long as it is within spinUs
+    void (*sleepUntil)(uint64_t us);
+    //how far ahead of a deadline sleeping stops and spinning on now() takes
+    //over. 0 never spins
+    uint64_t spinUs;
+};
+
+struct framePacerStats {
+    uint32_t frames;
+    //frames that started after their deadline had already passed
+    uint32_t missedDeadlines;
+    uint32_t resyncs;
+    uint64_t lastFrameUs;
+    uint64_t worstFrameUs;
+    uint64_t averageFrameUs;
+    uint32_t histogram[PACER_HISTOGRAM_BUCKETS];
+};
+
+//Keeps frames to a target rate against absolute deadlines. Deadlines are
+//worked out from when the schedule started rather than from the previous
+//frame, so sleeping late on one frame doesn't push every later one back.
+class FramePacer {
+    pacerClock _clock;
+    int _targetFps;
+
+    //the schedule started at _epoch, deadline n is n frames after it
+    uint64_t _epoch;
+    uint64_t _scheduledFrames;
+    bool _started;
+    uint64_t _lastFrameStart;
+
+    framePacerStats _stats;
+    uint64_t _totalFrameUs;
+
+    uint64_t deadline(uint64_t frame);
+    void restart(uint64_t now);
+    void record(uint64_t frameUs);
+
+    public:
+    FramePacer(pacerClock clock);
+
+    void SetTargetFps(int fps);
+
+    //waits for the next frame's deadline
+    void Wait();
+
+    framePacerStats GetStats();
+    void ResetStats();
+};
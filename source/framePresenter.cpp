@@ -0,0 +1,136 @@
+#include "framePresenter.h"
+#include "host.h"
+#include "frameHash.h"
+
+#include <string.h>
+#include <algorithm>
+
+FramePresenter::FramePresenter(Host* host, int frameCount){
+    _host = host;
+    _frameCount = std::min(frameCount, PRESENTER_MAX_FRAMES);
+    _nextSequence = 0;
+    _running = false;
+    _thread = nullptr;
+
+    _hasLastFrame = false;
+    _lastFrameHash = 0;
+    _skippedFrames = 0;
+
+    for (int i = 0; i < PRESENTER_MAX_FRAMES; i++) {
+        _frames[i].state = presenterFrame::Free;
+        _frames[i].sequence = 0;
+    }
+
+    if (_frameCount >= 2) {
+        _running = true;
+        _thread = _host->startPresenterThread(&FramePresenter::presenterEntry, this);
+        _running = _thread != nullptr;
+    }
+}
+
+FramePresenter::~FramePresenter(){
+    Stop();
+}
+
+bool FramePresenter::IsPipelined(){
+    return _thread != nullptr;
+}
+
+void FramePresenter::Present(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors){
+    uint64_t const hash = hashFrame(picoFb, screenPaletteMap, paletteColors);
+    if (_hasLastFrame && hash == _lastFrameHash) {
+        _skippedFrames++;
+        return;
+    }
+    _hasLastFrame = true;
+    _lastFrameHash = hash;
+
+    if (!_running) {
+        _host->drawFrame(picoFb, screenPaletteMap, paletteColors);
+        return;
+    }
+
+    presenterFrame* frame = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        _changed.wait(lock, [this, &frame] {
+            for (int i = 0; i < _frameCount; i++) {
+                if (_frames[i].state == presenterFrame::Free) {
+                    frame = &_frames[i];
+                    return true;
+                }
+            }
+            return false;
+        });
+        frame->state = presenterFrame::Writing;
+    }
+
+    memcpy(frame->picoFb, picoFb, sizeof(frame->picoFb));
+    memcpy(frame->screenPaletteMap, screenPaletteMap, sizeof(frame->screenPaletteMap));
+    memcpy(frame->paletteColors, paletteColors, sizeof(frame->paletteColors));
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        frame->state = presenterFrame::Ready;
+        frame->sequence = _nextSequence++;
+    }
+    _changed.notify_all();
+}
+
+void FramePresenter::Invalidate(){
+    _hasLastFrame = false;
+}
+
+uint32_t FramePresenter::GetSkippedFrames(){
+    return _skippedFrames;
+}
+
+void FramePresenter::presenterEntry(void* presenter){
+    ((FramePresenter*)presenter)->presenterThread();
+}
+
+void FramePresenter::presenterThread(){
+    while (true) {
+        presenterFrame* frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _changed.wait(lock, [this, &frame] {
+                for (int i = 0; i < _frameCount; i++) {
+                    if (_frames[i].state == presenterFrame::Ready &&
+                            (!frame || (int32_t)(_frames[i].sequence - frame->sequence) < 0)) {
+                        frame = &_frames[i];
+                    }
+                }
+                return frame != nullptr || !_running;
+            });
+
+            //everything queued is drawn before stopping
+            if (!frame) {
+                return;
+            }
+            frame->state = presenterFrame::Presenting;
+        }
+
+        _host->drawFrame(frame->picoFb, frame->screenPaletteMap, frame->paletteColors);
+
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            frame->state = presenterFrame::Free;
+        }
+        _changed.notify_all();
+    }
+}
+
+void FramePresenter::Stop(){
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (!_running) {
+            return;
+        }
+        _running = false;
+    }
+    _changed.notify_all();
+
+    _host->joinPresenterThread(_thread);
+    _thread = nullptr;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+
+#include "hostVmShared.h"
+
+class Host;
+struct hostThread;
+
+#define PRESENTER_MAX_FRAMES 3
+
+//everything drawFrame reads, copied out of the vm so it can go on to the
+//next frame
+struct presenterFrame {
+    uint8_t picoFb[128 * 128];
+    uint8_t screenPaletteMap[16];
+    Color paletteColors[16];
+
+    enum { Free, Writing, Ready, Presenting } state;
+    //presented oldest first
+    uint32_t sequence;
+};
+
+//Hands finished frames to the host. With fewer than 2 frames it draws them
+//right away on the calling thread like before, as it does when the host
+//can't start a presenter thread. Otherwise the presenter thread converts and
+//flips frame N while the vm runs frame N + 1. The vm only
+//waits when every frame is still queued or on screen, so the presenter
+//never falls more than frameCount - 1 frames behind.
+//Frames that look the same as the last one drawn aren't drawn again, the
+//screen keeps showing the host buffer from before.
+class FramePresenter {
+    Host* _host;
+    int _frameCount;
+    presenterFrame _frames[PRESENTER_MAX_FRAMES];
+    uint32_t _nextSequence;
+
+    bool _hasLastFrame;
+    uint64_t _lastFrameHash;
+    uint32_t _skippedFrames;
+
+    hostThread* _thread;
+    std::mutex _lock;
+    std::condition_variable _changed;
+    bool _running;
+
+    void presenterThread();
+    static void presenterEntry(void* presenter);
+
+    public:
+    FramePresenter(Host* host, int frameCount);
+    ~FramePresenter();
+
+    bool IsPipelined();
+
+    void Present(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors);
+
+    //the next frame gets drawn even if it is unchanged, for when the host
+    //changes how it draws them
+    void Invalidate();
+
+    uint32_t GetSkippedFrames();
+
+    //waits for queued frames to reach the screen and stops the thread
+    void Stop();
+};
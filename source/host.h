@@ -4,6 +4,10 @@
 #include <vector>
 #include <string>
 #include "hostVmShared.h"
+#include "framePacer.h"
+
+//a thread the platform started, only the host knows what is inside
+struct hostThread;
 
 enum StretchOption {
   PixelPerfect,
@@ -18,8 +22,6 @@ class Host {
 
     void oneTimeSetup();
 
-    void setTargetFps(int targetFps);
-
     bool mainLoop();
 
     void scanInput();
@@ -28,21 +30,40 @@ class Host {
 
     bool shouldQuit();
 
-    void changeStretch();
+    //true when the stretch changed and frames need drawing again
+    bool changeStretch();
+
+    //held to play the running cart backwards
+    bool rewindHeld();
+    //memory the RewindBuffer can use, 0 turns rewinding off
+    size_t getRewindBufferSize();
     
-    void waitForTargetFps();
+    //clock and sleep for the FramePacer main() paces frames with
+    pacerClock getPacerClock();
 
+    //frames FramePresenter keeps in flight, less than 2 draws on the main
+    //thread. Otherwise drawFrame is only ever called from the presenter thread
+    int getPresenterFrameCount();
+    //starts the presenter thread wherever it can run next to the vm. Null
+    //when it can't start, frames are then drawn on the main thread
+    hostThread* startPresenterThread(void (*entry)(void*), void* arg);
+    void joinPresenterThread(hostThread* thread);
     void drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors);
 
+    //the audio device, fed through AudioOutput. Buffers hold up to
+    //getAudioBufferSize() stereo int16 samples at getAudioSampleRate()
+    int getAudioSampleRate();
+    int getAudioBufferCount();
+    int getAudioBuffersQueued();
     bool shouldFillAudioBuff();
     void* getAudioBufferPointer();
     size_t getAudioBufferSize();
-    void playFilledAudioBuffer();
+    void playFilledAudioBuffer(size_t samples);
 
     void oneTimeCleanup();
 
     double deltaTMs();
 
-    std::vector<std::string> listcarts();
+    std::string getCartDirectory();
    
 };
\ No newline at end of file
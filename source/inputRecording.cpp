@@ -0,0 +1,266 @@
+#include "inputRecording.h"
+#include "vm.h"
+#include "frameHash.h"
+#include "filehelpers.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#define RECORDING_MAGIC 0x52493846
+//bump whenever the file layout changes
+#define RECORDING_VERSION 1
+
+struct recordingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rngSeed;
+    uint32_t frameCount;
+    uint32_t hashInterval;
+    uint32_t hashCount;
+    uint32_t cartFilenameLength;
+    //bytes of frame runs after the filename
+    uint32_t runBytes;
+};
+
+static void putLength(std::vector<uint8_t> &out, uint32_t length) {
+    while (length >= 0x80) {
+        out.push_back((uint8_t)(length | 0x80));
+        length >>= 7;
+    }
+    out.push_back((uint8_t)length);
+}
+
+static bool getLength(const uint8_t* &in, const uint8_t* end, uint32_t &length) {
+    length = 0;
+    for (int shift = 0; in < end && shift < 32; shift += 7) {
+        uint8_t const byte = *in++;
+        length |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void InputRecording::Start(std::string cartFilename, uint32_t rngSeed){
+    CartFilename = cartFilename;
+    RngSeed = rngSeed;
+    _frames.clear();
+    _hashes.clear();
+}
+
+void InputRecording::AddFrame(uint8_t kdown, uint8_t kheld, uint64_t frameHash){
+    _frames.push_back(kdown | (kheld << 8));
+
+    if (_frames.size() % RECORDING_HASH_INTERVAL == 0) {
+        _hashes.push_back(frameHash);
+    }
+}
+
+void InputRecording::Truncate(int frames){
+    if (frames < 0 || frames >= (int)_frames.size()) {
+        return;
+    }
+
+    _frames.resize(frames);
+    _hashes.resize(frames / RECORDING_HASH_INTERVAL);
+}
+
+int InputRecording::FrameCount(){
+    return _frames.size();
+}
+
+void InputRecording::GetFrame(int frame, uint8_t &kdown, uint8_t &kheld){
+    kdown = _frames[frame] & 0xff;
+    kheld = _frames[frame] >> 8;
+}
+
+bool InputRecording::GetFrameHash(int frame, uint64_t &hash){
+    if ((frame + 1) % RECORDING_HASH_INTERVAL != 0) {
+        return false;
+    }
+
+    size_t const index = (frame + 1) / RECORDING_HASH_INTERVAL - 1;
+    if (index >= _hashes.size()) {
+        return false;
+    }
+    hash = _hashes[index];
+
+    return true;
+}
+
+bool InputRecording::Save(std::string filename){
+    std::vector<uint8_t> runs;
+    for (size_t i = 0; i < _frames.size();) {
+        size_t run = 1;
+        while (i + run < _frames.size() && _frames[i + run] == _frames[i]) {
+            run++;
+        }
+
+        putLength(runs, run);
+        runs.push_back(_frames[i] & 0xff);
+        runs.push_back(_frames[i] >> 8);
+        i += run;
+    }
+
+    recordingHeader header = {};
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    header.rngSeed = RngSeed;
+    header.frameCount = _frames.size();
+    header.hashInterval = RECORDING_HASH_INTERVAL;
+    header.hashCount = _hashes.size();
+    header.cartFilenameLength = CartFilename.length();
+    header.runBytes = runs.size();
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written &= fwrite(CartFilename.data(), 1, CartFilename.length(), file) == CartFilename.length();
+    written &= fwrite(runs.data(), 1, runs.size(), file) == runs.size();
+    written &= fwrite(_hashes.data(), sizeof(uint64_t), _hashes.size(), file) == _hashes.size();
+    fclose(file);
+
+    return written;
+}
+
+bool InputRecording::Load(std::string filename){
+    std::vector<unsigned char> data = get_file_buffer(filename);
+
+    recordingHeader header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION || header.hashInterval != RECORDING_HASH_INTERVAL) {
+        Logger::Write("%s is not a recording this version can play\n", filename.c_str());
+        return false;
+    }
+
+    size_t const expected = sizeof(header) + header.cartFilenameLength + header.runBytes + header.hashCount * sizeof(uint64_t);
+    if (data.size() != expected) {
+        return false;
+    }
+
+    const uint8_t* in = data.data() + sizeof(header);
+    Start(std::string((const char*)in, header.cartFilenameLength), header.rngSeed);
+    in += header.cartFilenameLength;
+
+    const uint8_t* const runsEnd = in + header.runBytes;
+    while (in < runsEnd) {
+        uint32_t run;
+        if (!getLength(in, runsEnd, run) || runsEnd - in < 2 || _frames.size() + run > header.frameCount) {
+            return false;
+        }
+        uint16_t const frame = in[0] | (in[1] << 8);
+        in += 2;
+        _frames.insert(_frames.end(), run, frame);
+    }
+
+    _hashes.resize(header.hashCount);
+    memcpy(_hashes.data(), in, header.hashCount * sizeof(uint64_t));
+
+    return _frames.size() == header.frameCount;
+}
+
+InputRecorder::InputRecorder(Vm* vm, std::string filename){
+    _vm = vm;
+    _filename = filename;
+    _recordingCart = false;
+}
+
+void InputRecorder::finish(){
+    if (_recordingCart && _recording.FrameCount() > 0) {
+        _recording.Save(_filename);
+    }
+    _recordingCart = false;
+}
+
+void InputRecorder::Capture(uint8_t kdown, uint8_t kheld){
+    int const frameCount = _vm->GetFrameCount();
+
+    //the frame just run loaded a cart, its first frame comes next
+    if (frameCount == 0) {
+        finish();
+        if (!_vm->IsBiosLoaded() && _vm->GetCartFilename() != "") {
+            _recording.Start(_vm->GetCartFilename(), _vm->GetRngSeed());
+            _recordingCart = true;
+        }
+        return;
+    }
+
+    if (!_recordingCart) {
+        return;
+    }
+
+    if (frameCount != _recording.FrameCount() + 1) {
+        //loaded from a save state, or something else this can't follow
+        finish();
+        return;
+    }
+
+    _recording.AddFrame(kdown, kheld, hashFrame(_vm->GetPicoInteralFb(), _vm->GetScreenPaletteMap(), _vm->GetPaletteColors()));
+}
+
+void InputRecorder::Rewound(){
+    if (_recordingCart) {
+        _recording.Truncate(_vm->GetFrameCount());
+    }
+}
+
+void InputRecorder::Stop(){
+    finish();
+}
+
+replayResult replayRecording(Vm* vm, InputRecording &recording, int maxFrames, std::vector<uint64_t>* trace,
+    std::function<void(int frame)> afterFrame){
+    replayResult result = {};
+    result.firstMismatch = -1;
+
+    vm->SetRngSeed(recording.RngSeed);
+    if (!vm->LoadCart(recording.CartFilename)) {
+        result.error = vm->GetLastError();
+        return result;
+    }
+
+    int frames = recording.FrameCount();
+    if (maxFrames > 0 && maxFrames < frames) {
+        frames = maxFrames;
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        uint8_t kdown, kheld;
+        recording.GetFrame(i, kdown, kheld);
+        vm->UpdateAndDraw(kdown, kheld);
+
+        if (vm->GetLastError() != "") {
+            result.error = vm->GetLastError();
+            break;
+        }
+
+        result.frames++;
+        result.finalHash = hashFrame(vm->GetPicoInteralFb(), vm->GetScreenPaletteMap(), vm->GetPaletteColors());
+        if (trace) {
+            trace->push_back(result.finalHash);
+        }
+        if (afterFrame) {
+            afterFrame(i);
+        }
+
+        uint64_t expected;
+        if (result.firstMismatch < 0 && recording.GetFrameHash(i, expected) && expected != result.finalHash) {
+            result.firstMismatch = i;
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return result;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+class Vm;
+
+//frames between the hashes a recording keeps to check replays against
+#define RECORDING_HASH_INTERVAL 30
+
+//Everything needed to play a cart session again: the cart, the rnd() seed it
+//started from and the buttons of every frame since it loaded. Every
+//RECORDING_HASH_INTERVAL frames the hash of what was drawn is kept too, so a
+//replay can tell where it stopped matching.
+class InputRecording {
+    //kdown in the low byte, kheld in the high one
+    std::vector<uint16_t> _frames;
+    std::vector<uint64_t> _hashes;
+
+    public:
+    std::string CartFilename;
+    uint32_t RngSeed;
+
+    void Start(std::string cartFilename, uint32_t rngSeed);
+    //frameHash is what the frame drew
+    void AddFrame(uint8_t kdown, uint8_t kheld, uint64_t frameHash);
+    //keeps the first frames, for when the cart was rewound
+    void Truncate(int frames);
+
+    int FrameCount();
+    void GetFrame(int frame, uint8_t &kdown, uint8_t &kheld);
+    //false for frames without a kept hash
+    bool GetFrameHash(int frame, uint64_t &hash);
+
+    //runs of identical frames are stored once, a few bytes per second of
+    //play for most carts
+    bool Save(std::string filename);
+    bool Load(std::string filename);
+};
+
+//Keeps a recording of whatever cart the vm is running, from when it loads.
+//Sessions resumed from a save state can't be replayed and aren't recorded.
+class InputRecorder {
+    Vm* _vm;
+    std::string _filename;
+    InputRecording _recording;
+    bool _recordingCart;
+
+    void finish();
+
+    public:
+    //each finished session is written to filename, replacing the last one
+    InputRecorder(Vm* vm, std::string filename);
+
+    //records the frame the vm just ran with this input
+    void Capture(uint8_t kdown, uint8_t kheld);
+    //the vm went back to an earlier frame of the same session
+    void Rewound();
+    //writes out the session so far
+    void Stop();
+};
+
+struct replayResult {
+    int frames;
+    //first frame whose hash doesn't match the recording, -1 if they all do
+    int firstMismatch;
+    double seconds;
+    uint64_t finalHash;
+    std::string error;
+};
+
+//loads the recorded cart with its seed and runs every frame back to back
+//with no pacing. trace gets the hash of each frame when it isn't null, and
+//afterFrame is called with each frame's index once it has run.
+//maxFrames of 0 plays the whole recording
+replayResult replayRecording(Vm* vm, InputRecording &recording, int maxFrames, std::vector<uint64_t>* trace,
+    std::function<void(int frame)> afterFrame = nullptr);
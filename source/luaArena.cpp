@@ -0,0 +1,357 @@
+#include "luaArena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//offsets and sizes are 32 bit, the arena is never near 4GB and small
+//blocks are most of what lua allocates
+struct arenaBlock {
+    //bytes in the block, this included. The low bit is set while it is free
+    uint32_t size;
+    //size of the block just before this one, 0 for the first
+    uint32_t prevSize;
+};
+
+//a free block keeps its links where lua's data was
+struct arenaFreeBlock {
+    arenaBlock block;
+    uint32_t next;
+    uint32_t prev;
+};
+
+#define ARENA_GRANULE 8
+#define ARENA_FREE 1
+#define ARENA_MIN_BLOCK sizeof(arenaFreeBlock)
+#define ARENA_FIRST_BLOCK ((sizeof(arenaHeader) + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1))
+
+static_assert(sizeof(arenaBlock) % ARENA_GRANULE == 0, "lua data has to start 8 byte aligned");
+
+static int log2Floor(size_t size) {
+    int shift = 0;
+    while (size >> (shift + 1)) {
+        shift++;
+    }
+
+    return shift;
+}
+
+//the class a free block of this size is listed in
+static int sizeClass(size_t size) {
+    if (size < ARENA_EXACT_MAX) {
+        return (int)(size / ARENA_GRANULE);
+    }
+
+    int const shift = log2Floor(size);
+    int const subclass = (int)(size >> (shift - 3)) & (ARENA_SUBCLASSES - 1);
+
+    return ARENA_EXACT_MAX / ARENA_GRANULE + (shift - 8) * ARENA_SUBCLASSES + subclass;
+}
+
+//the first class where every block is at least this size
+static int searchClass(size_t size) {
+    if (size < ARENA_EXACT_MAX) {
+        return sizeClass(size);
+    }
+
+    return sizeClass(size + ((size_t)1 << (log2Floor(size) - 3)) - 1);
+}
+
+static size_t blockSize(size_t size) {
+    size = (size + sizeof(arenaBlock) + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1);
+
+    return size < ARENA_MIN_BLOCK ? ARENA_MIN_BLOCK : size;
+}
+
+LuaArena::LuaArena(size_t size, size_t alignment){
+    _size = size;
+    //aligned_alloc wants a multiple of the alignment
+    _base = (uint8_t*)aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+
+    Reset();
+}
+
+LuaArena::~LuaArena(){
+    free(_base);
+}
+
+arenaHeader* LuaArena::header(){
+    return (arenaHeader*)_base;
+}
+
+arenaBlock* LuaArena::block(size_t offset){
+    return (arenaBlock*)(_base + offset);
+}
+
+void LuaArena::Reset(){
+    if (!_base) {
+        return;
+    }
+
+    memset(header(), 0, sizeof(arenaHeader));
+    header()->top = ARENA_FIRST_BLOCK;
+}
+
+void LuaArena::link(size_t offset, size_t size){
+    arenaHeader* arena = header();
+    arenaFreeBlock* entry = (arenaFreeBlock*)block(offset);
+    int const index = sizeClass(size);
+
+    entry->block.size = (uint32_t)size | ARENA_FREE;
+    entry->next = arena->freeLists[index];
+    entry->prev = 0;
+    if (entry->next) {
+        ((arenaFreeBlock*)block(entry->next))->prev = (uint32_t)offset;
+    }
+    arena->freeLists[index] = (uint32_t)offset;
+    arena->freeClasses[index / 32] |= 1u << (index % 32);
+
+    block(offset + size)->prevSize = (uint32_t)size;
+}
+
+void LuaArena::unlink(size_t offset){
+    arenaHeader* arena = header();
+    arenaFreeBlock* entry = (arenaFreeBlock*)block(offset);
+    int const index = sizeClass(entry->block.size & ~ARENA_FREE);
+
+    if (entry->prev) {
+        ((arenaFreeBlock*)block(entry->prev))->next = entry->next;
+    }
+    else {
+        arena->freeLists[index] = entry->next;
+        if (!entry->next) {
+            arena->freeClasses[index / 32] &= ~(1u << (index % 32));
+        }
+    }
+    if (entry->next) {
+        ((arenaFreeBlock*)block(entry->next))->prev = entry->prev;
+    }
+
+    entry->block.size &= ~ARENA_FREE;
+}
+
+void* LuaArena::allocate(size_t size){
+    if (!_base || size > _size) {
+        return nullptr;
+    }
+
+    size_t const needed = blockSize(size);
+    arenaHeader* arena = header();
+
+    //the lowest class with blocks that are all big enough
+    int index = searchClass(needed);
+    int word = index / 32;
+    uint32_t bits = index < ARENA_CLASSES ? arena->freeClasses[word] & (~0u << (index % 32)) : 0;
+    while (!bits && ++word < (ARENA_CLASSES + 31) / 32) {
+        bits = arena->freeClasses[word];
+    }
+
+    size_t offset;
+    if (bits) {
+        index = word * 32 + __builtin_ctz(bits);
+        offset = arena->freeLists[index];
+        unlink(offset);
+
+        size_t const available = block(offset)->size;
+        if (available - needed >= ARENA_MIN_BLOCK) {
+            //a free block is never last or next to another free block, so
+            //the rest goes straight back on a list
+            block(offset)->size = (uint32_t)needed;
+            block(offset + needed)->prevSize = (uint32_t)needed;
+            link(offset + needed, available - needed);
+        }
+    }
+    else {
+        if (needed > _size - arena->top) {
+            //lua collects everything it can and tries once more
+            return nullptr;
+        }
+        offset = arena->top;
+        block(offset)->size = (uint32_t)needed;
+        block(offset)->prevSize = arena->lastBlock ? block(arena->lastBlock)->size : 0;
+        arena->lastBlock = offset;
+        arena->top += needed;
+    }
+
+    arena->bytesInUse += block(offset)->size;
+
+    return _base + offset + sizeof(arenaBlock);
+}
+
+void LuaArena::release(size_t offset){
+    arenaHeader* arena = header();
+    size_t size = block(offset)->size;
+    arena->bytesInUse -= size;
+
+    size_t const next = offset + size;
+    if (next != arena->top && (block(next)->size & ARENA_FREE)) {
+        unlink(next);
+        size += block(next)->size;
+    }
+
+    size_t const prevSize = block(offset)->prevSize;
+    if (prevSize && (block(offset - prevSize)->size & ARENA_FREE)) {
+        offset -= prevSize;
+        unlink(offset);
+        size += prevSize;
+    }
+
+    if (offset + size == arena->top) {
+        arena->top = offset;
+        size_t const lastSize = block(offset)->prevSize;
+        arena->lastBlock = lastSize ? offset - lastSize : 0;
+        return;
+    }
+
+    link(offset, size);
+}
+
+void* LuaArena::reallocate(void* ptr, size_t osize, size_t nsize){
+    arenaHeader* arena = header();
+    size_t const offset = (uint8_t*)ptr - _base - sizeof(arenaBlock);
+    size_t size = block(offset)->size;
+    size_t const needed = nsize > _size ? _size : blockSize(nsize);
+
+    if (needed > size) {
+        size_t const next = offset + size;
+        if (next == arena->top && needed - size <= _size - arena->top) {
+            arena->top += needed - size;
+            arena->bytesInUse += needed - size;
+            block(offset)->size = (uint32_t)needed;
+            return ptr;
+        }
+
+        if (next != arena->top && (block(next)->size & ARENA_FREE) &&
+                size + (block(next)->size & ~ARENA_FREE) >= needed) {
+            unlink(next);
+            size_t const nextSize = block(next)->size;
+            size += nextSize;
+            arena->bytesInUse += nextSize;
+            block(offset)->size = (uint32_t)size;
+            block(offset + size)->prevSize = (uint32_t)size;
+        }
+        else {
+            void* moved = allocate(nsize);
+            if (!moved) {
+                return nullptr;
+            }
+
+            memcpy(moved, ptr, osize < nsize ? osize : nsize);
+            release(offset);
+
+            return moved;
+        }
+    }
+
+    //shrinking never fails, lua doesn't expect it to
+    if (size - needed >= ARENA_MIN_BLOCK) {
+        block(offset)->size = (uint32_t)needed;
+        block(offset + needed)->size = (uint32_t)(size - needed);
+        block(offset + needed)->prevSize = (uint32_t)needed;
+        if (arena->lastBlock == offset) {
+            arena->lastBlock = offset + needed;
+        }
+        release(offset + needed);
+    }
+
+    return ptr;
+}
+
+void* LuaArena::Alloc(void* ud, void* ptr, size_t osize, size_t nsize){
+    LuaArena* arena = (LuaArena*)ud;
+
+    if (nsize == 0) {
+        if (ptr) {
+            arena->release((uint8_t*)ptr - arena->_base - sizeof(arenaBlock));
+        }
+        return nullptr;
+    }
+
+    //osize is a type tag rather than a size for new blocks
+    if (!ptr) {
+        return arena->allocate(nsize);
+    }
+
+    return arena->reallocate(ptr, osize, nsize);
+}
+
+uint8_t* LuaArena::Base(){
+    return _base;
+}
+
+size_t LuaArena::Size(){
+    return _size;
+}
+
+size_t LuaArena::Used(){
+    return _base ? header()->top : 0;
+}
+
+size_t LuaArena::BytesInUse(){
+    return _base ? header()->bytesInUse : 0;
+}
+
+void LuaArena::Copy(uint8_t* out){
+    arenaHeader* arena = header();
+    memcpy(out, _base, arena->top);
+
+    for (int i = 0; i < ARENA_CLASSES; i++) {
+        for (size_t offset = arena->freeLists[i]; offset; offset = ((arenaFreeBlock*)block(offset))->next) {
+            size_t const size = block(offset)->size & ~ARENA_FREE;
+            memset(out + offset + sizeof(arenaFreeBlock), 0, size - sizeof(arenaFreeBlock));
+        }
+    }
+}
+
+bool LuaArena::Restore(const uint8_t* data, size_t size){
+    if (!_base || size < ARENA_FIRST_BLOCK || size > _size) {
+        return false;
+    }
+
+    memcpy(_base, data, size);
+
+    arenaHeader* arena = header();
+    if (arena->top != size) {
+        return false;
+    }
+
+    //every block has to lead to the next one and end at top, otherwise the
+    //first allocation would go somewhere it shouldn't
+    size_t offset = ARENA_FIRST_BLOCK;
+    size_t prevSize = 0;
+    size_t last = 0;
+    size_t freeBlocks = 0;
+    while (offset < size) {
+        size_t const length = block(offset)->size & ~ARENA_FREE;
+        if (size - offset < sizeof(arenaBlock) || length < ARENA_MIN_BLOCK || length % ARENA_GRANULE ||
+                length > size - offset || block(offset)->prevSize != prevSize) {
+            return false;
+        }
+        freeBlocks += block(offset)->size & ARENA_FREE;
+
+        last = offset;
+        prevSize = length;
+        offset += length;
+    }
+    if (offset != size || arena->lastBlock != last || (last && (block(last)->size & ARENA_FREE))) {
+        return false;
+    }
+
+    //and the lists have to hold just those free blocks, once each
+    for (int i = 0; i < ARENA_CLASSES; i++) {
+        size_t prev = 0;
+        for (size_t listed = arena->freeLists[i]; listed; listed = ((arenaFreeBlock*)block(listed))->next) {
+            if (listed < ARENA_FIRST_BLOCK || listed % ARENA_GRANULE || listed >= size || freeBlocks == 0 ||
+                    !(block(listed)->size & ARENA_FREE) || sizeClass(block(listed)->size & ~ARENA_FREE) != i ||
+                    ((arenaFreeBlock*)block(listed))->prev != prev) {
+                return false;
+            }
+            freeBlocks--;
+            prev = listed;
+        }
+        if (((arena->freeClasses[i / 32] >> (i % 32)) & 1) != (arena->freeLists[i] != 0)) {
+            return false;
+        }
+    }
+
+    return freeBlocks == 0;
+}
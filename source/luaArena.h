@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct arenaBlock;
+
+//free blocks up to this size are listed by their exact size, 8 bytes apart.
+//Bigger ones by their power of two, split in ARENA_SUBCLASSES steps
+#define ARENA_EXACT_MAX 256
+#define ARENA_SUBCLASSES 8
+#define ARENA_CLASSES (ARENA_EXACT_MAX / 8 + (32 - 8) * ARENA_SUBCLASSES)
+
+//bookkeeping kept at the start of the arena itself, so copying the used
+//part of the arena copies the allocator along with everything it handed out
+struct arenaHeader {
+    size_t top;
+    size_t bytesInUse;
+    //offset of the block that ends at top, 0 for none. It is never free,
+    //freeing it hands its space back to top
+    size_t lastBlock;
+    //a bit for each size class that has free blocks
+    uint32_t freeClasses[(ARENA_CLASSES + 31) / 32];
+    //offset of the first free block of each size class, 0 for none
+    uint32_t freeLists[ARENA_CLASSES];
+};
+
+//A lua allocator over one fixed block of memory. Everything a lua state
+//allocates, the state itself included, lives between Base() and
+//Base() + Used(), so a state can be saved by copying those bytes and
+//brought back by copying them back to the same address.
+//The block starts on a multiple of alignment, so an address's offset in it
+//is just its low bits (see fake08conf.h in the lua sources).
+//Every block starts with its size and the size of the block before it.
+//Allocations take the first free block big enough from the size classes,
+//split off what they don't need and only grow the arena when nothing fits.
+//Freed blocks merge with free neighbours, and with top when they are the
+//last one, so Used() comes back down as the heap shrinks.
+class LuaArena {
+    uint8_t* _base;
+    size_t _size;
+
+    arenaHeader* header();
+    arenaBlock* block(size_t offset);
+    void link(size_t offset, size_t size);
+    void unlink(size_t offset);
+    void* allocate(size_t size);
+    void* reallocate(void* ptr, size_t osize, size_t nsize);
+    void release(size_t offset);
+
+    public:
+    LuaArena(size_t size, size_t alignment);
+    ~LuaArena();
+
+    //forgets every allocation. Only after the state using it is closed
+    void Reset();
+
+    //lua_Alloc, ud is the arena
+    static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    uint8_t* Base();
+    size_t Size();
+    //bytes from Base() up to the end of the last block in use
+    size_t Used();
+    size_t BytesInUse();
+
+    //copies Used() bytes from Base(). What is left in free blocks is
+    //zeroed, so copies of a heap that hasn't changed are the same
+    void Copy(uint8_t* out);
+    //puts back bytes from Copy(). Fails if they aren't a whole arena
+    bool Restore(const uint8_t* data, size_t size);
+};
@@ -0,0 +1,225 @@
+#include "luaProfiler.h"
+#include "apiProfiler.h"
+#include "picoluaapi.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+LuaProfiler::LuaProfiler(){
+    _enabled = false;
+    _active = false;
+    _mainState = nullptr;
+    _root = nullptr;
+    _lastSampleNs = 0;
+    _nativeNs = 0;
+    _samples = 0;
+}
+
+void LuaProfiler::SetEnabled(bool enabled){
+    _enabled = enabled;
+}
+
+bool LuaProfiler::IsEnabled(){
+    return _enabled;
+}
+
+void LuaProfiler::SetOutputFile(std::string filename){
+    _outputFile = filename;
+}
+
+void LuaProfiler::Start(lua_State* L){
+    _stackIds.clear();
+    _stacks.clear();
+    _samples = 0;
+    _root = nullptr;
+    _nativeNs = 0;
+    _lastSampleNs = ApiProfiler::Now();
+    _active = true;
+
+    Attach(L);
+}
+
+void LuaProfiler::Attach(lua_State* L){
+    _mainState = L;
+
+    //coroutines pick up the hook from the state that creates them
+    if (_active) {
+        lua_sethook(L, hook, LUA_MASKCOUNT, LUA_PROFILER_INSTRUCTIONS);
+    }
+    else {
+        lua_sethook(L, nullptr, 0, 0);
+    }
+}
+
+void LuaProfiler::Stop(){
+    if (!_active) {
+        return;
+    }
+    _active = false;
+    _mainState = nullptr;
+
+    if (_outputFile != "" && !_stacks.empty() && !WriteCollapsed(_outputFile)) {
+        Logger::Write("unable to write profile to %s\n", _outputFile.c_str());
+    }
+}
+
+bool LuaProfiler::IsActive(){
+    return _active;
+}
+
+void LuaProfiler::Enter(const char* root){
+    if (!_active) {
+        return;
+    }
+
+    //whatever ran since the last callback wasn't the cart
+    _root = root;
+    _lastSampleNs = ApiProfiler::Now();
+    _nativeNs = 0;
+}
+
+void LuaProfiler::Leave(){
+    _root = nullptr;
+}
+
+//FNV-1a over where each frame's function was defined, which lua reads
+//straight out of the function instead of working out what it was called
+uint64_t LuaProfiler::keyOf(lua_State* L, lua_CFunction native){
+    uint64_t key = 14695981039346656037ull;
+    auto const mix = [&key](uint64_t value) {
+        key = (key ^ value) * 1099511628211ull;
+    };
+
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(L, level, &ar); level++) {
+        lua_getinfo(L, "S", &ar);
+        mix((uint64_t)(uintptr_t)ar.source);
+        mix((uint64_t)ar.linedefined);
+    }
+
+    //c frames all look alike from here, but stackOf names them
+    mix((uint64_t)(uintptr_t)native);
+    mix((uint64_t)(uintptr_t)_root);
+    mix(L == _mainState);
+
+    return key;
+}
+
+std::string LuaProfiler::stackOf(lua_State* L){
+    std::vector<std::string> frames;
+
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(L, level, &ar); level++) {
+        lua_getinfo(L, "Sn", &ar);
+
+        if (strcmp(ar.what, "main") == 0) {
+            frames.push_back("main");
+        }
+        else if (strcmp(ar.what, "C") == 0) {
+            frames.push_back(ar.name ? ar.name : "?");
+        }
+        else {
+            frames.push_back(std::string(ar.name ? ar.name : "?") + ":" + std::to_string(ar.linedefined));
+        }
+    }
+
+    //the function the vm called has no name, it was called from c
+    if (L == _mainState && _root && !frames.empty() && frames.back()[0] == '?') {
+        frames.back() = _root;
+    }
+    else if (L != _mainState) {
+        frames.push_back("coroutine");
+        if (_root) {
+            frames.push_back(_root);
+        }
+    }
+
+    std::string stack;
+    for (auto frame = frames.rbegin(); frame != frames.rend(); frame++) {
+        if (stack != "") {
+            stack += ";";
+        }
+        stack += *frame;
+    }
+
+    return stack;
+}
+
+profiledStack& LuaProfiler::find(lua_State* L, lua_CFunction native){
+    uint64_t const key = keyOf(L, native);
+
+    auto const id = _stackIds.find(key);
+    if (id != _stackIds.end()) {
+        return _stacks[id->second];
+    }
+
+    _stackIds[key] = _stacks.size();
+    _stacks.push_back({stackOf(L), 0});
+
+    return _stacks.back();
+}
+
+void LuaProfiler::sample(lua_State* L){
+    uint64_t const now = ApiProfiler::Now();
+    uint64_t const elapsed = now - _lastSampleNs;
+
+    find(L, nullptr).ns += elapsed > _nativeNs ? elapsed - _nativeNs : 0;
+    _samples++;
+
+    //the walk itself isn't the cart's time
+    _lastSampleNs = ApiProfiler::Now();
+    _nativeNs = 0;
+}
+
+void LuaProfiler::hook(lua_State* L, lua_Debug*){
+    LuaProfiler* profiler = apiContext(L)->luaProfiler;
+    if (profiler->_active) {
+        profiler->sample(L);
+    }
+}
+
+void LuaProfiler::RecordNative(lua_State* L, lua_CFunction f, uint64_t start, uint64_t end){
+    if (!_active) {
+        return;
+    }
+
+    find(L, f).ns += end - start;
+    _nativeNs += end - start;
+    _samples++;
+
+    //keep the walk out of the next lua sample
+    _lastSampleNs += ApiProfiler::Now() - end;
+}
+
+uint32_t LuaProfiler::GetSamples(){
+    return _samples;
+}
+
+std::map<std::string, uint64_t> LuaProfiler::GetStacks(){
+    std::map<std::string, uint64_t> stacks;
+    for (auto const &stack : _stacks) {
+        stacks[stack.frames] += stack.ns;
+    }
+
+    return stacks;
+}
+
+bool LuaProfiler::WriteCollapsed(std::string filename){
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    bool written = true;
+    for (auto const &stack : GetStacks()) {
+        unsigned long long const us = (stack.second + 500) / 1000;
+        if (us > 0) {
+            written &= fprintf(file, "%s %llu\n", stack.first.c_str(), us) > 0;
+        }
+    }
+    fclose(file);
+
+    return written;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+extern "C" {
+  #include <lua.h>
+}
+
+//lua vm instructions between looks at the stack
+#define LUA_PROFILER_INSTRUCTIONS 1000
+
+//a stack the profiler has seen and the time charged to it
+struct profiledStack {
+    std::string frames;
+    uint64_t ns;
+};
+
+//Samples where a cart's time goes. A count hook looks at the lua stack every
+//LUA_PROFILER_INSTRUCTIONS instructions and charges it with the time since
+//the last look. Api functions are timed by the wrappers the api profiler
+//puts around them (profiledCall in picoluaapi.h); their time is taken back
+//out of the lua samples and charged to the stack of each call, with the
+//function on top.
+//Stacks are kept the way flamegraph tools read them: frames from the
+//outermost in separated by ';', then the time spent there in microseconds.
+//Looking a stack up only reads where each frame's function was defined,
+//working out the frames' names is left for the first time it is seen. Calls
+//to one function under different names are counted under the first.
+//The hook and the stack walk allocate nothing in the lua heap, so a
+//profiled cart runs exactly as it does without the profiler.
+class LuaProfiler {
+    bool _enabled;
+    bool _active;
+    std::string _outputFile;
+
+    lua_State* _mainState;
+    //the vm callback running, frames called from c have no name of their own
+    const char* _root;
+
+    uint64_t _lastSampleNs;
+    //api time since the last lua sample
+    uint64_t _nativeNs;
+
+    uint32_t _samples;
+    //indexes into _stacks by keyOf
+    std::unordered_map<uint64_t, uint32_t> _stackIds;
+    std::vector<profiledStack> _stacks;
+
+    uint64_t keyOf(lua_State* L, lua_CFunction native);
+    std::string stackOf(lua_State* L);
+    profiledStack& find(lua_State* L, lua_CFunction native);
+    void sample(lua_State* L);
+    static void hook(lua_State* L, lua_Debug*);
+
+    public:
+    LuaProfiler();
+
+    //takes effect from the next cart load, which also turns on the api
+    //profiler for its timings
+    void SetEnabled(bool enabled);
+    bool IsEnabled();
+    //each profiled cart's stacks are written here when it closes, nothing
+    //is written while it is empty
+    void SetOutputFile(std::string filename);
+
+    //forgets the last cart's stacks and starts sampling L
+    void Start(lua_State* L);
+    //samples L from now on instead, for when a save state replaced the
+    //state being sampled
+    void Attach(lua_State* L);
+    void Stop();
+    bool IsActive();
+
+    //around each call the vm makes into the cart
+    void Enter(const char* root);
+    void Leave();
+    //api function f called from L ran from start to end
+    void RecordNative(lua_State* L, lua_CFunction f, uint64_t start, uint64_t end);
+
+    uint32_t GetSamples();
+    //time in nanoseconds by stack
+    std::map<std::string, uint64_t> GetStacks();
+    bool WriteCollapsed(std::string filename);
+};
@@ -6,11 +6,38 @@
 #include <string>
 
 #include "vm.h"
+#include "audioOutput.h"
+#include "framePacer.h"
+#include "framePresenter.h"
+#include "rewindBuffer.h"
+#include "inputRecording.h"
+#include "luaProfiler.h"
+#include "cartLibrary.h"
 #include "logger.h"
 #include "host.h"
 #include "hostVmShared.h"
 
-
+#include "tests/test_base.h"
+#if _TEST
+#include "tests/cart_test.h"
+#include "tests/pxa_test.h"
+#include "tests/audio_test.h"
+#include "tests/frame_pacer_test.h"
+#include "tests/vm_test.h"
+#include "tests/rewind_test.h"
+#include "tests/input_recording_test.h"
+#include "tests/cart_library_test.h"
+#endif
+
+#define SUSPEND_STATE_FILE "suspend.f8state"
+//the input of the last cart played, to replay when something went wrong
+#define LAST_SESSION_FILE "lastsession.f8input"
+//lua stacks of the last cart profiled, for flamegraph tools
+#define LAST_PROFILE_FILE "lastprofile.folded"
+
+//a full save state every second or so of a 30fps cart, resuming runs at most
+//this many frames again
+#define REWIND_KEYFRAME_INTERVAL 30
 
 int main(int argc, char* argv[])
 {
@@ -22,51 +49,153 @@ int main(int argc, char* argv[])
 	Vm *vm = new Vm();
 	Logger::Write("initialized Vm and host\n");
 
-	Logger::Write("Setting cart list on vm\n");
-	vm->SetCartList(host->listcarts());
+	#if _TEST
+	verifyP8CartParse();
+	runPxaTests();
+	runAudioTests();
+	runFramePacerTests();
+	runVmTests();
+	runRewindTests();
+	runInputRecordingTests();
+	runCartLibraryTests();
+	#endif
+
+	Logger::Write("Refreshing cart library index\n");
+	CartLibrary *cartLibrary = new CartLibrary(host->getCartDirectory());
+	cartLibrary->Refresh();
+
+	Logger::Write("Setting cart library on vm\n");
+	vm->SetCartLibrary(cartLibrary);
+
+	AudioOutput *audioOutput = new AudioOutput(host->getAudioSampleRate(), host->getAudioBufferCount(),
+		host->getAudioBufferSize(), [vm](uint32_t* samples, size_t count) {
+			vm->FillAudioBuffer(samples, 0, count);
+		});
+
+	FramePacer *framePacer = new FramePacer(host->getPacerClock());
+	vm->SetFramePacer(framePacer);
+
+	FramePresenter *framePresenter = new FramePresenter(host, host->getPresenterFrameCount());
+	vm->SetFramePresenter(framePresenter);
+	if (framePresenter->IsPipelined()) {
+		Logger::Write("Presenting frames on their own thread\n");
+	}
+	else if (host->getPresenterFrameCount() >= 2) {
+		Logger::Write("Unable to start the presenter thread, drawing frames on the main thread\n");
+	}
+
+	RewindBuffer *rewindBuffer = new RewindBuffer(vm, host->getRewindBufferSize(), REWIND_KEYFRAME_INTERVAL);
+	bool rewinding = false;
+
+	InputRecorder *inputRecorder = new InputRecorder(vm, host->getCartDirectory() + "/" + LAST_SESSION_FILE);
+
+	vm->GetLuaProfiler()->SetOutputFile(host->getCartDirectory() + "/" + LAST_PROFILE_FILE);
 
 	Logger::Write("Loading Bios cart\n");
 	vm->LoadBiosCart();
 	Logger::Write("Bios Cart Loaded\n");
 
+	//pick up the cart that was running when the last session quit. A state
+	//only loads back into a vm laid out the same way, otherwise the bios stays
+	std::string suspendStatePath = host->getCartDirectory() + "/" + SUSPEND_STATE_FILE;
+	if (vm->LoadStateFile(suspendStatePath)) {
+		Logger::Write("Resumed suspended cart\n");
+	}
+	remove(suspendStatePath.c_str());
+
 	// Main loop
 	Logger::Write("Starting main loop\n");
 
 	while (host->mainLoop())
 	{
 		int targetFps = vm->GetTargetFps();
-		host->setTargetFps(targetFps);
+		framePacer->SetTargetFps(targetFps);
 
-		host->waitForTargetFps();
+		framePacer->Wait();
 
 		host->scanInput();
 
 		if (host->shouldQuit()) break; // break in order to return to hbmenu
 
-		host->changeStretch();
+		if (host->changeStretch()) {
+			framePresenter->Invalidate();
+		}
 
 		uint8_t p8kDown = host->getKeysDown();
 		uint8_t p8kHeld = host->getKeysHeld();
 
-		vm->UpdateAndDraw(p8kDown, p8kHeld);
-
-		uint8_t* picoFb = vm->GetPicoInteralFb();
-		uint8_t* screenPaletteMap = vm->GetScreenPaletteMap();
-		Color* paletteColors = vm->GetPaletteColors();
+		//holding rewind shows earlier frames, the cart carries on from
+		//whichever one it is let go on
+		if (host->rewindHeld() && (rewinding || rewindBuffer->FramesAvailable() > 1)) {
+			rewinding = true;
+			if (rewindBuffer->StepBack()) {
+				framePresenter->Present(rewindBuffer->GetShownFb(), rewindBuffer->GetShownScreenPaletteMap(), vm->GetPaletteColors());
+			}
+		}
+		else {
+			if (rewinding) {
+				rewindBuffer->Resume();
+				inputRecorder->Rewound();
+				rewinding = false;
+			}
+
+			vm->UpdateAndDraw(p8kDown, p8kHeld);
+			rewindBuffer->Capture(p8kDown, p8kHeld);
+			inputRecorder->Capture(p8kDown, p8kHeld);
+
+			uint8_t* picoFb = vm->GetPicoInteralFb();
+			uint8_t* screenPaletteMap = vm->GetScreenPaletteMap();
+			Color* paletteColors = vm->GetPaletteColors();
+
+			framePresenter->Present(picoFb, screenPaletteMap, paletteColors);
+		}
 
-		host->drawFrame(picoFb, screenPaletteMap, paletteColors);
+		//top up every buffer the device is done with, sized for how far apart
+		//these passes have been lately
+		audioOutput->Service(host->getAudioBuffersQueued());
+		vm->SetAudioRingTarget(audioOutput->SourceSamplesPerBuffer() + AUDIO_BLOCK_SIZE);
 
-		if (host->shouldFillAudioBuff()) {
-			vm->FillAudioBuffer(host->getAudioBufferPointer(), 0, host->getAudioBufferSize());
+		while (host->shouldFillAudioBuff()) {
+			size_t samples = audioOutput->NextBufferSize();
+			audioOutput->Fill(host->getAudioBufferPointer(), samples);
 
-			host->playFilledAudioBuffer();
+			host->playFilledAudioBuffer(samples);
 		}
 	}
 
+	framePresenter->Stop();
+	Logger::Write("%u unchanged frames skipped\n", framePresenter->GetSkippedFrames());
+
+	framePacerStats frameStats = framePacer->GetStats();
+	Logger::Write("frames: %u, %u missed deadlines, %u resyncs, average %dus, worst %dus\n",
+		frameStats.frames, frameStats.missedDeadlines, frameStats.resyncs,
+		(int)frameStats.averageFrameUs, (int)frameStats.worstFrameUs);
+
+	rewindStats rewindUsage = rewindBuffer->GetStats();
+	Logger::Write("rewind: %d frames kept in %d of %d bytes, capture average %dus, worst %dus, worst keyframe %dus\n",
+		rewindBuffer->FramesAvailable(), (int)rewindUsage.bytesUsed, (int)rewindUsage.budgetBytes,
+		(int)rewindUsage.averageCaptureUs, (int)rewindUsage.worstCaptureUs, (int)rewindUsage.worstKeyframeUs);
+
+	audioOutputStats audioStats = audioOutput->GetStats();
+	Logger::Write("audio output: %d buffers of %d samples at %dhz, %u underruns\n",
+		audioStats.bufferCount, (int)audioStats.bufferSamples, audioStats.deviceRate, audioStats.underruns);
+
+
+	inputRecorder->Stop();
+
+	if (vm->SaveStateFile(suspendStatePath)) {
+		Logger::Write("Suspended running cart\n");
+	}
 
 	Logger::Write("Turning off vm and exiting logger\n");
 	vm->CloseCart();
+	delete rewindBuffer;
+	delete inputRecorder;
+	delete audioOutput;
 	delete vm;
+	delete framePacer;
+	delete framePresenter;
+	delete cartLibrary;
 	
 	Logger::Exit();
 
@@ -93,15 +93,6 @@ trace = debug.traceback
 ---------------------------------
 --Math
 ---------------------------------
-function rnd(x)
-	return math.random()*(x or 1)
-end
-
-function srand(seed)
-	seed = seed or 0
-	math.randomseed(flr(seed*0x10000))
-end
-
 flr=math.floor
 ceil=math.ceil
 
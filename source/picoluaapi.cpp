@@ -1,6 +1,7 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 using namespace std;
 
 #include "picoluaapi.h"
@@ -15,25 +16,22 @@ extern "C" {
   #include <lauxlib.h>
 }
 
-Graphics* _graphicsForLuaApi;
-Input* _inputForLuaApi;
-Vm* _vmForLuaApi;
-Audio* _audioForLuaApi;
+static_assert(LUA_EXTRASPACE >= sizeof(picoApiContext*), "the api context pointer lives in the lua_State extra space");
 
-void initPicoApi(Graphics* graphics, Input* input, Vm* vm, Audio* audio){
-    _graphicsForLuaApi = graphics;
-    _inputForLuaApi = input;
-    _vmForLuaApi = vm;
-    _audioForLuaApi = audio;
+void initPicoApi(lua_State* L, picoApiContext* context){
+    *(picoApiContext**)lua_getextraspace(L) = context;
 }
 
-int noop(const char * name) {
-    //todo log name of unimplemented functions?
+//unimplemented functions are counted by the vm so tools can see which ones
+//a cart relies on
+int noop(lua_State *L, const char * name) {
+    apiContext(L)->vm->RecordUnimplementedCall(name);
+
     return 0;
 }
 
 int noopreturns(lua_State *L, const char * name) {
-    //todo log name of unimplemented functions?
+    apiContext(L)->vm->RecordUnimplementedCall(name);
     lua_pushnumber(L, 0);
 
     return 1;
@@ -43,11 +41,11 @@ int noopreturns(lua_State *L, const char * name) {
 //Graphics
 int cls(lua_State *L){
     if (lua_gettop(L) == 0) {
-        _graphicsForLuaApi->cls();
+        apiContext(L)->graphics->cls();
     }
     else {
         int c = lua_tonumber(L,1);
-        _graphicsForLuaApi->cls(c);
+        apiContext(L)->graphics->cls(c);
     }
 
     return 0;
@@ -58,13 +56,13 @@ int pset(lua_State *L){
     int y = lua_tonumber(L,2);
 
     if (lua_gettop(L) <= 2) {
-        _graphicsForLuaApi->pset(x, y);
+        apiContext(L)->graphics->pset(x, y);
         return 0;
     }
 
     int c = lua_tonumber(L,3);
 
-    _graphicsForLuaApi->pset(x, y, (uint8_t)c);
+    apiContext(L)->graphics->pset(x, y, (uint8_t)c);
 
     return 0;
 }
@@ -73,7 +71,7 @@ int pget(lua_State *L){
     double x = lua_tonumber(L,1);
     double y = lua_tonumber(L,2);
 
-    uint8_t color = _graphicsForLuaApi->pget((int)x, (int)y);
+    uint8_t color = apiContext(L)->graphics->pget((int)x, (int)y);
 
     lua_pushinteger(L, color);
 
@@ -83,32 +81,32 @@ int pget(lua_State *L){
 int color(lua_State *L){
     double c = lua_tonumber(L,1);
 
-    _graphicsForLuaApi->color((uint8_t)c);
+    apiContext(L)->graphics->color((uint8_t)c);
 
     return 0;
 }
 
 int line (lua_State *L){
     if (lua_gettop(L) == 0) {
-        _graphicsForLuaApi->line();
+        apiContext(L)->graphics->line();
     }
     else if (lua_gettop(L) == 1) {
         uint8_t c = lua_tonumber(L,1);
 
-        _graphicsForLuaApi->line(c);
+        apiContext(L)->graphics->line(c);
     }
     else if (lua_gettop(L) == 2) {
         int x1 = lua_tonumber(L,1);
         int y1 = lua_tonumber(L,2);
 
-        _graphicsForLuaApi->line(x1, y1);
+        apiContext(L)->graphics->line(x1, y1);
     }
     else if (lua_gettop(L) == 3) {
         int x1 = lua_tonumber(L,1);
         int y1 = lua_tonumber(L,2);
         uint8_t c = lua_tonumber(L,3);
 
-        _graphicsForLuaApi->line(x1, y1, c);
+        apiContext(L)->graphics->line(x1, y1, c);
     }
     else if (lua_gettop(L) == 4) {
         int x1 = lua_tonumber(L,1);
@@ -116,7 +114,7 @@ int line (lua_State *L){
         int x2 = lua_tonumber(L,3);
         int y2 = lua_tonumber(L,4);
 
-        _graphicsForLuaApi->line(x1, y1, x2, y2);
+        apiContext(L)->graphics->line(x1, y1, x2, y2);
     }
     else {
         int x1 = lua_tonumber(L,1);
@@ -125,7 +123,7 @@ int line (lua_State *L){
         int y2 = lua_tonumber(L,4);
         uint8_t c = lua_tonumber(L,5);
 
-        _graphicsForLuaApi->line(x1, y1, x2, y2, c);
+        apiContext(L)->graphics->line(x1, y1, x2, y2, c);
     }
 
     return 0;
@@ -136,17 +134,17 @@ int circ(lua_State *L){
     int oy = lua_tonumber(L,2);
 
     if (lua_gettop(L) == 2) {
-        _graphicsForLuaApi->circ(ox, oy);
+        apiContext(L)->graphics->circ(ox, oy);
     } 
     else if (lua_gettop(L) == 3){
         int r = lua_tonumber(L,3);
-        _graphicsForLuaApi->circ(ox, oy, r);
+        apiContext(L)->graphics->circ(ox, oy, r);
     }
     else if (lua_gettop(L) > 3){
         int r = lua_tonumber(L,3);
         uint8_t c = lua_tonumber(L,4);
 
-        _graphicsForLuaApi->circ(ox, oy, r, c);
+        apiContext(L)->graphics->circ(ox, oy, r, c);
     }
 
     return 0;
@@ -157,17 +155,17 @@ int circfill(lua_State *L){
     int oy = lua_tonumber(L,2);
 
     if (lua_gettop(L) == 2) {
-        _graphicsForLuaApi->circfill(ox, oy);
+        apiContext(L)->graphics->circfill(ox, oy);
     } 
     else if (lua_gettop(L) == 3){
         int r = lua_tonumber(L,3);
-        _graphicsForLuaApi->circfill(ox, oy, r);
+        apiContext(L)->graphics->circfill(ox, oy, r);
     }
     else if (lua_gettop(L) > 3){
         int r = lua_tonumber(L,3);
         uint8_t c = lua_tonumber(L,4);
 
-        _graphicsForLuaApi->circfill(ox, oy, r, c);
+        apiContext(L)->graphics->circfill(ox, oy, r, c);
     }
 
     return 0;
@@ -182,13 +180,13 @@ int rect(lua_State *L){
         int y2 = lua_tonumber(L,4);
 
         if (lua_gettop(L) == 4){
-            _graphicsForLuaApi->rect(x1, y1, x2, y2);
+            apiContext(L)->graphics->rect(x1, y1, x2, y2);
 
         }
         else {
             uint8_t c = lua_tonumber(L,5);
 
-            _graphicsForLuaApi->rect(x1, y1, x2, y2, c);
+            apiContext(L)->graphics->rect(x1, y1, x2, y2, c);
         }
     }
 
@@ -203,13 +201,13 @@ int rectfill(lua_State *L){
         int y2 = lua_tonumber(L,4);
 
         if (lua_gettop(L) == 4){
-            _graphicsForLuaApi->rectfill(x1, y1, x2, y2);
+            apiContext(L)->graphics->rectfill(x1, y1, x2, y2);
 
         }
         else {
             double c = lua_tonumber(L,5);
 
-            _graphicsForLuaApi->rectfill(x1, y1, x2, y2, c);
+            apiContext(L)->graphics->rectfill(x1, y1, x2, y2, c);
         }
     }
 
@@ -239,13 +237,13 @@ int print(lua_State *L){
     }
 
     if (lua_gettop(L) < 3) {
-        _graphicsForLuaApi->print(str);
+        apiContext(L)->graphics->print(str);
     }
     else if (lua_gettop(L) == 3) {
         int x = lua_tonumber(L,2);
         int y = lua_tonumber(L,3);
 
-        _graphicsForLuaApi->print(str, x, y);
+        apiContext(L)->graphics->print(str, x, y);
     }
     else {
         int x = lua_tonumber(L,2);
@@ -253,7 +251,7 @@ int print(lua_State *L){
 
         uint8_t c = lua_tonumber(L,4);
 
-        _graphicsForLuaApi->print(str, x, y, c);
+        apiContext(L)->graphics->print(str, x, y, c);
     }
 
     return 0;
@@ -286,7 +284,7 @@ int spr(lua_State *L) {
         flip_y = lua_toboolean(L,7);
     }
 
-    _graphicsForLuaApi->spr(n, x, y, w, h, flip_x, flip_y);
+    apiContext(L)->graphics->spr(n, x, y, w, h, flip_x, flip_y);
 
     return 0;
 }
@@ -321,7 +319,7 @@ int sspr(lua_State *L) {
         flip_y = lua_toboolean(L,10);
     }
 
-    _graphicsForLuaApi->sspr(
+    apiContext(L)->graphics->sspr(
         sx,
         sy,
         sw,
@@ -340,12 +338,12 @@ int fget(lua_State *L) {
     double n = lua_tonumber(L,1);
 
     if (lua_gettop(L) == 1) {
-        uint8_t result = _graphicsForLuaApi->fget((uint8_t)n);
+        uint8_t result = apiContext(L)->graphics->fget((uint8_t)n);
         lua_pushinteger(L, result);
     }
     else {
         double f = lua_tonumber(L,2);
-        bool result = _graphicsForLuaApi->fget((uint8_t)n, (uint8_t)f);
+        bool result = apiContext(L)->graphics->fget((uint8_t)n, (uint8_t)f);
         lua_pushboolean(L, result);
     }
 
@@ -358,11 +356,11 @@ int fset(lua_State *L) {
     if (lua_gettop(L) > 2) {
         double f = lua_tonumber(L,2);
         double v = lua_toboolean(L,3);
-        _graphicsForLuaApi->fset((uint8_t)n, (uint8_t)f, (bool)v);
+        apiContext(L)->graphics->fset((uint8_t)n, (uint8_t)f, (bool)v);
     }
     else {
         double v = lua_tonumber(L,2);
-        _graphicsForLuaApi->fset((uint8_t)n, (uint8_t)v);
+        apiContext(L)->graphics->fset((uint8_t)n, (uint8_t)v);
     }
 
     return 0;
@@ -371,7 +369,7 @@ int fset(lua_State *L) {
 int sget(lua_State *L) {
     int x = lua_tonumber(L,1);
     int y = lua_tonumber(L,2);
-    uint8_t result = _graphicsForLuaApi->sget((uint8_t)x, (uint8_t)y);
+    uint8_t result = apiContext(L)->graphics->sget((uint8_t)x, (uint8_t)y);
     lua_pushinteger(L, result);
 
     return 1;
@@ -381,7 +379,7 @@ int sset(lua_State *L) {
     int x = lua_tonumber(L,1);
     int y = lua_tonumber(L,2);
     uint8_t c = lua_tonumber(L,3);
-    _graphicsForLuaApi->sset(x, y, c);
+    apiContext(L)->graphics->sset(x, y, c);
 
     return 0;
 }
@@ -396,7 +394,7 @@ int camera(lua_State *L) {
         y = lua_tonumber(L,2);
     }
     
-    _graphicsForLuaApi->camera(x, y);
+    apiContext(L)->graphics->camera(x, y);
 
     return 0;
 }
@@ -408,10 +406,10 @@ int clip(lua_State *L) {
         int w = lua_tonumber(L,3);
         int h = lua_tonumber(L,4);
 
-        _graphicsForLuaApi->clip(x, y, w, h);
+        apiContext(L)->graphics->clip(x, y, w, h);
     }
     else {
-        _graphicsForLuaApi->clip();
+        apiContext(L)->graphics->clip();
     }
 
     return 0;
@@ -421,7 +419,7 @@ int mget(lua_State *L) {
     int celx = lua_tonumber(L,1);
     int cely = lua_tonumber(L,2);
 
-    uint8_t result = _graphicsForLuaApi->mget(celx, cely);
+    uint8_t result = apiContext(L)->graphics->mget(celx, cely);
     lua_pushnumber(L, result);
 
     return 1;
@@ -432,7 +430,7 @@ int mset(lua_State *L) {
     int cely = lua_tonumber(L,2);
     uint8_t snum = lua_tonumber(L, 3);
 
-    _graphicsForLuaApi->mset(celx, cely, snum);
+    apiContext(L)->graphics->mset(celx, cely, snum);
 
     return 0;
 }
@@ -450,14 +448,14 @@ int map(lua_State *L) {
         layer = lua_tonumber(L,7);
     }
 
-    _graphicsForLuaApi->map(celx, cely, sx, sy, celw, celh, layer);
+    apiContext(L)->graphics->map(celx, cely, sx, sy, celw, celh, layer);
 
     return 0;
 }
 
 int pal(lua_State *L) {
     if (lua_gettop(L) == 0) {
-        _graphicsForLuaApi->pal();
+        apiContext(L)->graphics->pal();
         
         return 0;
     }
@@ -471,14 +469,14 @@ int pal(lua_State *L) {
         p = lua_tonumber(L,3);
     }
 
-    _graphicsForLuaApi->pal(c0, c1, p);
+    apiContext(L)->graphics->pal(c0, c1, p);
 
     return 0;
 }
 
 int palt(lua_State *L) {
     if (lua_gettop(L) == 0) {
-        _graphicsForLuaApi->palt();
+        apiContext(L)->graphics->palt();
         
         return 0;
     }
@@ -486,7 +484,7 @@ int palt(lua_State *L) {
     uint8_t c = lua_tonumber(L,1);
     bool t = lua_toboolean(L,2);
 
-    _graphicsForLuaApi->palt(c, t);
+    apiContext(L)->graphics->palt(c, t);
 
     return 0;
 }
@@ -496,24 +494,24 @@ int cursor(lua_State *L) {
     int y = lua_tonumber(L,2);
 
     if (lua_gettop(L) <= 2) {
-        _graphicsForLuaApi->cursor(x, y);
+        apiContext(L)->graphics->cursor(x, y);
         return 0;
     }
 
     uint8_t c = lua_tonumber(L,3);
 
-    _graphicsForLuaApi->cursor(x, y, c);
+    apiContext(L)->graphics->cursor(x, y, c);
 
     return 0;
 
 }
 
 int fillp(lua_State *L) {
-    return noop("fillp");
+    return noop(L, "fillp");
 }
 
 int flip(lua_State *L) {
-    return noop("flip");
+    return noop(L, "flip");
 }
 
 //Input
@@ -522,7 +520,7 @@ int flip(lua_State *L) {
 int btn(lua_State *L){
     double i = lua_tonumber(L,1);
 
-    bool pressed = _inputForLuaApi->btn((int)i);
+    bool pressed = apiContext(L)->input->btn((int)i);
 
     lua_pushboolean(L, pressed);
 
@@ -531,7 +529,7 @@ int btn(lua_State *L){
 int btnp(lua_State *L){
     double i = lua_tonumber(L,1);
 
-    bool pressed = _inputForLuaApi->btnp((int)i);
+    bool pressed = apiContext(L)->input->btnp((int)i);
 
     lua_pushboolean(L, pressed);
 
@@ -540,8 +538,8 @@ int btnp(lua_State *L){
 
 //System
 int time(lua_State *L) {
-    int frameCount = _vmForLuaApi->GetFrameCount();
-    int targetFps = _vmForLuaApi->GetTargetFps();
+    int frameCount = apiContext(L)->vm->GetFrameCount();
+    int targetFps = apiContext(L)->vm->GetTargetFps();
 
     double seconds = (double)frameCount / (double)targetFps;
 
@@ -554,6 +552,40 @@ int stat(lua_State *L) {
     return noopreturns(L, "stat");
 }
 
+//Math
+int rnd(lua_State *L) {
+    if (lua_istable(L, 1)) {
+        //random element of a sequence, nil if it is empty
+        lua_Integer count = (lua_Integer)lua_rawlen(L, 1);
+        if (count == 0) {
+            lua_pushnil(L);
+            return 1;
+        }
+
+        lua_Integer idx = (lua_Integer)apiContext(L)->vm->api_rnd((double)count) + 1;
+        lua_rawgeti(L, 1, idx);
+
+        return 1;
+    }
+
+    double range = 1.0;
+    if (lua_gettop(L) > 0) {
+        range = lua_tonumber(L, 1);
+    }
+
+    lua_pushnumber(L, apiContext(L)->vm->api_rnd(range));
+
+    return 1;
+}
+
+int srand(lua_State *L) {
+    double seed = lua_tonumber(L, 1);
+
+    apiContext(L)->vm->api_srand(seed);
+
+    return 0;
+}
+
 //Audio
 int music(lua_State *L) {
     int n = lua_tonumber(L,1);
@@ -566,7 +598,7 @@ int music(lua_State *L) {
         channelmask = (int)lua_tonumber(L, 3);
     }
 
-    _audioForLuaApi->api_music(n, fadems, channelmask);
+    apiContext(L)->audio->api_music(n, fadems, channelmask);
 
     return 0;
 }
@@ -582,22 +614,22 @@ int sfx(lua_State *L) {
         offset = (int)lua_tonumber(L, 3);
     }
 
-    _audioForLuaApi->api_sfx((int)n, channel, offset);
+    apiContext(L)->audio->api_sfx((int)n, channel, offset);
     
     return 0;
 }
 
 //Memory
 int cstore(lua_State *L) {
-    return noop("cstore");
+    return noop(L, "cstore");
 }
 
 int api_memcpy(lua_State *L) {
-    return noop("memcpy");
+    return noop(L, "memcpy");
 }
 
 int api_memset(lua_State *L) {
-    return noop("memset");
+    return noop(L, "memset");
 }
 
 int peek(lua_State *L) {
@@ -605,16 +637,16 @@ int peek(lua_State *L) {
 }
 
 int poke(lua_State *L) {
-    return noop("poke");
+    return noop(L, "poke");
 }
 
 int reload(lua_State *L) {
-    return noop("reload");
+    return noop(L, "reload");
 }
 
 //cart data
 int cartdata(lua_State *L) {
-    return noop("cartdata");
+    return noop(L, "cartdata");
 }
 
 int dget(lua_State *L) {
@@ -622,24 +654,63 @@ int dget(lua_State *L) {
 }
 
 int dset(lua_State *L) {
-    return noop("dset");
+    return noop(L, "dset");
 }
 
-int listcarts(lua_State *L) {
-    //get cart list from VM (who should get it from host)
-    vector<string> carts = _vmForLuaApi->GetCartList();
+int cartcount(lua_State *L) {
+    CartLibrary* library = apiContext(L)->vm->GetCartLibrary();
 
-    lua_createtable(L, carts.size(), 0);
-    int newTable = lua_gettop(L);
-    int index = 1;
+    lua_pushinteger(L, library ? library->GetCartCount() : 0);
 
-    for(size_t i = 0; i < carts.size(); i++){
-        lua_pushstring(L, carts[i].c_str());
-        lua_rawseti(L, newTable, index);
-        
-        ++index;
+    return 1;
+}
+
+//returns path, title, author for the 1 based cart index
+int cartinfo(lua_State *L) {
+    CartLibrary* library = apiContext(L)->vm->GetCartLibrary();
+    int idx = lua_tonumber(L,1);
+
+    const CartIndexEntry* entry = library ? library->GetEntry(idx - 1) : nullptr;
+    if (!entry) {
+        return 0;
+    }
+
+    lua_pushstring(L, entry->Path.c_str());
+    lua_pushstring(L, entry->Title.c_str());
+    lua_pushstring(L, entry->Author.c_str());
+
+    return 3;
+}
+
+//draws the cart label scaled down to size x size pixels
+int drawcartlabel(lua_State *L) {
+    CartLibrary* library = apiContext(L)->vm->GetCartLibrary();
+    int idx = lua_tonumber(L,1);
+    int x = lua_tonumber(L,2);
+    int y = lua_tonumber(L,3);
+    int size = 128;
+    if (lua_gettop(L) > 3) {
+        size = lua_tonumber(L,4);
+    }
+
+    const uint8_t* label = library ? library->GetLabel(idx - 1) : nullptr;
+    if (!label || size <= 0) {
+        lua_pushboolean(L, false);
+        return 1;
     }
 
+    for (int ly = 0; ly < size; ly++) {
+        int srcY = ly * 128 / size;
+        for (int lx = 0; lx < size; lx++) {
+            int srcX = lx * 128 / size;
+            uint8_t packed = label[srcY * 64 + srcX / 2];
+            uint8_t c = (srcX & 1) ? packed >> 4 : packed & 0x0f;
+
+            apiContext(L)->graphics->pset(x + lx, y + ly, c);
+        }
+    }
+
+    lua_pushboolean(L, true);
     return 1;
 }
 
@@ -647,22 +718,107 @@ int loadcart(lua_State *L) {
     if (lua_isstring(L, 1)){
         const char * str = "";
         str = lua_tolstring(L, 1, nullptr);
-        _vmForLuaApi->QueueCartChange(str);
+        apiContext(L)->vm->QueueCartChange(str);
     }
 
     return 0;
 }
 
 int getbioserror(lua_State *L) {
-    string error = _vmForLuaApi->GetBiosError();
+    string error = apiContext(L)->vm->GetBiosError();
 
     lua_pushstring(L, error.c_str());
 
     return 1;
 }
 
+//frame pacing so far as a table, histogram[i] counts frames that took i to
+//i + 1 milliseconds. skipped counts unchanged frames that weren't redrawn
+int framestats(lua_State *L) {
+    FramePacer* pacer = apiContext(L)->vm->GetFramePacer();
+    if (!pacer) {
+        return 0;
+    }
+
+    framePacerStats stats = pacer->GetStats();
+
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, stats.frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, stats.missedDeadlines);
+    lua_setfield(L, -2, "missed");
+    lua_pushinteger(L, stats.resyncs);
+    lua_setfield(L, -2, "resyncs");
+    lua_pushnumber(L, stats.averageFrameUs / 1000.0);
+    lua_setfield(L, -2, "average");
+    lua_pushnumber(L, stats.worstFrameUs / 1000.0);
+    lua_setfield(L, -2, "worst");
+
+    FramePresenter* presenter = apiContext(L)->vm->GetFramePresenter();
+    lua_pushinteger(L, presenter ? presenter->GetSkippedFrames() : 0);
+    lua_setfield(L, -2, "skipped");
+
+    lua_createtable(L, PACER_HISTOGRAM_BUCKETS, 0);
+    for (int i = 0; i < PACER_HISTOGRAM_BUCKETS; i++) {
+        lua_pushinteger(L, stats.histogram[i]);
+        lua_rawseti(L, -2, i);
+    }
+    lua_setfield(L, -2, "histogram");
+
+    return 1;
+}
+
+//turns both profilers on or off for carts loaded from now on and returns
+//whether they are on
+int profiling(lua_State *L) {
+    picoApiContext* context = apiContext(L);
+    if (lua_gettop(L) > 0) {
+        context->apiProfiler->SetEnabled(lua_toboolean(L, 1));
+        context->luaProfiler->SetEnabled(lua_toboolean(L, 1));
+    }
+    lua_pushboolean(L, context->apiProfiler->IsEnabled());
+
+    return 1;
+}
+
+//the last profiled cart's api calls as a list of {name, calls, ms} per frame,
+//most time first. nil before anything has been profiled
+int apistats(lua_State *L) {
+    ApiProfiler* profiler = apiContext(L)->apiProfiler;
+    uint32_t const frames = profiler->GetFrames();
+    if (frames == 0) {
+        return 0;
+    }
+
+    vector<apiCallStats> totals = profiler->GetTotals();
+    std::stable_sort(totals.begin(), totals.end(), [](const apiCallStats &a, const apiCallStats &b) {
+        return a.ns > b.ns;
+    });
+
+    lua_createtable(L, totals.size(), 1);
+    int index = 1;
+    for (auto const &function : totals) {
+        if (function.calls == 0) {
+            continue;
+        }
+
+        lua_createtable(L, 0, 3);
+        lua_pushstring(L, function.name);
+        lua_setfield(L, -2, "name");
+        lua_pushnumber(L, (double)function.calls / frames);
+        lua_setfield(L, -2, "calls");
+        lua_pushnumber(L, function.ns / 1000000.0 / frames);
+        lua_setfield(L, -2, "ms");
+        lua_rawseti(L, -2, index++);
+    }
+    lua_pushinteger(L, frames);
+    lua_setfield(L, -2, "frames");
+
+    return 1;
+}
+
 int loadbioscart(lua_State *L) {
-    //_vmForLuaApi->LoadBiosCart();
+    //apiContext(L)->vm->LoadBiosCart();
 
     return 0;
 }
@@ -11,9 +11,55 @@ extern "C" {
 #include "graphics.h"
 #include "Input.h"
 #include "vm.h"
+#include "apiProfiler.h"
+#include "luaProfiler.h"
+
+//what the api functions act on. Each Vm keeps its own and points its
+//lua_State at it, so any number of them can run side by side
+struct picoApiContext {
+    Graphics* graphics;
+    Input* input;
+    Vm* vm;
+    Audio* audio;
+    ApiProfiler* apiProfiler;
+    LuaProfiler* luaProfiler;
+};
+
+void initPicoApi(lua_State* L, picoApiContext* context);
+
+//coroutines get a copy of their main state's extra space when they start,
+//so this works from inside them too
+static inline picoApiContext* apiContext(lua_State* L) {
+    return *(picoApiContext**)lua_getextraspace(L);
+}
+
+//stands in for F while the profiler is on. Each F gets its own plain C
+//function rather than a closure, so profiling allocates nothing in the lua
+//heap and tables keyed by objects iterate in the same order as without it
+template<lua_CFunction F>
+int profiledCall(lua_State* L) {
+    uint64_t const start = ApiProfiler::Now();
+    int const results = F(L);
+    uint64_t const end = ApiProfiler::Now();
+
+    picoApiContext* const context = apiContext(L);
+    context->apiProfiler->Record(F, end - start);
+    context->luaProfiler->RecordNative(L, F, start, end);
+
+    return results;
+}
 
-//this can probably go away when I'm loading actual carts and just have to expose api to lua
-void initPicoApi(Graphics* graphics, Input* input, Vm* vm, Audio* audio);
+//sets global name to F, timed by the profiler when it is active
+template<lua_CFunction F>
+void registerApiFunction(lua_State* L, const char* name, ApiProfiler* profiler) {
+    if (!profiler->IsActive()) {
+        lua_register(L, name, F);
+        return;
+    }
+
+    profiler->AddFunction(name, F);
+    lua_register(L, name, profiledCall<F>);
+}
 
 //graphics api
 int cls(lua_State *L);
@@ -67,6 +113,10 @@ int sfx(lua_State *L);
 int time(lua_State *L);
 int stat(lua_State *L);
 
+//math
+int rnd(lua_State *L);
+int srand(lua_State *L);
+
 //memory api
 int cstore(lua_State *L);
 int api_memcpy(lua_State *L);
@@ -81,9 +131,14 @@ int dget(lua_State *L);
 int dset(lua_State *L);
 
 //file system/vm functions
-int listcarts(lua_State *L);
+int cartcount(lua_State *L);
+int cartinfo(lua_State *L);
+int drawcartlabel(lua_State *L);
 int loadcart(lua_State *L);
 int getbioserror(lua_State *L);
+int framestats(lua_State *L);
+int profiling(lua_State *L);
+int apistats(lua_State *L);
 int loadbioscart(lua_State *L);
 
 //system functions
@@ -92,10 +147,6 @@ int loadbioscart(lua_State *L);
 
 //api.tostr(val, hex)
 
-//api.rnd(x)
-
-//api.srand(seed)
-
 //api.flr=math.floor
 
 //api.ceil=math.ceil
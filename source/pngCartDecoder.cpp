@@ -0,0 +1,225 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include "lodepng.h"
+
+#include "pngCartDecoder.h"
+#include "logger.h"
+
+#define BYTES_PER_PIXEL 4
+#define ROW_BYTES (PNG_CART_WIDTH * BYTES_PER_PIXEL)
+
+//label area inside the png cart image
+#define PNG_LABEL_X 16
+#define PNG_LABEL_Y 24
+
+//pico 8 palette as it appears on png cart labels
+static const uint8_t labelPaletteRgb[16][3] = {
+    {  0,   0,   0}, { 29,  43,  83}, {126,  37,  83}, {  0, 135,  81},
+    {171,  82,  54}, { 95,  87,  79}, {194, 195, 199}, {255, 241, 232},
+    {255,   0,  77}, {255, 163,   0}, {255, 240,  36}, {  0, 231,  86},
+    { 41, 173, 255}, {131, 118, 156}, {255, 119, 168}, {255, 204, 170}
+};
+
+//the low 2 bits of each channel hold cart data, so match on the closest color
+static uint8_t nearestLabelColor(const uint8_t* rgba) {
+    //labels saved by pico 8 only use palette colors, so try an exact match first
+    for (uint8_t c = 0; c < 16; c++) {
+        if ((rgba[0] & 0xfc) == (labelPaletteRgb[c][0] & 0xfc) &&
+            (rgba[1] & 0xfc) == (labelPaletteRgb[c][1] & 0xfc) &&
+            (rgba[2] & 0xfc) == (labelPaletteRgb[c][2] & 0xfc))
+        {
+            return c;
+        }
+    }
+
+    uint8_t best = 0;
+    int bestDist = 0x7fffffff;
+    for (uint8_t c = 0; c < 16; c++) {
+        int dr = (int)rgba[0] - labelPaletteRgb[c][0];
+        int dg = (int)rgba[1] - labelPaletteRgb[c][1];
+        int db = (int)rgba[2] - labelPaletteRgb[c][2];
+        int dist = dr * dr + dg * dg + db * db;
+        if (dist < bestDist) {
+            bestDist = dist;
+            best = c;
+        }
+    }
+
+    return best;
+}
+
+//pulls the cart bytes (and label pixels) out of one row of RGBA pixels
+static void extractRow(const uint8_t* row, int y, uint8_t* cartData, uint8_t* label) {
+    uint8_t* out = cartData + y * PNG_CART_WIDTH;
+
+    for (int x = 0; x < PNG_CART_WIDTH; x++) {
+        const uint8_t* px = row + x * BYTES_PER_PIXEL;
+        out[x] = ((px[3] & 3) << 6) | ((px[0] & 3) << 4) | ((px[1] & 3) << 2) | (px[2] & 3);
+    }
+
+    int labelY = y - PNG_LABEL_Y;
+    if (label && labelY >= 0 && labelY < 128) {
+        const uint8_t* labelRow = row + PNG_LABEL_X * BYTES_PER_PIXEL;
+        for (int x = 0; x < 128; x += 2) {
+            uint8_t left = nearestLabelColor(labelRow + x * BYTES_PER_PIXEL);
+            uint8_t right = nearestLabelColor(labelRow + (x + 1) * BYTES_PER_PIXEL);
+            label[labelY * 64 + x / 2] = left | (right << 4);
+        }
+    }
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int pa = abs((int)b - c);
+    int pb = abs((int)a - c);
+    int pc = abs((int)a + b - c - c);
+    if (pc < pa && pc < pb) return c;
+    if (pb < pa) return b;
+    return a;
+}
+
+//undoes the png filter for one scanline in place. prev is the already
+//unfiltered previous scanline, or null for the first one
+static bool unfilterRow(uint8_t* row, const uint8_t* prev, uint8_t filter) {
+    switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (int i = BYTES_PER_PIXEL; i < ROW_BYTES; i++) {
+                row[i] += row[i - BYTES_PER_PIXEL];
+            }
+            break;
+        case 2:
+            if (prev) {
+                for (int i = 0; i < ROW_BYTES; i++) {
+                    row[i] += prev[i];
+                }
+            }
+            break;
+        case 3:
+            for (int i = 0; i < ROW_BYTES; i++) {
+                int left = i >= BYTES_PER_PIXEL ? row[i - BYTES_PER_PIXEL] : 0;
+                int up = prev ? prev[i] : 0;
+                row[i] += (uint8_t)((left + up) >> 1);
+            }
+            break;
+        case 4:
+            for (int i = 0; i < ROW_BYTES; i++) {
+                uint8_t left = i >= BYTES_PER_PIXEL ? row[i - BYTES_PER_PIXEL] : 0;
+                uint8_t up = prev ? prev[i] : 0;
+                uint8_t upLeft = prev && i >= BYTES_PER_PIXEL ? prev[i - BYTES_PER_PIXEL] : 0;
+                row[i] += paeth(left, up, upLeft);
+            }
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+//full lodepng decode for anything that isn't a plain 8 bit RGBA png
+static bool decodePngCartFallback(const std::vector<unsigned char> &fileData, uint8_t* cartData, uint8_t* label, std::string &error) {
+    std::vector<unsigned char> image;
+    unsigned width, height;
+
+    unsigned lodeError = lodepng::decode(image, width, height, fileData);
+    if (lodeError) {
+        error = "png decoder error " + std::string(lodepng_error_text(lodeError));
+        return false;
+    }
+
+    if (width != PNG_CART_WIDTH || height != PNG_CART_HEIGHT) {
+        error = "Invalid png dimensions";
+        return false;
+    }
+
+    for (int y = 0; y < PNG_CART_HEIGHT; y++) {
+        extractRow(&image[y * ROW_BYTES], y, cartData, label);
+    }
+
+    return true;
+}
+
+bool decodePngCart(std::string filename, uint8_t* cartData, uint8_t* label, std::string &error) {
+    std::vector<unsigned char> fileData;
+    unsigned lodeError = lodepng::load_file(fileData, filename);
+    if (lodeError) {
+        error = "png decoder error " + std::string(lodepng_error_text(lodeError));
+        return false;
+    }
+
+    unsigned width, height;
+    lodepng::State state;
+    lodeError = lodepng_inspect(&width, &height, &state, fileData.data(), fileData.size());
+    if (lodeError) {
+        error = "png decoder error " + std::string(lodepng_error_text(lodeError));
+        return false;
+    }
+
+    if (width != PNG_CART_WIDTH || height != PNG_CART_HEIGHT) {
+        error = "Invalid png dimensions";
+        return false;
+    }
+
+    const LodePNGColorMode &color = state.info_png.color;
+    if (color.colortype != LCT_RGBA || color.bitdepth != 8 || state.info_png.interlace_method != 0) {
+        Logger::Write("png cart is not 8 bit RGBA, using full decode\n");
+        return decodePngCartFallback(fileData, cartData, label, error);
+    }
+
+    //gather the IDAT chunks, then drop the file. lodepng only inflates
+    //whole buffers, so the compressed data stays until the scanlines are out
+    std::vector<unsigned char> idat;
+    const unsigned char* end = fileData.data() + fileData.size();
+    const unsigned char* chunk = fileData.data() + 8;
+    while (chunk + 12 <= end) {
+        unsigned length = lodepng_chunk_length(chunk);
+        if (length > (size_t)(end - chunk) - 12) {
+            break;
+        }
+
+        if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+            const unsigned char* data = lodepng_chunk_data_const(chunk);
+            idat.insert(idat.end(), data, data + length);
+        }
+        else if (lodepng_chunk_type_equals(chunk, "IEND")) {
+            break;
+        }
+
+        chunk = lodepng_chunk_next_const(chunk, end);
+    }
+    std::vector<unsigned char>().swap(fileData);
+
+    //each scanline is a filter type byte followed by the row's pixels
+    std::vector<unsigned char> scanlines;
+    lodeError = lodepng::decompress(scanlines, idat.data(), idat.size());
+    std::vector<unsigned char>().swap(idat);
+    if (lodeError) {
+        error = "png decoder error " + std::string(lodepng_error_text(lodeError));
+        return false;
+    }
+
+    if (scanlines.size() < (size_t)PNG_CART_HEIGHT * (ROW_BYTES + 1)) {
+        error = "png decoder error: not enough image data";
+        return false;
+    }
+
+    const uint8_t* prev = nullptr;
+    for (int y = 0; y < PNG_CART_HEIGHT; y++) {
+        uint8_t* line = &scanlines[y * (ROW_BYTES + 1)];
+        uint8_t* row = line + 1;
+
+        if (!unfilterRow(row, prev, line[0])) {
+            error = "png decoder error: invalid filter type";
+            return false;
+        }
+
+        extractRow(row, y, cartData, label);
+        prev = row;
+    }
+
+    return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#define PNG_CART_WIDTH 160
+#define PNG_CART_HEIGHT 205
+
+//160x205 == 32800 == 0x8020. 0x8000 is actual used data size, 0x8000 is the version byte
+#define PNG_CART_DATA_SIZE 0x8020
+
+//Extracts the cart bytes hidden in the low 2 bits of each channel of a .p8.png
+//straight from the unfiltered scanlines into cartData, without building an RGBA
+//copy of the image. If label is not null it receives the 128x128 label, packed
+//two pixels per byte like the sprite sheet.
+bool decodePngCart(std::string filename, uint8_t* cartData, uint8_t* label, std::string &error);
@@ -0,0 +1,582 @@
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "pxa.h"
+
+static char const *legacyCompressionLut = "\n 0123456789abcdefghijklmnopqrstuvwxyz!#%(){}[]<>+=/*:;.,~_";
+
+bool pxa_is_compressed(const uint8_t* data, size_t size) {
+    return size >= PXA_HEADER_SIZE &&
+        data[0] == '\0' && data[1] == 'p' && data[2] == 'x' && data[3] == 'a';
+}
+
+bool legacy_is_compressed(const uint8_t* data, size_t size) {
+    return size >= PXA_HEADER_SIZE &&
+        data[0] == ':' && data[1] == 'c' && data[2] == ':' && data[3] == '\0';
+}
+
+//LSB first bit reader that keeps up to 64 bits buffered, refilled a word at a
+//time. Reads past the end of the data return zeros.
+class bit_reader {
+    const uint8_t* _data;
+    size_t _size;
+    size_t _next;
+    uint64_t _bits;
+    int _count;
+
+    void refill() {
+        #if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (_next + 8 <= _size) {
+            //load a whole word and keep however many whole bytes fit. bits
+            //above _count are already the right stream bits, so or-ing the
+            //same bytes in again on the next refill is harmless
+            uint64_t word;
+            memcpy(&word, _data + _next, sizeof(word));
+            _bits |= word << _count;
+            _next += (63 - _count) >> 3;
+            _count |= 56;
+            return;
+        }
+        #endif
+
+        while (_count <= 56) {
+            uint64_t byte = _next < _size ? _data[_next] : 0;
+            _bits |= byte << _count;
+            _next++;
+            _count += 8;
+        }
+    }
+
+    public:
+    bit_reader(const uint8_t* data, size_t size, size_t start) {
+        _data = data;
+        _size = size;
+        _next = start;
+        _bits = 0;
+        _count = 0;
+    }
+
+    //at most 32 bits at a time
+    uint32_t get(int count) {
+        if (_count < count) {
+            refill();
+        }
+
+        uint32_t value = (uint32_t)(_bits & ((uint64_t(1) << count) - 1));
+        _bits >>= count;
+        _count -= count;
+
+        return value;
+    }
+
+    //stream position in bits from the start of the data
+    size_t position() {
+        return _next * 8 - _count;
+    }
+};
+
+//implementation based on zepto8 code.cpp, pxa_decompress
+//https://github.com/samhocevar/zepto8/blob/b1a13516945c49e47495c739e6a43a241ad99291/src/pico8/code.cpp
+bool pxa_decompress(const uint8_t* data, size_t size, std::string &out) {
+    out.clear();
+    if (!pxa_is_compressed(data, size)) {
+        return false;
+    }
+
+    size_t length = data[4] * 256 + data[5];
+    size_t compressedBits = (data[6] * 256 + data[7]) * 8;
+
+    out.resize(length);
+    char* dst = &out[0];
+    size_t written = 0;
+
+    bit_reader reader(data, size, PXA_HEADER_SIZE);
+
+    //move to front list of byte values. moving an entry to the front is a
+    //single memmove of the entries before it
+    uint8_t mtf[256];
+    for (int i = 0; i < 256; i++) {
+        mtf[i] = (uint8_t)i;
+    }
+
+    bool valid = true;
+
+    while (written < length && reader.position() < compressedBits)
+    {
+        if (reader.get(1))
+        {
+            //character: index into the move to front list, with a unary
+            //encoded bit count
+            int nbits = 4;
+            while (reader.get(1) && valid) {
+                valid = ++nbits <= 8;
+            }
+
+            int n = valid ? reader.get(nbits) + (1 << nbits) - 16 : 256;
+            if (n > 255) {
+                valid = false;
+                break;
+            }
+
+            uint8_t ch = mtf[n];
+            memmove(mtf + 1, mtf, n);
+            mtf[0] = ch;
+
+            if (!ch) {
+                break;
+            }
+
+            dst[written++] = (char)ch;
+        }
+        else
+        {
+            int nbits = reader.get(1) ? reader.get(1) ? 5 : 10 : 15;
+            size_t offset = reader.get(nbits) + 1;
+
+            if (nbits == 10 && offset == 1)
+            {
+                //raw block: 8 bit characters up to a terminating zero
+                uint8_t ch;
+                while ((ch = (uint8_t)reader.get(8)) != 0 && written < length) {
+                    dst[written++] = (char)ch;
+                }
+                continue;
+            }
+
+            size_t len = 3;
+            int n;
+            do
+                len += (n = reader.get(3));
+            while (n == 7);
+
+            if (offset > written) {
+                valid = false;
+                break;
+            }
+
+            len = std::min(len, length - written);
+            const char* src = dst + written - offset;
+            if (offset >= len) {
+                memcpy(dst + written, src, len);
+            }
+            else {
+                //overlapping copy repeats the last offset bytes
+                for (size_t i = 0; i < len; i++) {
+                    dst[written + i] = src[i];
+                }
+            }
+            written += len;
+        }
+    }
+
+    out.resize(written);
+
+    return valid;
+}
+
+//from pico 8 wiki: https://pico-8.fandom.com/wiki/P8PNGFileFormat
+//The first four bytes (0x4300-0x4303) are :c:\x00.
+//The next two bytes (0x4304-0x4305) are the length of the decompressed code, stored MSB first.
+//The next two bytes (0x4306-0x4307) are always zero.
+bool legacy_decompress(const uint8_t* data, size_t size, std::string &out) {
+    out.clear();
+    if (!legacy_is_compressed(data, size)) {
+        return false;
+    }
+
+    size_t length = data[4] * 256 + data[5];
+
+    out.resize(length);
+    char* dst = &out[0];
+    size_t written = 0;
+
+    bool valid = true;
+
+    for (size_t i = PXA_HEADER_SIZE; i < size && written < length; ++i) {
+        //0x00: Copy the next byte directly to the output stream.
+        if (data[i] == 0x00) {
+            if (i + 1 >= size) {
+                valid = false;
+                break;
+            }
+            dst[written++] = data[++i];
+        }
+        //0x01-0x3b: Emit a character from a lookup table
+        else if (data[i] < 0x3c) {
+            dst[written++] = legacyCompressionLut[data[i] - 1];
+        }
+        //0x3c-0xff: Calculate an offset and length from this byte and the next byte,
+        //then copy those bytes from what has already been emitted. In other words,
+        //go back "offset" characters in the output stream, copy "length" characters,
+        //then paste them to the end of the output stream. Offset and length are
+        //calculated as:
+        //   offset = (current_byte - 0x3c) * 16 + (next_byte & 0xf)
+        //   length = (next_byte >> 4) + 2
+        else {
+            if (i + 1 >= size) {
+                valid = false;
+                break;
+            }
+
+            size_t offset = (data[i] - 0x3c) * 16 + (data[i + 1] & 0xf);
+            size_t len = (data[i + 1] >> 4) + 2;
+            ++i;
+
+            //references before the start of the output are skipped
+            if (offset == 0 || offset > written) {
+                valid = false;
+                continue;
+            }
+
+            len = std::min(len, length - written);
+            const char* src = dst + written - offset;
+            if (offset >= len) {
+                memcpy(dst + written, src, len);
+            }
+            else {
+                for (size_t j = 0; j < len; j++) {
+                    dst[written + j] = src[j];
+                }
+            }
+            written += len;
+        }
+    }
+
+    out.resize(written);
+
+    return valid;
+}
+
+//hash chain match finder shared by both compressors. positions are inserted
+//once the compressor has moved past them, so find() only sees earlier data
+class match_finder {
+    const uint8_t* _data;
+    size_t _size;
+    size_t _window;
+    size_t _maxLen;
+    size_t _minLen;
+    int _maxChain;
+    std::vector<int32_t> _head;
+    std::vector<int32_t> _prev;
+
+    static const int HASH_BITS = 12;
+
+    uint32_t hash(size_t pos) {
+        uint32_t h = _data[pos] << 8 ^ _data[pos + 1] << 4;
+        if (_minLen >= 3) {
+            h ^= _data[pos + 2];
+        }
+        return (h ^ h >> HASH_BITS) & ((1 << HASH_BITS) - 1);
+    }
+
+    public:
+    match_finder(const uint8_t* data, size_t size, size_t window, size_t minLen, size_t maxLen, int maxChain) {
+        _data = data;
+        _size = size;
+        _window = window;
+        _minLen = minLen;
+        _maxLen = maxLen;
+        _maxChain = maxChain;
+        _head.assign(1 << HASH_BITS, -1);
+        _prev.assign(size, -1);
+    }
+
+    void insert(size_t pos) {
+        if (pos + _minLen > _size) {
+            return;
+        }
+
+        uint32_t h = hash(pos);
+        _prev[pos] = _head[h];
+        _head[h] = (int32_t)pos;
+    }
+
+    //length of the longest earlier match at pos (0 if under the minimum)
+    size_t find(size_t pos, size_t &offset) {
+        if (pos + _minLen > _size) {
+            return 0;
+        }
+
+        size_t limit = std::min(_maxLen, _size - pos);
+        size_t best = 0;
+        int chain = _maxChain;
+
+        for (int32_t cand = _head[hash(pos)]; cand >= 0 && chain-- > 0; cand = _prev[cand]) {
+            if (pos - cand > _window) {
+                break;
+            }
+
+            const uint8_t* a = _data + cand;
+            const uint8_t* b = _data + pos;
+            if (a[best] != b[best]) {
+                continue;
+            }
+
+            size_t len = 0;
+            while (len < limit && a[len] == b[len]) {
+                len++;
+            }
+
+            if (len > best) {
+                best = len;
+                offset = pos - cand;
+                if (len == limit) {
+                    break;
+                }
+            }
+        }
+
+        return best >= _minLen ? best : 0;
+    }
+};
+
+static int clampEffort(int effort) {
+    return std::max(0, std::min(9, effort));
+}
+
+//LSB first, the reverse of bit_reader
+class bit_writer {
+    std::vector<uint8_t> &_out;
+    uint32_t _bits;
+    int _count;
+
+    public:
+    bit_writer(std::vector<uint8_t> &out) : _out(out) {
+        _bits = 0;
+        _count = 0;
+    }
+
+    //at most 24 bits at a time
+    void put(uint32_t value, int count) {
+        _bits |= value << _count;
+        _count += count;
+        while (_count >= 8) {
+            _out.push_back((uint8_t)_bits);
+            _bits >>= 8;
+            _count -= 8;
+        }
+    }
+
+    void flush() {
+        if (_count > 0) {
+            _out.push_back((uint8_t)_bits);
+        }
+        _bits = 0;
+        _count = 0;
+    }
+};
+
+//bits needed after the unary prefix to store move to front index n
+static int pxaIndexBits(int n) {
+    int nbits = 4;
+    while (n >= (1 << (nbits + 1)) - 16) {
+        nbits++;
+    }
+    return nbits;
+}
+
+static int pxaLiteralCost(int n) {
+    int nbits = pxaIndexBits(n);
+    return 1 + (nbits - 4) + 1 + nbits;
+}
+
+static int pxaBackrefCost(size_t offset, size_t len) {
+    int offsetBits = offset <= 32 ? 2 + 5 : offset <= 1024 ? 2 + 10 : 1 + 15;
+    return 1 + offsetBits + 3 * (int)((len - 3) / 7 + 1);
+}
+
+static int mtfIndex(const uint8_t* mtf, uint8_t ch) {
+    return (int)(std::find(mtf, mtf + 256, ch) - mtf);
+}
+
+bool pxa_compress(const std::string &input, std::vector<uint8_t> &out, int effort) {
+    out.clear();
+
+    size_t length = input.length();
+    const uint8_t* data = (const uint8_t*)input.data();
+    if (length > 0xffff || memchr(data, 0, length)) {
+        return false;
+    }
+
+    effort = clampEffort(effort);
+
+    out.reserve(PXA_HEADER_SIZE + length);
+    out.push_back('\0');
+    out.push_back('p');
+    out.push_back('x');
+    out.push_back('a');
+    out.push_back((uint8_t)(length >> 8));
+    out.push_back((uint8_t)length);
+    //compressed size, filled in at the end
+    out.push_back(0);
+    out.push_back(0);
+
+    uint8_t mtf[256];
+    for (int i = 0; i < 256; i++) {
+        mtf[i] = (uint8_t)i;
+    }
+
+    bit_writer writer(out);
+    //offsets are stored in at most 15 bits, a 10 bit offset of 1 means a raw block
+    match_finder finder(data, length, 0x8000, 3, length, 4 << effort);
+    bool lazy = effort >= 4;
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t offset = 0;
+        size_t len = finder.find(pos, offset);
+        finder.insert(pos);
+
+        //a longer match starting at the next byte is worth a literal first
+        if (len && lazy && pos + 1 < length) {
+            size_t nextOffset;
+            if (finder.find(pos + 1, nextOffset) > len + 1) {
+                len = 0;
+            }
+        }
+
+        //short far matches can cost more than the literals they replace
+        if (len && len <= 4) {
+            uint8_t trial[256];
+            memcpy(trial, mtf, sizeof(trial));
+            int literalCost = 0;
+            for (size_t i = 0; i < len; i++) {
+                int n = mtfIndex(trial, data[pos + i]);
+                literalCost += pxaLiteralCost(n);
+                memmove(trial + 1, trial, n);
+                trial[0] = data[pos + i];
+            }
+            if (literalCost <= pxaBackrefCost(offset, len)) {
+                len = 0;
+            }
+        }
+
+        if (len) {
+            writer.put(0, 1);
+            if (offset <= 32) {
+                writer.put(3, 2);
+                writer.put((uint32_t)(offset - 1), 5);
+            }
+            else if (offset <= 1024) {
+                writer.put(1, 2);
+                writer.put((uint32_t)(offset - 1), 10);
+            }
+            else {
+                writer.put(0, 1);
+                writer.put((uint32_t)(offset - 1), 15);
+            }
+
+            size_t remaining = len - 3;
+            while (remaining >= 7) {
+                writer.put(7, 3);
+                remaining -= 7;
+            }
+            writer.put((uint32_t)remaining, 3);
+
+            for (size_t i = 1; i < len; i++) {
+                finder.insert(pos + i);
+            }
+            pos += len;
+        }
+        else {
+            uint8_t ch = data[pos];
+            int n = mtfIndex(mtf, ch);
+            int nbits = pxaIndexBits(n);
+
+            writer.put(1, 1);
+            //unary bit count: one set bit per bit over 4, then a clear bit
+            writer.put((1 << (nbits - 4)) - 1, nbits - 4 + 1);
+            writer.put((uint32_t)(n - ((1 << nbits) - 16)), nbits);
+
+            memmove(mtf + 1, mtf, n);
+            mtf[0] = ch;
+            pos++;
+        }
+    }
+
+    writer.flush();
+
+    if (out.size() > 0xffff) {
+        return false;
+    }
+
+    out[6] = (uint8_t)(out.size() >> 8);
+    out[7] = (uint8_t)out.size();
+
+    return true;
+}
+
+bool legacy_compress(const std::string &input, std::vector<uint8_t> &out, int effort) {
+    out.clear();
+
+    size_t length = input.length();
+    const uint8_t* data = (const uint8_t*)input.data();
+    if (length > 0xffff) {
+        return false;
+    }
+
+    effort = clampEffort(effort);
+
+    uint8_t lutIndex[256] = {0};
+    for (int i = 0; legacyCompressionLut[i]; i++) {
+        lutIndex[(uint8_t)legacyCompressionLut[i]] = (uint8_t)(i + 1);
+    }
+
+    out.reserve(PXA_HEADER_SIZE + length * 2);
+    out.push_back(':');
+    out.push_back('c');
+    out.push_back(':');
+    out.push_back('\0');
+    out.push_back((uint8_t)(length >> 8));
+    out.push_back((uint8_t)length);
+    out.push_back(0);
+    out.push_back(0);
+
+    //offset is (0xff - 0x3c) * 16 + 15 at most, length 2 to 17
+    match_finder finder(data, length, (0xff - 0x3c) * 16 + 15, 2, 17, 4 << effort);
+    bool lazy = effort >= 4;
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t offset = 0;
+        size_t len = finder.find(pos, offset);
+        finder.insert(pos);
+
+        if (len && lazy && pos + 1 < length) {
+            size_t nextOffset;
+            if (finder.find(pos + 1, nextOffset) > len + 1) {
+                len = 0;
+            }
+        }
+
+        //two lookup table characters fit in the same two bytes as a reference
+        if (len == 2 && lutIndex[data[pos]] && lutIndex[data[pos + 1]]) {
+            len = 0;
+        }
+
+        if (len) {
+            out.push_back((uint8_t)(0x3c + (offset >> 4)));
+            out.push_back((uint8_t)(((len - 2) << 4) | (offset & 0xf)));
+
+            for (size_t i = 1; i < len; i++) {
+                finder.insert(pos + i);
+            }
+            pos += len;
+        }
+        else {
+            uint8_t ch = data[pos];
+            if (lutIndex[ch]) {
+                out.push_back(lutIndex[ch]);
+            }
+            else {
+                out.push_back(0x00);
+                out.push_back(ch);
+            }
+            pos++;
+        }
+    }
+
+    return true;
+}
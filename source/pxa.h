@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+//Code compression used by the code section of png carts. Both formats start
+//with an 8 byte header: 4 magic bytes and the decompressed length (MSB first).
+//pxa ("\0pxa") also stores the compressed size, header included.
+//Format details: https://pico-8.fandom.com/wiki/P8PNGFileFormat
+
+#define PXA_HEADER_SIZE 8
+
+bool pxa_is_compressed(const uint8_t* data, size_t size);
+bool legacy_is_compressed(const uint8_t* data, size_t size);
+
+//Both return false if the stream is corrupt. out holds whatever was decoded
+//up to that point, never more than the declared length.
+bool pxa_decompress(const uint8_t* data, size_t size, std::string &out);
+bool legacy_decompress(const uint8_t* data, size_t size, std::string &out);
+
+//Compressors for the formats above. effort goes from 0 (fastest) to 9
+//(smallest output). Output always decodes back to exactly the input with the
+//matching decompressor. Returns false if the input can't be represented
+//(longer than 65535 bytes, or a zero byte for pxa) or the result is too big
+//for the 16 bit size fields.
+bool pxa_compress(const std::string &input, std::vector<uint8_t> &out, int effort = 6);
+bool legacy_compress(const std::string &input, std::vector<uint8_t> &out, int effort = 6);
@@ -0,0 +1,310 @@
+#include "rewindBuffer.h"
+
+#include <string.h>
+#include <chrono>
+
+//bytes a frame costs besides its delta
+#define REWIND_FRAME_OVERHEAD sizeof(rewindFrame)
+
+static void putLength(std::vector<uint8_t> &out, size_t length) {
+    while (length >= 0x80) {
+        out.push_back((uint8_t)(length | 0x80));
+        length >>= 7;
+    }
+    out.push_back((uint8_t)length);
+}
+
+static size_t getLength(const uint8_t* &in) {
+    size_t length = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        length |= (size_t)(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    length |= (size_t)*in++ << shift;
+
+    return length;
+}
+
+//xors current against base and packs the result as runs of zeros followed by
+//runs of changed bytes, most of a frame's memory doesn't change. Bytes past
+//the end of base count as zeros
+static bool sameWord(const uint8_t* base, size_t baseSize, const uint8_t* current, size_t i) {
+    static const uint8_t zeros[8] = {};
+
+    if (i + 8 <= baseSize) {
+        return memcmp(base + i, current + i, 8) == 0;
+    }
+    if (i >= baseSize) {
+        return memcmp(zeros, current + i, 8) == 0;
+    }
+    for (size_t j = i; j < i + 8; j++) {
+        if ((j < baseSize ? base[j] : 0) != current[j]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void encodeDelta(const uint8_t* base, size_t baseSize, const uint8_t* current, size_t size, std::vector<uint8_t> &out) {
+    out.clear();
+
+    auto const baseByte = [base, baseSize](size_t i) -> uint8_t {
+        return i < baseSize ? base[i] : 0;
+    };
+
+    size_t i = 0;
+    while (i < size) {
+        size_t const zerosStart = i;
+        //a word at a time while nothing changes
+        while (i + 8 <= size && sameWord(base, baseSize, current, i)) {
+            i += 8;
+        }
+        while (i < size && baseByte(i) == current[i]) {
+            i++;
+        }
+
+        size_t const changedStart = i;
+        //short matches inside a changed run cost more as their own run
+        size_t same = 0;
+        while (i < size && same < 4) {
+            same = baseByte(i) == current[i] ? same + 1 : 0;
+            i++;
+        }
+        //the matching bytes that ended it start the next zero run
+        i -= same;
+
+        putLength(out, changedStart - zerosStart);
+        putLength(out, i - changedStart);
+        for (size_t j = changedStart; j < i; j++) {
+            out.push_back(baseByte(j) ^ current[j]);
+        }
+    }
+}
+
+static void decodeDelta(const uint8_t* base, size_t baseSize, const std::vector<uint8_t> &delta, uint8_t* out, size_t size) {
+    memcpy(out, base, baseSize < size ? baseSize : size);
+    if (size > baseSize) {
+        memset(out + baseSize, 0, size - baseSize);
+    }
+
+    const uint8_t* in = delta.data();
+    const uint8_t* end = in + delta.size();
+    size_t i = 0;
+    while (in < end) {
+        i += getLength(in);
+        size_t const changed = getLength(in);
+        for (size_t j = 0; j < changed && i < size; j++) {
+            out[i++] ^= *in++;
+        }
+    }
+}
+
+static size_t keyframeBytes(const rewindKeyframe &keyframe) {
+    size_t bytes = keyframe.state.size() + sizeof(rewindKeyframe);
+    for (auto const &frame : keyframe.frames) {
+        bytes += frame.delta.size() + REWIND_FRAME_OVERHEAD;
+    }
+
+    return bytes;
+}
+
+RewindBuffer::RewindBuffer(Vm* vm, size_t budgetBytes, int keyframeInterval){
+    _vm = vm;
+    _budgetBytes = budgetBytes;
+    _keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+
+    _bytesUsed = 0;
+    _lastFrameCount = -1;
+    _framesBack = 0;
+
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.budgetBytes = budgetBytes;
+    _totalCaptureUs = 0;
+}
+
+void RewindBuffer::Capture(uint8_t kdown, uint8_t kheld){
+    if (_budgetBytes == 0) {
+        return;
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+
+    //a new cart, or the same one loaded again
+    int const frameCount = _vm->GetFrameCount();
+    if (frameCount != _lastFrameCount + 1) {
+        Clear();
+    }
+    _lastFrameCount = frameCount;
+    _framesBack = 0;
+
+    bool keyframe = _keyframes.empty() || (int)_keyframes.back().frames.size() + 1 >= _keyframeInterval;
+    if (keyframe) {
+        _keyframes.emplace_back();
+        rewindKeyframe &newest = _keyframes.back();
+        if (!_vm->SaveState(newest.state)) {
+            //the bios, nothing to come back to
+            _keyframes.pop_back();
+            return;
+        }
+        newest.stateSize = newest.state.size();
+        _vm->CopyMemoryImage(&newest.image);
+        _bytesUsed += newest.state.size() + sizeof(rewindKeyframe);
+        _stats.keyframes++;
+
+        if (_keyframes.size() > 1) {
+            rewindKeyframe &previous = _keyframes[_keyframes.size() - 2];
+            encodeDelta(newest.state.data(), newest.stateSize, previous.state.data(), previous.stateSize, _stateScratch);
+            _bytesUsed -= previous.state.size();
+            previous.state = std::vector<uint8_t>(_stateScratch.begin(), _stateScratch.end());
+            _bytesUsed += previous.state.size();
+        }
+    }
+    else {
+        rewindKeyframe &newest = _keyframes.back();
+        _vm->CopyMemoryImage(&_scratch);
+
+        newest.frames.emplace_back();
+        rewindFrame &frame = newest.frames.back();
+        frame.kdown = kdown;
+        frame.kheld = kheld;
+        encodeDelta((const uint8_t*)&newest.image, sizeof(vmMemoryImage), (const uint8_t*)&_scratch, sizeof(vmMemoryImage), frame.delta);
+        frame.delta.shrink_to_fit();
+        _bytesUsed += frame.delta.size() + REWIND_FRAME_OVERHEAD;
+    }
+    _stats.frames++;
+
+    trim();
+
+    uint64_t const captureUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    _stats.lastCaptureUs = captureUs;
+    _totalCaptureUs += captureUs;
+    _stats.averageCaptureUs = _totalCaptureUs / _stats.frames;
+    if (keyframe) {
+        if (captureUs > _stats.worstKeyframeUs) {
+            _stats.worstKeyframeUs = captureUs;
+        }
+    }
+    else if (captureUs > _stats.worstCaptureUs) {
+        _stats.worstCaptureUs = captureUs;
+    }
+}
+
+void RewindBuffer::trim(){
+    while (_bytesUsed > _budgetBytes && _keyframes.size() > 1) {
+        _bytesUsed -= keyframeBytes(_keyframes.front());
+        _keyframes.pop_front();
+    }
+}
+
+int RewindBuffer::FramesAvailable(){
+    int frames = 0;
+    for (auto const &keyframe : _keyframes) {
+        frames += 1 + keyframe.frames.size();
+    }
+
+    return frames;
+}
+
+//frame -1 is the keyframe itself
+bool RewindBuffer::findFrame(int framesBack, size_t &keyframe, int &frame){
+    for (size_t i = _keyframes.size(); i-- > 0;) {
+        int const frames = 1 + _keyframes[i].frames.size();
+        if (framesBack < frames) {
+            keyframe = i;
+            frame = frames - 2 - framesBack;
+            return true;
+        }
+        framesBack -= frames;
+    }
+
+    return false;
+}
+
+//the whole state of a keyframe, from the newest one back through the deltas
+void RewindBuffer::unpackState(size_t keyframe, std::vector<uint8_t> &state){
+    state = _keyframes.back().state;
+    for (size_t i = _keyframes.size() - 1; i-- > keyframe;) {
+        _stateScratch.resize(_keyframes[i].stateSize);
+        decodeDelta(state.data(), state.size(), _keyframes[i].state, _stateScratch.data(), _stateScratch.size());
+        state.swap(_stateScratch);
+    }
+}
+
+bool RewindBuffer::StepBack(){
+    size_t keyframe;
+    int frame;
+    if (!findFrame(_framesBack + 1, keyframe, frame)) {
+        return false;
+    }
+    _framesBack++;
+
+    rewindKeyframe &shown = _keyframes[keyframe];
+    if (frame < 0) {
+        _shown = shown.image;
+    }
+    else {
+        decodeDelta((const uint8_t*)&shown.image, sizeof(vmMemoryImage), shown.frames[frame].delta, (uint8_t*)&_shown, sizeof(vmMemoryImage));
+    }
+
+    return true;
+}
+
+uint8_t* RewindBuffer::GetShownFb(){
+    return _shown.picoFb;
+}
+
+uint8_t* RewindBuffer::GetShownScreenPaletteMap(){
+    return _shown.ram._gfxState_screenPaletteMap;
+}
+
+bool RewindBuffer::Resume(){
+    size_t keyframe;
+    int frame;
+    if (_framesBack == 0 || !findFrame(_framesBack, keyframe, frame)) {
+        _framesBack = 0;
+        return false;
+    }
+
+    rewindKeyframe &resumed = _keyframes[keyframe];
+    std::vector<uint8_t> state;
+    unpackState(keyframe, state);
+    if (!_vm->LoadState(state)) {
+        Clear();
+        return false;
+    }
+
+    for (int i = 0; i <= frame; i++) {
+        _vm->UpdateAndDraw(resumed.frames[i].kdown, resumed.frames[i].kheld);
+    }
+
+    //the frames after this one won't happen now
+    while (_keyframes.size() > keyframe + 1) {
+        _bytesUsed -= keyframeBytes(_keyframes.back());
+        _keyframes.pop_back();
+    }
+    //it is the newest now, so it keeps its whole state
+    _bytesUsed -= keyframeBytes(resumed);
+    resumed.state.swap(state);
+    resumed.frames.resize(frame + 1);
+    _bytesUsed += keyframeBytes(resumed);
+
+    _lastFrameCount = _vm->GetFrameCount();
+    _framesBack = 0;
+
+    return true;
+}
+
+void RewindBuffer::Clear(){
+    _keyframes.clear();
+    _bytesUsed = 0;
+    _framesBack = 0;
+}
+
+rewindStats RewindBuffer::GetStats(){
+    rewindStats stats = _stats;
+    stats.bytesUsed = _bytesUsed;
+
+    return stats;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+
+#include "vm.h"
+
+struct rewindStats {
+    size_t bytesUsed;
+    size_t budgetBytes;
+    //captured so far, including ones since dropped
+    uint32_t frames;
+    uint32_t keyframes;
+    uint64_t lastCaptureUs;
+    uint64_t averageCaptureUs;
+    uint64_t worstCaptureUs;
+    //keyframes copy the whole vm, so they are counted on their own
+    uint64_t worstKeyframeUs;
+};
+
+//a frame after a keyframe: what it was given and what it changed
+struct rewindFrame {
+    uint8_t kdown;
+    uint8_t kheld;
+    //the frame's memory image xored with the keyframe's, zero runs packed
+    std::vector<uint8_t> delta;
+};
+
+//a save state and the frames that followed it
+struct rewindKeyframe {
+    //the newest keyframe keeps its whole state. Older ones keep how theirs
+    //differs from the next keyframe's, packed the same way as frames
+    std::vector<uint8_t> state;
+    size_t stateSize;
+    vmMemoryImage image;
+    std::vector<rewindFrame> frames;
+};
+
+//Keeps the last stretch of a running cart so it can be played backwards.
+//Every keyframeInterval frames the whole vm is saved. Frames in between only
+//keep their input and how their memory image differs from the keyframe's, so
+//any of them can be shown straight away, and resuming from one loads the
+//keyframe before it and runs the recorded input forward again.
+//Once a newer keyframe is saved the one before it is packed against it, most
+//of the lua heap is the same from one keyframe to the next. Resuming from an
+//older keyframe unpacks the ones after it back to it.
+//The oldest keyframes are dropped to stay under budgetBytes.
+class RewindBuffer {
+    Vm* _vm;
+    size_t _budgetBytes;
+    int _keyframeInterval;
+
+    std::deque<rewindKeyframe> _keyframes;
+    size_t _bytesUsed;
+    int _lastFrameCount;
+
+    //how many frames back from the newest StepBack has gone
+    int _framesBack;
+    vmMemoryImage _shown;
+
+    rewindStats _stats;
+    uint64_t _totalCaptureUs;
+
+    vmMemoryImage _scratch;
+    std::vector<uint8_t> _stateScratch;
+
+    bool findFrame(int framesBack, size_t &keyframe, int &frame);
+    void unpackState(size_t keyframe, std::vector<uint8_t> &state);
+    void trim();
+
+    public:
+    RewindBuffer(Vm* vm, size_t budgetBytes, int keyframeInterval);
+
+    //records the frame the vm just ran with this input
+    void Capture(uint8_t kdown, uint8_t kheld);
+
+    int FramesAvailable();
+
+    //moves one frame further back, false at the oldest one kept
+    bool StepBack();
+    //the frame StepBack got to, for drawing
+    uint8_t* GetShownFb();
+    uint8_t* GetShownScreenPaletteMap();
+
+    //puts the vm back at the frame StepBack got to and forgets everything
+    //after it
+    bool Resume();
+
+    void Clear();
+
+    rewindStats GetStats();
+};
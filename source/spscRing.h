@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+//Fixed size ring shared by exactly one producer thread and one consumer
+//thread. Neither side ever blocks or allocates: push and pop move as many
+//items as fit and return how many that was. Size must be a power of two.
+template<typename T, size_t Size>
+class SpscRing {
+    static_assert((Size & (Size - 1)) == 0, "ring size must be a power of two");
+
+    T _items[Size];
+    //free running counts, only the owning side writes each of them
+    std::atomic<size_t> _written{0};
+    std::atomic<size_t> _read{0};
+
+    public:
+    //consumer side, or an estimate from the producer
+    size_t Available() const {
+        return _written.load(std::memory_order_acquire) - _read.load(std::memory_order_acquire);
+    }
+
+    size_t Free() const {
+        return Size - Available();
+    }
+
+    //producer side
+    size_t Push(const T* items, size_t count) {
+        size_t const written = _written.load(std::memory_order_relaxed);
+        size_t const read = _read.load(std::memory_order_acquire);
+        if (count > Size - (written - read)) {
+            count = Size - (written - read);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            _items[(written + i) & (Size - 1)] = items[i];
+        }
+
+        _written.store(written + count, std::memory_order_release);
+        return count;
+    }
+
+    bool Push(const T &item) {
+        return Push(&item, 1) == 1;
+    }
+
+    //consumer side
+    size_t Pop(T* items, size_t count) {
+        size_t const read = _read.load(std::memory_order_relaxed);
+        size_t const written = _written.load(std::memory_order_acquire);
+        if (count > written - read) {
+            count = written - read;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            items[i] = _items[(read + i) & (Size - 1)];
+        }
+
+        _read.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+    bool Pop(T &item) {
+        return Pop(&item, 1) == 1;
+    }
+
+    //only safe while neither side is running
+    void Clear() {
+        _read.store(_written.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+};
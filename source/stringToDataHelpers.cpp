@@ -1,44 +1,60 @@
-#include <string>
+#include <string_view>
 
 #include "stringToDataHelpers.h"
 
-void copy_string_to_sprite_memory(uint8_t sprite_data[128 * 64], std::string data) {
-	uint16_t i = 0;
-
-	for (size_t n = 0; n < data.length(); n++) {
-		char buf[3] = {0};
+const uint8_t hex_digit_values[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0, 0, 0, 0,
+	0, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 10, 11, 12, 13, 14, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+void copy_string_to_sprite_memory(uint8_t sprite_data[128 * 64], std::string_view data) {
+	const char* p = data.data();
+	const char* end = p + data.length();
+	size_t i = 0;
+
+	while (p < end && i < 128 * 64) {
+		if ((uint8_t)*p <= ' ') {
+			p++;
+			continue;
+		}
 
 		//https://pico-8.fandom.com/wiki/Memory
 		// "An 8-bit byte represents two pixels, horizontally adjacent, where the most significant 
 		// (leftmost) 4 bits is the right pixel of the pair, and the least significant 4 bits is 
 		// the left pixel.
-		if (data[n] > ' ') {
-			//buf[0] = data[n++];
-			//buf[1] = data[n];
-			buf[1] = data[n++]; //left pixel 
-			buf[0] = data[n];
-			uint8_t val = (uint8_t)strtol(buf, NULL, 16);
-
-			//this was the impl before combining nibbles into a single byte
-			//sprite_data[i++] = val >> 4;
-			//sprite_data[i++] = val & 0x0f;
-			sprite_data[i++] = val;
-		}
+		char right = p + 1 < end ? p[1] : '0';
+		sprite_data[i++] = hex_to_byte(right, p[0]);
+		p += 2;
 	}
 }
 
-void copy_string_to_memory(uint8_t* sprite_flag_data, std::string data) {
-	uint16_t i = 0;
-
-	for (size_t n = 0; n < data.length(); n++) {
-		char buf[3] = {0};
+void copy_string_to_memory(uint8_t* memory, size_t size, std::string_view data) {
+	const char* p = data.data();
+	const char* end = p + data.length();
+	size_t i = 0;
 
-		if (data[n] > ' ') {
-			buf[0] = data[n++];
-			buf[1] = data[n];
-			uint8_t val = (uint8_t)strtol(buf, NULL, 16);
-
-			sprite_flag_data[i++] = val;
+	while (p < end && i < size) {
+		if ((uint8_t)*p <= ' ') {
+			p++;
+			continue;
 		}
+
+		char low = p + 1 < end ? p[1] : '0';
+		memory[i++] = hex_to_byte(p[0], low);
+		p += 2;
 	}
-}
\ No newline at end of file
+}
@@ -1,7 +1,17 @@
 #pragma once
 
-#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <string_view>
 
-void copy_string_to_sprite_memory(uint8_t sprite_data[128 * 64], std::string data);
+//value of each hex digit by character, anything else reads as 0
+extern const uint8_t hex_digit_values[256];
 
-void copy_string_to_memory(uint8_t* sprite_flag_data, std::string data);
\ No newline at end of file
+inline uint8_t hex_to_byte(char high, char low) {
+	return (hex_digit_values[(uint8_t)high] << 4) | hex_digit_values[(uint8_t)low];
+}
+
+//Both skip whitespace between digit pairs and stop once the destination is full.
+void copy_string_to_sprite_memory(uint8_t sprite_data[128 * 64], std::string_view data);
+
+void copy_string_to_memory(uint8_t* memory, size_t size, std::string_view data);
@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include <cmath>     // std::fabs, std::fmod
+
 namespace z8
 {
 
@@ -34,8 +36,75 @@ public:
         INST_PHASER     = 7,
     };
 
+    enum
+    {
+        FX_NO_EFFECT = 0,
+        FX_SLIDE     = 1,
+        FX_VIBRATO   = 2,
+        FX_DROP      = 3,
+        FX_FADE_IN   = 4,
+        FX_FADE_OUT  = 5,
+        FX_ARP_FAST  = 6,
+        FX_ARP_SLOW  = 7,
+    };
+
     static float waveform(int instrument, float advance);
+
+    // Same as above with the instrument known at compile time, so block
+    // renderers can pick the waveform once instead of per sample
+    template <int instrument>
+    static float waveform(float advance);
 };
 
+template <int instrument>
+inline float synth::waveform(float advance)
+{
+    using std::fabs, std::fmod;
+
+    float t = fmod(advance, 1.f);
+    float ret = 0.f;
+
+    // Multipliers were measured from PICO-8 WAV exports. Waveforms are
+    // inferred from those exports by guessing what the original formulas
+    // could be.
+    switch (instrument)
+    {
+        case INST_TRIANGLE:
+            return 0.5f * (fabs(4.f * t - 2.0f) - 1.0f);
+        case INST_TILTED_SAW:
+        {
+            static float const a = 0.9f;
+            ret = t < a ? 2.f * t / a - 1.f
+                        : 2.f * (1.f - t) / (1.f - a) - 1.f;
+            return ret * 0.5f;
+        }
+        case INST_SAW:
+            return 0.653f * (t < 0.5f ? t : t - 1.f);
+        case INST_SQUARE:
+            return t < 0.5f ? 0.25f : -0.25f;
+        case INST_PULSE:
+            return t < 1.f / 3 ? 0.25f : -0.25f;
+        case INST_ORGAN:
+            ret = t < 0.5f ? 3.f - fabs(24.f * t - 6.f)
+                           : 1.f - fabs(16.f * t - 12.f);
+            return ret / 9.f;
+        case INST_NOISE:
+            //noise is generated per channel in Audio.cpp, it has no shape
+            return 0.f;
+        case INST_PHASER:
+        {   // This one has a subfrequency of freq/128 that appears
+            // to modulate two signals using a triangle wave
+            // FIXME: amplitude seems to be affected, too
+            float k = fabs(2.f * fmod(advance / 128.f, 1.f) - 1.f);
+            float u = fmod(t + 0.5f * k, 1.0f);
+            ret = fabs(4.f * u - 2.f) - fabs(8.f * t - 4.f);
+            return ret / 6.f;
+        }
+    }
+
+    return 0.0f;
+}
+
+
 } // namespace z8
 
@@ -0,0 +1,264 @@
+//Offline renderer for a cart's sfx and music. Writes a wav, checks the output
+//against a reference wav, and times the mixer so audio changes can be
+//measured. Not part of the console builds. Carts need lua for the patcher, so
+//build lua's library first (make -C libs/lua-5.3.2/src liblua.a) then from the repo root something like:
+//g++ -std=gnu++17 -O2 -funsigned-char -Isource -Ilibs/lodepng -Ilibs/lua-5.3.2/src source/Audio.cpp source/synth.cpp source/wavetable.cpp source/cart.cpp source/cartPatcher.cpp source/filehelpers.cpp source/pngCartDecoder.cpp source/pxa.cpp source/emojiconversion.cpp source/stringToDataHelpers.cpp source/logger.cpp libs/lodepng/lodepng.cpp source/tests/audio_render.cpp libs/lua-5.3.2/src/liblua.a -o audio_render -lpthread
+//usage: audio_render <cart> sfx|music <n> [-o out.wav] [-r reference.wav] [-t tolerance] [-s max seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "../Audio.h"
+#include "../cart.h"
+
+#define SAMPLE_RATE 22050
+#define RENDER_CHUNK (AUDIO_BLOCK_SIZE * 4)
+
+//same window as the audio tests, small phase differences average out but a
+//wrong note doesn't
+#define COMPARE_WINDOW 512
+
+static void putLe(std::vector<uint8_t> &out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.push_back((value >> (8 * i)) & 0xff);
+    }
+}
+
+static uint32_t getLe(const uint8_t* data, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint32_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+//16 bit mono pcm, both output channels are always the same
+static bool writeWav(std::string path, const std::vector<int16_t> &samples) {
+    std::vector<uint8_t> out;
+    uint32_t dataSize = samples.size() * 2;
+
+    out.insert(out.end(), {'R', 'I', 'F', 'F'});
+    putLe(out, 36 + dataSize, 4);
+    out.insert(out.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    putLe(out, 16, 4);
+    putLe(out, 1, 2);
+    putLe(out, 1, 2);
+    putLe(out, SAMPLE_RATE, 4);
+    putLe(out, SAMPLE_RATE * 2, 4);
+    putLe(out, 2, 2);
+    putLe(out, 16, 2);
+    out.insert(out.end(), {'d', 'a', 't', 'a'});
+    putLe(out, dataSize, 4);
+    for (int16_t sample : samples) {
+        putLe(out, (uint16_t)sample, 2);
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+
+    return written;
+}
+
+static bool readWav(std::string path, std::vector<int16_t> &samples, std::string &error) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        error = "unable to open " + path;
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t read;
+    while ((read = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + read);
+    }
+    fclose(file);
+
+    if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0) {
+        error = path + " is not a wav file";
+        return false;
+    }
+
+    bool formatOk = false;
+    for (size_t pos = 12; pos + 8 <= data.size(); ) {
+        uint32_t chunkSize = getLe(data.data() + pos + 4, 4);
+        const uint8_t* chunk = data.data() + pos + 8;
+        if (pos + 8 + chunkSize > data.size()) {
+            break;
+        }
+
+        if (memcmp(data.data() + pos, "fmt ", 4) == 0 && chunkSize >= 16) {
+            formatOk = getLe(chunk, 2) == 1 && getLe(chunk + 2, 2) == 1 &&
+                getLe(chunk + 4, 4) == SAMPLE_RATE && getLe(chunk + 14, 2) == 16;
+        }
+        else if (memcmp(data.data() + pos, "data", 4) == 0) {
+            if (!formatOk) {
+                error = path + " is not 16 bit mono pcm at 22050hz";
+                return false;
+            }
+            samples.resize(chunkSize / 2);
+            for (size_t i = 0; i < samples.size(); i++) {
+                samples[i] = (int16_t)getLe(chunk + i * 2, 2);
+            }
+            return true;
+        }
+
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    error = path + " has no sample data";
+    return false;
+}
+
+static bool isIdle(const PicoRam* memory) {
+    for (int i = 0; i < 4; i++) {
+        if (memory->_sfxChannels[i].sfxId != -1) {
+            return false;
+        }
+    }
+    return memory->_musicChannel.pattern == -1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        printf("usage: %s <cart> sfx|music <n> [-o out.wav] [-r reference.wav] [-t tolerance] [-s max seconds]\n", argv[0]);
+        return 1;
+    }
+
+    std::string cartPath = argv[1];
+    std::string kind = argv[2];
+    int index = atoi(argv[3]);
+    std::string outPath;
+    std::string referencePath;
+    double tolerance = 16.0;
+    double maxSeconds = 60.0;
+
+    for (int i = 4; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "-o") {
+            outPath = argv[i + 1];
+        }
+        else if (flag == "-r") {
+            referencePath = argv[i + 1];
+        }
+        else if (flag == "-t") {
+            tolerance = atof(argv[i + 1]);
+        }
+        else if (flag == "-s") {
+            maxSeconds = atof(argv[i + 1]);
+        }
+        else {
+            printf("unknown option %s\n", flag.c_str());
+            return 1;
+        }
+    }
+
+    if (kind != "sfx" && kind != "music") {
+        printf("expected sfx or music, got %s\n", kind.c_str());
+        return 1;
+    }
+
+    Cart* cart = new Cart(cartPath);
+    if (cart->LoadError != "") {
+        printf("%s: %s\n", cartPath.c_str(), cart->LoadError.c_str());
+        return 1;
+    }
+
+    PicoRam* memory = new PicoRam();
+    memcpy(memory->sfx, cart->SfxData, sizeof(memory->sfx));
+    memcpy(memory->songs, cart->SongData, sizeof(memory->songs));
+    delete cart;
+
+    //no render thread, every sample is mixed right here
+    Audio* audio = new Audio(memory);
+    if (kind == "sfx") {
+        audio->api_sfx(index, -1, 0);
+    }
+    else {
+        audio->api_music(index, 0, 0);
+    }
+
+    size_t const maxSamples = (size_t)(maxSeconds * SAMPLE_RATE);
+    std::vector<uint32_t> stereo;
+    std::chrono::duration<double> mixTime(0);
+
+    while (stereo.size() < maxSamples) {
+        size_t start = stereo.size();
+        size_t count = std::min((size_t)RENDER_CHUNK, maxSamples - start);
+        stereo.resize(start + count);
+
+        auto before = std::chrono::steady_clock::now();
+        audio->FillAudioBuffer(stereo.data() + start, 0, count);
+        mixTime += std::chrono::steady_clock::now() - before;
+
+        if (isIdle(memory)) {
+            break;
+        }
+    }
+
+    delete audio;
+    delete memory;
+
+    std::vector<int16_t> samples(stereo.size());
+    for (size_t i = 0; i < stereo.size(); i++) {
+        samples[i] = (int16_t)(stereo[i] & 0xffff);
+    }
+
+    double seconds = (double)samples.size() / SAMPLE_RATE;
+    printf("%s %d: %zu samples (%.2fs) mixed in %.2fms, %.0f samples/s, %.0fx real time\n",
+        kind.c_str(), index, samples.size(), seconds, mixTime.count() * 1000.0,
+        samples.size() / mixTime.count(), seconds / mixTime.count());
+
+    if (outPath != "" && !writeWav(outPath, samples)) {
+        printf("unable to write %s\n", outPath.c_str());
+        return 1;
+    }
+
+    if (referencePath == "") {
+        return 0;
+    }
+
+    std::vector<int16_t> reference;
+    std::string error;
+    if (!readWav(referencePath, reference, error)) {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+
+    if (reference.size() != samples.size()) {
+        printf("FAIL: %zu samples, the reference has %zu\n", samples.size(), reference.size());
+        return 1;
+    }
+
+    double worst = 0.0;
+    size_t worstStart = 0;
+    for (size_t start = 0; start < samples.size(); start += COMPARE_WINDOW) {
+        size_t end = std::min(start + COMPARE_WINDOW, samples.size());
+        double error = 0.0;
+        for (size_t i = start; i < end; i++) {
+            double diff = samples[i] - reference[i];
+            error += diff * diff;
+        }
+        error = sqrt(error / (end - start));
+
+        if (error > worst) {
+            worst = error;
+            worstStart = start;
+        }
+    }
+
+    bool matches = worst <= tolerance;
+    printf("%s: worst window at sample %zu is off by %f rms (tolerance %f)\n",
+        matches ? "PASS" : "FAIL", worstStart, worst, tolerance);
+
+    return matches ? 0 : 1;
+}
@@ -0,0 +1,715 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+
+#include "audio_test.h"
+#include "../Audio.h"
+#include "../audioOutput.h"
+#include "../synth.h"
+#include "../wavetable.h"
+#include "../logger.h"
+
+#define REFERENCE_SAMPLE_RATE 22050
+
+//The renderer steps pitch and volume in fixed point, so it drifts a little in
+//phase against the reference over long notes. Samples are compared as the rms
+//error over windows of this many samples.
+#define TOLERANCE_WINDOW 512
+#define RMS_TOLERANCE 16.0
+
+static double referenceKeyToFreq(double key) {
+    return 440.0 * std::exp2((key - 33.0) / 12.0);
+}
+
+//position of an sfx being played by the reference
+struct referenceVoice {
+    float offset = 0.f;
+    int prev_key = 24;
+    double prev_vol = 0.0;
+};
+
+struct referencePoint {
+    double freq;
+    double vol;
+    double table_key;
+};
+
+//straight per sample port of the zepto8 effect code
+static referencePoint referenceNote(const struct sfx &sfx, const referenceVoice &voice, double key_offset) {
+    using z8::synth;
+
+    int const speed = std::max(1, (int)sfx.speed);
+    float const offs_per_second = 22050.f / (183.f * speed);
+    int const note_idx = (int)voice.offset;
+    note const &n = sfx.notes[note_idx];
+    double const t = voice.offset - note_idx;
+    double const volume = n.volume / 7.0;
+
+    referencePoint point;
+    point.table_key = n.key + key_offset;
+    point.freq = referenceKeyToFreq(point.table_key);
+    point.vol = volume;
+
+    switch (n.effect) {
+        case synth::FX_SLIDE:
+        {
+            double prev_freq = referenceKeyToFreq(voice.prev_key + key_offset);
+            point.freq = prev_freq + (point.freq - prev_freq) * t;
+            if (voice.prev_vol > 0.0) {
+                point.vol = voice.prev_vol + (volume - voice.prev_vol) * t;
+            }
+            point.table_key = std::max(point.table_key, voice.prev_key + key_offset);
+            break;
+        }
+        case synth::FX_VIBRATO:
+        {
+            double x = 7.5f * voice.offset / offs_per_second;
+            double lfo = std::fabs(x - std::floor(x) - 0.5) - 0.25;
+            point.freq *= 1.0 + (1.059463094359 - 1.0) * lfo;
+            break;
+        }
+        case synth::FX_DROP:
+            point.freq *= 1.0 - t;
+            break;
+        case synth::FX_FADE_IN:
+            point.vol *= t;
+            break;
+        case synth::FX_FADE_OUT:
+            point.vol *= 1.0 - t;
+            break;
+        case synth::FX_ARP_FAST:
+        case synth::FX_ARP_SLOW:
+        {
+            int m = (speed <= 8 ? 32 : 16) / (n.effect == synth::FX_ARP_FAST ? 4 : 8);
+            int arp = (int)(m * 7.5f * voice.offset / offs_per_second);
+            point.table_key = sfx.notes[(note_idx & ~3) | (arp & 3)].key + key_offset;
+            point.freq = referenceKeyToFreq(point.table_key);
+            break;
+        }
+    }
+
+    return point;
+}
+
+static void referenceAdvance(const struct sfx &sfx, referenceVoice &voice) {
+    int const speed = std::max(1, (int)sfx.speed);
+    //same float expression as the renderer, so notes change on the same sample
+    float const offset_per_sample = 22050.f / (183.f * speed) / REFERENCE_SAMPLE_RATE;
+    float const loop_start = sfx.loopRangeStart;
+    float const loop_range = float(sfx.loopRangeEnd - sfx.loopRangeStart);
+
+    int const note_idx = (int)voice.offset;
+    float next_offset = voice.offset + offset_per_sample;
+    if (loop_range > 0.f && next_offset >= loop_start) {
+        next_offset = std::fmod(next_offset - loop_start, loop_range) + loop_start;
+    }
+    if ((int)next_offset != note_idx && next_offset < 32.f) {
+        voice.prev_key = sfx.notes[note_idx].key;
+        voice.prev_vol = sfx.notes[note_idx].volume / 7.0;
+    }
+    voice.offset = next_offset;
+}
+
+//renders sfxId on its own, using the same wavetables as the renderer
+static std::vector<int16_t> renderReference(const PicoRam* memory, int sfxId, size_t count) {
+    using z8::synth;
+
+    std::vector<int16_t> out(count, 0);
+
+    wavetable_init();
+
+    const struct sfx &sfx = memory->sfx[sfxId];
+    referenceVoice voice;
+    referenceVoice instrument;
+    int instrumentSfx = -1;
+    int instrumentNote = -1;
+    double phase = 0.0;
+    double phaser_phase = 0.0;
+
+    for (size_t i = 0; i < count && voice.offset < 32.f; i++) {
+        int const note_idx = (int)voice.offset;
+        note const &n = sfx.notes[note_idx];
+        referencePoint point = referenceNote(sfx, voice, 0.0);
+        int waveform = n.waveform;
+        bool audible = n.volume != 0;
+
+        if (n.custom) {
+            //restart the instrument on each new note, unless it slides
+            if (instrumentNote != note_idx) {
+                if (instrumentSfx != n.waveform || n.effect != synth::FX_SLIDE) {
+                    instrumentSfx = n.waveform;
+                    instrument = referenceVoice();
+                }
+                instrumentNote = note_idx;
+            }
+
+            if (instrument.offset < 32.f) {
+                const struct sfx &inner = memory->sfx[instrumentSfx];
+                note const &innerNote = inner.notes[(int)instrument.offset];
+                referencePoint innerPoint = referenceNote(inner, instrument, n.key - 24.0);
+
+                point.freq = innerPoint.freq * point.freq / referenceKeyToFreq(n.key);
+                point.vol *= innerPoint.vol;
+                point.table_key = innerPoint.table_key + (point.table_key - n.key);
+                waveform = innerNote.waveform;
+                audible &= innerNote.volume != 0;
+            }
+            else {
+                audible = false;
+            }
+        }
+        else {
+            instrumentSfx = -1;
+            instrumentNote = -1;
+        }
+
+        if (audible) {
+            const int16_t* table = wavetable_get(waveform, point.table_key);
+            uint32_t fixedPhase = (uint32_t)(int64_t)((phase - std::floor(phase)) * 4294967296.0);
+            uint32_t fixedPhaser = (uint32_t)(int64_t)((phaser_phase - std::floor(phaser_phase)) * 4294967296.0);
+            int32_t value = waveform == synth::INST_PHASER ?
+                wavetable_phaser(table, fixedPhase, fixedPhaser) :
+                wavetable_sample(table, fixedPhase);
+
+            out[i] = (int16_t)((value * (int32_t)(point.vol * 32768.0)) >> 15) >> 3;
+
+            phase += point.freq / REFERENCE_SAMPLE_RATE;
+            phaser_phase += point.freq / REFERENCE_SAMPLE_RATE / 128.0;
+        }
+
+        referenceAdvance(sfx, voice);
+        if (n.custom && instrument.offset < 32.f) {
+            referenceAdvance(memory->sfx[instrumentSfx], instrument);
+        }
+    }
+
+    return out;
+}
+
+//plays sfxId through Audio and checks it against the reference
+static bool verifyAgainstReference(PicoRam* memory, int sfxId, std::string testName) {
+    //about two seconds, enough for every note at low speeds and several
+    //trips around the loop
+    size_t const count = 44100;
+    std::vector<int16_t> expected = renderReference(memory, sfxId, count);
+
+    Audio* audio = new Audio(memory);
+    audio->api_sfx(sfxId, 0, 0);
+
+    //odd sized buffers so notes and effect breakpoints straddle blocks
+    std::vector<uint32_t> rendered(count);
+    size_t done = 0;
+    while (done < count) {
+        size_t size = std::min(count - done, (size_t)(1 + rand() % 700));
+        audio->FillAudioBuffer(rendered.data() + done, 0, size);
+        done += size;
+    }
+
+    //a wrong pitch, volume or note change shows up as a large error over a
+    //whole window, where the tiny phase drift doesn't
+    bool valid = true;
+    for (size_t start = 0; start < count; start += TOLERANCE_WINDOW) {
+        size_t end = std::min(start + TOLERANCE_WINDOW, count);
+        double error = 0.0;
+        for (size_t i = start; i < end; i++) {
+            double diff = (int16_t)(rendered[i] & 0xffff) - expected[i];
+            error += diff * diff;
+        }
+        error = std::sqrt(error / (end - start));
+
+        if (error > RMS_TOLERANCE) {
+            Logger::Write("%s: samples %d to %d are off by %f rms\n", testName.c_str(), (int)start, (int)end, error);
+            valid = false;
+            break;
+        }
+    }
+
+    delete audio;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+//random notes with no noise, the reference doesn't model the noise generator
+static void fillRandomNotes(struct sfx &sfx, int effect) {
+    int waveforms[] = {0, 1, 2, 3, 4, 5, 7};
+
+    for (int i = 0; i < 32; i++) {
+        sfx.notes[i].key = rand() % 64;
+        sfx.notes[i].waveform = waveforms[rand() % 7];
+        sfx.notes[i].volume = 1 + rand() % 7;
+        sfx.notes[i].effect = effect < 0 ? rand() % 8 : effect;
+        sfx.notes[i].custom = 0;
+    }
+}
+
+bool verifySfxEffect(int effect, int speed, bool looping, std::string testName) {
+    PicoRam* memory = new PicoRam();
+    memset(memory->sfx, 0, sizeof(memory->sfx));
+    memset(memory->songs, 0, sizeof(memory->songs));
+
+    //fixed seed so failures can be reproduced
+    srand(effect * 1000 + speed);
+
+    struct sfx &sfx = memory->sfx[0];
+    sfx.speed = speed;
+    if (looping) {
+        sfx.loopRangeStart = 8;
+        sfx.loopRangeEnd = 12;
+    }
+    fillRandomNotes(sfx, effect);
+
+    bool valid = verifyAgainstReference(memory, 0, testName);
+
+    delete memory;
+
+    return valid;
+}
+
+bool verifyCustomInstruments(int effect, int speed, std::string testName) {
+    PicoRam* memory = new PicoRam();
+    memset(memory->sfx, 0, sizeof(memory->sfx));
+    memset(memory->songs, 0, sizeof(memory->songs));
+
+    srand(effect * 1000 + speed + 500);
+
+    //instruments use every effect, and some of them sustain with a loop
+    for (int i = 0; i < 8; i++) {
+        struct sfx &instrument = memory->sfx[i];
+        instrument.speed = 1 + rand() % 8;
+        if (i & 1) {
+            instrument.loopRangeStart = rand() % 4;
+            instrument.loopRangeEnd = instrument.loopRangeStart + 1 + rand() % 4;
+        }
+        fillRandomNotes(instrument, -1);
+        for (int n = 0; n < 32; n++) {
+            //keep instruments close to c-2 so transposed notes stay in range
+            instrument.notes[n].key = 18 + rand() % 12;
+        }
+    }
+
+    struct sfx &sfx = memory->sfx[8];
+    sfx.speed = speed;
+    fillRandomNotes(sfx, effect);
+    for (int n = 0; n < 32; n++) {
+        //mostly custom notes, with a few plain ones in between
+        sfx.notes[n].custom = rand() % 4 != 0;
+        sfx.notes[n].key = 12 + rand() % 40;
+    }
+
+    bool valid = verifyAgainstReference(memory, 8, testName);
+
+    delete memory;
+
+    return valid;
+}
+
+bool verifyAudioThread(std::string testName) {
+    PicoRam* memory = new PicoRam();
+    memset(memory->sfx, 0, sizeof(memory->sfx));
+    memset(memory->songs, 0, sizeof(memory->songs));
+
+    srand(36);
+    memory->sfx[0].speed = 4;
+    fillRandomNotes(memory->sfx[0], -1);
+
+    size_t const count = 8192;
+
+    //calls queued before the thread starts land on its very first block
+    Audio* direct = new Audio(memory);
+    direct->api_sfx(0, 0, 0);
+    std::vector<uint32_t> expected(count);
+    direct->FillAudioBuffer(expected.data(), 0, count);
+    delete direct;
+
+    Audio* threaded = new Audio(memory);
+    threaded->api_sfx(0, 0, 0);
+    threaded->StartThread();
+
+    //read in frame sized pieces, waiting for the ring like a host would
+    std::vector<uint32_t> rendered(count);
+    size_t done = 0;
+    while (done < count) {
+        size_t size = std::min(count - done, (size_t)735);
+        while (threaded->GetStats().bufferedSamples < size) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        threaded->ReadAudioBuffer(rendered.data() + done, size);
+        done += size;
+    }
+
+    audioStats stats = threaded->GetStats();
+    threaded->StopThread();
+    delete threaded;
+
+    bool valid = rendered == expected && stats.underruns == 0 && stats.droppedCommands == 0;
+    if (!valid) {
+        Logger::Write("%s: %u underruns, %u dropped commands\n", testName.c_str(), stats.underruns, stats.droppedCommands);
+    }
+
+    delete memory;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+//two patterns of random notes, the first of them ending the song
+static PicoRam* newMusicMemory(int speed) {
+    PicoRam* memory = new PicoRam();
+    memset(memory->sfx, 0, sizeof(memory->sfx));
+    memset(memory->songs, 0, sizeof(memory->songs));
+
+    srand(39 + speed);
+    for (int i = 0; i < 4; i++) {
+        memory->sfx[i].speed = std::min(255, speed + i);
+        fillRandomNotes(memory->sfx[i], z8::synth::FX_NO_EFFECT);
+    }
+
+    song &pattern = memory->songs[0];
+    pattern.sfx0 = 0;
+    pattern.sfx1 = 1;
+    pattern.sfx2 = 2;
+    pattern.sfx3 = 3;
+    pattern.stop = 1;
+
+    return memory;
+}
+
+bool verifyMusicTiming(int speed, std::string testName) {
+    PicoRam* memory = newMusicMemory(speed);
+
+    //the pattern lasts until its fastest sfx takes the step reaching note 32
+    float const step = 22050.f / (183.f * speed) / REFERENCE_SAMPLE_RATE;
+    float offset = 0.f;
+    size_t length = 0;
+    while (offset < 32.f) {
+        offset += step;
+        length++;
+    }
+
+    Audio* audio = new Audio(memory);
+    audio->api_music(0, 0, 0);
+
+    std::vector<uint32_t> buffer(length);
+    audio->FillAudioBuffer(buffer.data(), 0, length - 1);
+    bool valid = memory->_musicChannel.pattern == 0;
+    audio->FillAudioBuffer(buffer.data(), 0, 1);
+    valid &= memory->_musicChannel.pattern == -1;
+
+    delete audio;
+    delete memory;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyMusicFade(std::string testName) {
+    PicoRam* memory = newMusicMemory(20);
+
+    size_t const count = 22050 * 2;
+    std::vector<uint32_t> plain(count);
+    std::vector<uint32_t> faded(count);
+
+    Audio* audio = new Audio(memory);
+    audio->api_music(0, 0, 0);
+    audio->FillAudioBuffer(plain.data(), 0, count);
+    delete audio;
+
+    //one second in, then out over half a second starting at 1.25s
+    size_t const fadeOutStart = 27563;
+    audio = new Audio(memory);
+    audio->api_music(0, 1000, 0);
+    audio->FillAudioBuffer(faded.data(), 0, fadeOutStart);
+    audio->api_music(-1, 500, 0);
+    audio->FillAudioBuffer(faded.data() + fadeOutStart, 0, count - fadeOutStart);
+    delete audio;
+
+    bool valid = true;
+    for (size_t start = 0; start < count && valid; start += TOLERANCE_WINDOW) {
+        size_t end = std::min(start + TOLERANCE_WINDOW, count);
+        double error = 0.0;
+        for (size_t i = start; i < end; i++) {
+            double volume = std::min(1.0, i / 22050.0);
+            if (i >= fadeOutStart) {
+                volume = std::max(0.0, 1.0 - (i - fadeOutStart) / 11025.0);
+            }
+            double diff = (int16_t)(faded[i] & 0xffff) - (int16_t)(plain[i] & 0xffff) * volume;
+            error += diff * diff;
+        }
+        error = std::sqrt(error / (end - start));
+
+        if (error > RMS_TOLERANCE) {
+            Logger::Write("%s: samples %d to %d are off by %f rms\n", testName.c_str(), (int)start, (int)end, error);
+            valid = false;
+        }
+    }
+
+    //the fade out stops the song once it reaches silence
+    valid &= memory->_musicChannel.pattern == -1;
+
+    delete memory;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyNoiseRepeats(std::string testName) {
+    PicoRam* memory = new PicoRam();
+    memset(memory->sfx, 0, sizeof(memory->sfx));
+    memset(memory->songs, 0, sizeof(memory->songs));
+
+    srand(37);
+    memory->sfx[0].speed = 8;
+    fillRandomNotes(memory->sfx[0], -1);
+    for (int i = 0; i < 32; i++) {
+        memory->sfx[0].notes[i].waveform = z8::synth::INST_NOISE;
+    }
+
+    size_t const count = 4096;
+    std::vector<uint32_t> first(count);
+    std::vector<uint32_t> second(count);
+
+    //the second time channel 1 has already used up some noise, restarting
+    //the sfx on channel 2 has to pick up from the same seed as before
+    Audio* audio = new Audio(memory);
+    audio->api_sfx(0, 2, 0);
+    audio->FillAudioBuffer(first.data(), 0, count);
+    delete audio;
+
+    audio = new Audio(memory);
+    audio->api_sfx(0, 1, 0);
+    audio->FillAudioBuffer(second.data(), 0, count);
+    audio->api_sfx(0, 2, 0);
+    audio->FillAudioBuffer(second.data(), 0, count);
+    delete audio;
+
+    bool audible = false;
+    for (size_t i = 0; i < count; i++) {
+        audible |= first[i] != 0;
+    }
+
+    bool valid = audible && first == second;
+
+    delete memory;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+//Stands in for a host's audio device. Plays its queued buffers in order at
+//its own rate as simulated time passes and keeps everything it played.
+struct headlessAudioDevice {
+    int rate;
+    std::vector<std::vector<uint32_t>> buffers;
+    std::vector<size_t> sizes;
+    std::deque<int> queue;
+    size_t frontPlayed = 0;
+
+    double elapsedMs = 0.0;
+    uint64_t samplesDue = 0;
+    std::vector<uint32_t> played;
+    size_t starvedSamples = 0;
+
+    headlessAudioDevice(int sampleRate, int bufferCount, size_t maxSamples)
+        : rate(sampleRate), buffers(bufferCount, std::vector<uint32_t>(maxSamples)), sizes(bufferCount, 0) { }
+
+    int freeBuffer() {
+        for (int i = 0; i < (int)buffers.size(); i++) {
+            if (std::find(queue.begin(), queue.end(), i) == queue.end()) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void play(double ms) {
+        elapsedMs += ms;
+        uint64_t const due = (uint64_t)(elapsedMs * rate / 1000.0);
+        size_t count = due - samplesDue;
+        samplesDue = due;
+
+        while (count > 0 && !queue.empty()) {
+            int const buffer = queue.front();
+            size_t const take = std::min(count, sizes[buffer] - frontPlayed);
+            played.insert(played.end(), buffers[buffer].begin() + frontPlayed, buffers[buffer].begin() + frontPlayed + take);
+            frontPlayed += take;
+            count -= take;
+
+            if (frontPlayed == sizes[buffer]) {
+                queue.pop_front();
+                frontPlayed = 0;
+            }
+        }
+        starvedSamples += count;
+    }
+};
+
+//runs a few seconds of music through AudioOutput into a headless device at
+//a jittery frame rate. The device should never run dry, and should play
+//exactly the music rendered in one go, resampled if it isn't at 22050hz
+//stalls once a second for four seconds, then runs calmSeconds more without
+static void runAudioOutput(int fps, int deviceRate, double stallMs, int calmSeconds, audioOutputStats &stats, std::vector<uint32_t> &played, size_t &starved) {
+    int const bufferCount = 4;
+    size_t const maxSamples = deviceRate / 10;
+
+    PicoRam* memory = newMusicMemory(20);
+    Audio* audio = new Audio(memory);
+    audio->api_music(0, 0, 0);
+
+    headlessAudioDevice device(deviceRate, bufferCount, maxSamples);
+    AudioOutput output(deviceRate, bufferCount, maxSamples, [audio](uint32_t* samples, size_t count) {
+        audio->FillAudioBuffer(samples, 0, count);
+    });
+
+    srand(40 + fps);
+    double intervalMs = 0.0;
+    for (int frame = 0; frame < fps * (4 + calmSeconds); frame++) {
+        output.Service(intervalMs, (int)device.queue.size());
+
+        int buffer;
+        while ((buffer = device.freeBuffer()) != -1) {
+            size_t const samples = output.NextBufferSize();
+            output.Fill(device.buffers[buffer].data(), samples);
+            device.sizes[buffer] = samples;
+            device.queue.push_back(buffer);
+        }
+
+        //frames land anywhere within 20% of the target, with an occasional stall
+        intervalMs = 1000.0 / fps * (0.8 + 0.4 * rand() / RAND_MAX);
+        if (stallMs > 0 && frame < fps * 4 && frame % fps == fps / 2) {
+            intervalMs = stallMs;
+        }
+        device.play(intervalMs);
+    }
+
+    stats = output.GetStats();
+    played = device.played;
+    starved = device.starvedSamples;
+
+    delete audio;
+    delete memory;
+}
+
+bool verifyAudioOutput(int fps, int deviceRate, std::string testName) {
+    audioOutputStats stats;
+    std::vector<uint32_t> played;
+    size_t starved;
+    runAudioOutput(fps, deviceRate, 0.0, 0, stats, played, starved);
+
+    PicoRam* memory = newMusicMemory(20);
+    Audio* audio = new Audio(memory);
+    audio->api_music(0, 0, 0);
+    std::vector<uint32_t> reference(played.size() * SAMPLES_PER_SECOND / deviceRate + 2);
+    audio->FillAudioBuffer(reference.data(), 0, reference.size());
+    delete audio;
+    delete memory;
+
+    bool valid = starved == 0 && stats.underruns == 0 && played.size() > 0;
+
+    uint32_t const step = (uint32_t)(((uint64_t)SAMPLES_PER_SECOND << 16) / deviceRate);
+    for (size_t i = 0; valid && i < played.size(); i++) {
+        //the resampler starts out between two silent samples before the music
+        uint64_t const position = (uint64_t)i * step;
+        int64_t const index = (int64_t)(position >> 16) - 2;
+        double const frac = (position & 0xffff) / 65536.0;
+        double const a = index >= 0 ? (int16_t)(reference[index] & 0xffff) : 0;
+        double const b = index + 1 >= 0 ? (int16_t)(reference[index + 1] & 0xffff) : 0;
+        double const expected = step == 1 << 16 ? (int16_t)(reference[i] & 0xffff) : a + (b - a) * frac;
+
+        if (std::fabs((int16_t)(played[i] & 0xffff) - expected) > 2.0) {
+            Logger::Write("%s: sample %d is %d, expected %f\n", testName.c_str(), (int)i, (int16_t)(played[i] & 0xffff), expected);
+            valid = false;
+        }
+    }
+
+    if (starved > 0 || stats.underruns > 0) {
+        Logger::Write("%s: %d underruns, %d samples of silence\n", testName.c_str(), (int)stats.underruns, (int)starved);
+    }
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyAudioOutputAdapts(std::string testName) {
+    audioOutputStats at30;
+    audioOutputStats at60;
+    audioOutputStats stalling;
+    audioOutputStats recovered;
+    audioOutputStats loading;
+    std::vector<uint32_t> played;
+    size_t starved;
+
+    runAudioOutput(30, 48000, 0.0, 0, at30, played, starved);
+    runAudioOutput(60, 48000, 0.0, 0, at60, played, starved);
+
+    //a stall every second glitches until the buffers have grown to cover it
+    runAudioOutput(60, 48000, 70.0, 0, stalling, played, starved);
+    //and they go back to normal once the stalls stop
+    runAudioOutput(60, 48000, 70.0, 40, recovered, played, starved);
+    //stalls past AUDIO_OUTPUT_MAX_INTERVAL_MS glitch without growing anything
+    runAudioOutput(60, 48000, 500.0, 0, loading, played, starved);
+
+    bool valid = at60.bufferSamples < at30.bufferSamples && at60.latencyMs < at30.latencyMs;
+    valid &= stalling.bufferSamples > at60.bufferSamples && stalling.underruns <= 2;
+    valid &= stalling.headroom > at60.headroom;
+    valid &= recovered.headroom == at60.headroom && recovered.bufferSamples <= at60.bufferSamples + AUDIO_OUTPUT_GRANULARITY;
+    valid &= loading.underruns > 0 && loading.headroom == at60.headroom;
+
+    if (!valid) {
+        Logger::Write("%s: buffers of %d at 30fps, %d at 60fps, %d with stalls (%d underruns), %d after them, headroom %.2f with long stalls\n", testName.c_str(),
+            (int)at30.bufferSamples, (int)at60.bufferSamples, (int)stalling.bufferSamples, (int)stalling.underruns,
+            (int)recovered.bufferSamples, loading.headroom);
+    }
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runAudioTests() {
+    const char* effectNames[] = {
+        "None", "Slide", "Vibrato", "Drop", "Fade In", "Fade Out", "Arpeggio Fast", "Arpeggio Slow"
+    };
+
+    bool valid = true;
+    for (int effect = 0; effect < 8; effect++) {
+        std::string name = std::string("Sfx Effect ") + effectNames[effect];
+        valid &= verifySfxEffect(effect, 1, false, name + " Speed 1");
+        valid &= verifySfxEffect(effect, 8, false, name + " Speed 8");
+        valid &= verifySfxEffect(effect, 16, false, name + " Speed 16");
+        valid &= verifySfxEffect(effect, 5, true, name + " Looping");
+        valid &= verifyCustomInstruments(effect, 12, name + " Custom Instruments");
+    }
+
+    valid &= verifyMusicTiming(1, "Music Pattern Length Speed 1");
+    valid &= verifyMusicTiming(13, "Music Pattern Length Speed 13");
+    valid &= verifyMusicTiming(255, "Music Pattern Length Speed 255");
+    valid &= verifyMusicFade("Music Fade In And Out");
+    valid &= verifyNoiseRepeats("Noise Repeats Exactly");
+    valid &= verifyAudioThread("Audio Render Thread");
+    valid &= verifyAudioOutput(30, 22050, "Audio Output 30fps");
+    valid &= verifyAudioOutput(60, 22050, "Audio Output 60fps");
+    valid &= verifyAudioOutput(30, 48000, "Audio Output Resampled 30fps");
+    valid &= verifyAudioOutput(60, 48000, "Audio Output Resampled 60fps");
+    valid &= verifyAudioOutputAdapts("Audio Output Buffer Sizing");
+
+    return valid;
+}
+
+#endif
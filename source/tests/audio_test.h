@@ -0,0 +1,42 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+//renders one sfx whose notes all use the given effect, and compares it sample
+//by sample against a reference that evaluates the effect formulas per sample
+bool verifySfxEffect(int effect, int speed, bool looping, std::string testName);
+
+//plays an sfx of custom instrument notes using the given effect over
+//instruments that use every effect
+bool verifyCustomInstruments(int effect, int speed, std::string testName);
+
+//the music moves on, here stopping, on exactly the sample its fastest sfx
+//finishes the pattern
+bool verifyMusicTiming(int speed, std::string testName);
+
+//fades the music in and out and compares it to the same music at full volume
+//scaled by the expected fade
+bool verifyMusicFade(std::string testName);
+
+//noise comes from a generator on each channel that restarts with the sfx,
+//so the same noise sfx always renders the same samples
+bool verifyNoiseRepeats(std::string testName);
+
+//plays the same sfx through the render thread and straight through
+//FillAudioBuffer, which should give identical samples
+bool verifyAudioThread(std::string testName);
+
+//feeds music through AudioOutput into a simulated device at a jittery frame
+//rate, which should play every sample once without running dry
+bool verifyAudioOutput(int fps, int deviceRate, std::string testName);
+
+//buffers shrink at higher frame rates and grow after stalls
+bool verifyAudioOutputAdapts(std::string testName);
+
+bool runAudioTests();
+
+#endif
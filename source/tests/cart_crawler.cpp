@@ -0,0 +1,380 @@
+//Runs every cart in a directory headlessly for a number of frames and reports
+//how each one got on: load time, update and draw cost per frame, the first lua
+//error, which unimplemented api functions it called and a hash of its last
+//frame. Carts run in parallel, each on its own vm. Not part of the console
+//builds. Build lua's library first (make -C libs/lua-5.3.2/src liblua.a) then
+//from the repo root something like:
+//g++ -std=gnu++17 -O2 -funsigned-char -Isource -Ilibs/lodepng -Ilibs/utf8-util -Ilibs/lua-5.3.2/src $(ls source/*.cpp | grep -v main.cpp) libs/lodepng/lodepng.cpp source/tests/cart_crawler.cpp libs/lua-5.3.2/src/liblua.a -o cart_crawler -lpthread
+//usage: cart_crawler <cart dir> [-f frames] [-j jobs] [-i none|random|script file] [-s seed] [-o out.csv|out.json]
+//A script has one "frame buttons" pair per line, buttons are any of lrudox
+//(or - for none) and stay held until the next line.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "../vm.h"
+#include "../host.h"
+#include "../frameHash.h"
+#include "../hostVmShared.h"
+
+//framePresenter.cpp is linked in with the rest of the vm but nothing is ever
+//drawn here
+void Host::drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors) { }
+hostThread* Host::startPresenterThread(void (*entry)(void*), void* arg) { return nullptr; }
+void Host::joinPresenterThread(hostThread* thread) { }
+
+struct crawlerOptions {
+    int frames;
+    int jobs;
+    //none, random or script
+    std::string inputMode;
+    std::string scriptPath;
+    uint32_t seed;
+    std::string outPath;
+};
+
+struct scriptedInput {
+    int frame;
+    uint8_t buttons;
+};
+
+struct crawlResult {
+    std::string path;
+    bool loaded;
+    double loadMs;
+    int frames;
+    uint64_t totalUpdateUs;
+    uint32_t worstUpdateUs;
+    uint64_t totalDrawUs;
+    uint32_t worstDrawUs;
+    std::string error;
+    std::map<std::string, uint32_t> unimplemented;
+    uint64_t finalHash;
+};
+
+static bool isCart(std::string name) {
+    auto endsWith = [&name](const char* suffix) {
+        size_t length = strlen(suffix);
+        return name.length() >= length && name.compare(name.length() - length, length, suffix) == 0;
+    };
+
+    return endsWith(".p8") || endsWith(".png");
+}
+
+static bool loadScript(std::string path, std::vector<scriptedInput> &script) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        int frame;
+        char buttons[64];
+        if (line[0] == '#' || sscanf(line, "%d %63s", &frame, buttons) != 2) {
+            continue;
+        }
+
+        scriptedInput input = {frame, 0};
+        for (char* c = buttons; *c; c++) {
+            switch (*c) {
+                case 'l': input.buttons |= P8_KEY_LEFT; break;
+                case 'r': input.buttons |= P8_KEY_RIGHT; break;
+                case 'u': input.buttons |= P8_KEY_UP; break;
+                case 'd': input.buttons |= P8_KEY_DOWN; break;
+                case 'o': input.buttons |= P8_KEY_O; break;
+                case 'x': input.buttons |= P8_KEY_X; break;
+            }
+        }
+        script.push_back(input);
+    }
+    fclose(file);
+
+    std::stable_sort(script.begin(), script.end(), [](const scriptedInput &a, const scriptedInput &b) {
+        return a.frame < b.frame;
+    });
+
+    return true;
+}
+
+//xorshift, so every cart sees the same presses for a given seed whichever
+//worker runs it
+static uint32_t nextRandom(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+static crawlResult crawlCart(std::string path, const crawlerOptions &options, const std::vector<scriptedInput> &script) {
+    crawlResult result = {};
+    result.path = path;
+
+    Vm* vm = new Vm();
+    vm->SetRngSeed(options.seed);
+
+    auto const loadStart = std::chrono::steady_clock::now();
+    result.loaded = vm->LoadCart(path);
+    result.loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+
+    if (!result.loaded) {
+        result.error = vm->GetLastError();
+    }
+
+    uint32_t random = options.seed ? options.seed : 1;
+    size_t scriptIndex = 0;
+    uint8_t held = 0;
+    for (int frame = 0; result.loaded && frame < options.frames; frame++) {
+        uint8_t nextHeld = 0;
+        if (options.inputMode == "random") {
+            //a few frames per press so carts that wait for btnp see them,
+            //pause would only open the menu
+            if (frame % 4 == 0) {
+                nextHeld = nextRandom(random) & (P8_KEY_LEFT | P8_KEY_RIGHT | P8_KEY_UP | P8_KEY_DOWN | P8_KEY_O | P8_KEY_X);
+            }
+            else {
+                nextHeld = held;
+            }
+        }
+        else if (options.inputMode == "script") {
+            nextHeld = held;
+            while (scriptIndex < script.size() && script[scriptIndex].frame <= frame) {
+                nextHeld = script[scriptIndex++].buttons;
+            }
+        }
+
+        uint8_t const down = nextHeld & ~held;
+        held = nextHeld;
+
+        vm->UpdateAndDraw(down, held);
+
+        //an error swaps the bios in, nothing after it is the cart's
+        if (vm->GetLastError() != "") {
+            result.error = vm->GetLastError();
+            break;
+        }
+
+        uint32_t updateUs, drawUs;
+        vm->GetLastFrameCost(updateUs, drawUs);
+        result.frames++;
+        result.totalUpdateUs += updateUs;
+        result.worstUpdateUs = std::max(result.worstUpdateUs, updateUs);
+        result.totalDrawUs += drawUs;
+        result.worstDrawUs = std::max(result.worstDrawUs, drawUs);
+        result.finalHash = hashFrame(vm->GetPicoInteralFb(), vm->GetScreenPaletteMap(), vm->GetPaletteColors());
+    }
+
+    result.unimplemented = vm->GetUnimplementedCalls();
+
+    delete vm;
+
+    return result;
+}
+
+static std::string escaped(std::string text, bool json) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"') {
+            out += json ? "\\\"" : "\"\"";
+        }
+        else if (c == '\\' && json) {
+            out += "\\\\";
+        }
+        else if (c == '\n' || c == '\r' || c == '\t') {
+            out += ' ';
+        }
+        else if ((unsigned char)c >= 0x20) {
+            out += c;
+        }
+    }
+
+    return out;
+}
+
+static void writeResults(FILE* out, const std::vector<crawlResult> &results, bool json) {
+    if (json) {
+        fprintf(out, "[\n");
+    }
+    else {
+        fprintf(out, "path,loaded,load_ms,frames,update_avg_us,update_max_us,draw_avg_us,draw_max_us,error,unimplemented,final_hash\n");
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const crawlResult &result = results[i];
+        uint64_t const updateAvg = result.frames ? result.totalUpdateUs / result.frames : 0;
+        uint64_t const drawAvg = result.frames ? result.totalDrawUs / result.frames : 0;
+
+        std::string unimplemented;
+        for (auto const &call : result.unimplemented) {
+            if (json) {
+                unimplemented += (unimplemented == "" ? "" : ", ") + std::string("\"") + call.first + "\": " + std::to_string(call.second);
+            }
+            else {
+                unimplemented += (unimplemented == "" ? "" : ";") + call.first + ":" + std::to_string(call.second);
+            }
+        }
+
+        if (json) {
+            fprintf(out, "  {\"path\": \"%s\", \"loaded\": %s, \"load_ms\": %.2f, \"frames\": %d, "
+                "\"update_avg_us\": %llu, \"update_max_us\": %u, \"draw_avg_us\": %llu, \"draw_max_us\": %u, "
+                "\"error\": \"%s\", \"unimplemented\": {%s}, \"final_hash\": \"%016llx\"}%s\n",
+                escaped(result.path, true).c_str(), result.loaded ? "true" : "false", result.loadMs, result.frames,
+                (unsigned long long)updateAvg, result.worstUpdateUs, (unsigned long long)drawAvg, result.worstDrawUs,
+                escaped(result.error, true).c_str(), unimplemented.c_str(), (unsigned long long)result.finalHash,
+                i + 1 < results.size() ? "," : "");
+        }
+        else {
+            fprintf(out, "\"%s\",%d,%.2f,%d,%llu,%u,%llu,%u,\"%s\",\"%s\",%016llx\n",
+                escaped(result.path, false).c_str(), result.loaded ? 1 : 0, result.loadMs, result.frames,
+                (unsigned long long)updateAvg, result.worstUpdateUs, (unsigned long long)drawAvg, result.worstDrawUs,
+                escaped(result.error, false).c_str(), unimplemented.c_str(), (unsigned long long)result.finalHash);
+        }
+    }
+
+    if (json) {
+        fprintf(out, "]\n");
+    }
+}
+
+static void usage(const char* name) {
+    printf("usage: %s <cart dir> [-f frames] [-j jobs] [-i none|random|script file] [-s seed] [-o out.csv|out.json]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string dirPath = argv[1];
+    crawlerOptions options = {300, (int)std::thread::hardware_concurrency(), "none", "", 1, ""};
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        bool const hasValue = i + 1 < argc;
+        if (arg == "-f" && hasValue) {
+            options.frames = atoi(argv[++i]);
+        }
+        else if (arg == "-j" && hasValue) {
+            options.jobs = atoi(argv[++i]);
+        }
+        else if (arg == "-s" && hasValue) {
+            options.seed = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-o" && hasValue) {
+            options.outPath = argv[++i];
+        }
+        else if (arg == "-i" && hasValue) {
+            options.inputMode = argv[++i];
+            if (options.inputMode == "script") {
+                if (i + 1 >= argc) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                options.scriptPath = argv[++i];
+            }
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.jobs < 1) {
+        options.jobs = 1;
+    }
+
+    if (options.inputMode != "none" && options.inputMode != "random" && options.inputMode != "script") {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<scriptedInput> script;
+    if (options.inputMode == "script" && !loadScript(options.scriptPath, script)) {
+        printf("unable to open %s\n", options.scriptPath.c_str());
+        return 1;
+    }
+
+    std::vector<std::string> carts;
+    DIR* dir = opendir(dirPath.c_str());
+    if (!dir) {
+        printf("unable to open %s\n", dirPath.c_str());
+        return 1;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        std::string name = ent->d_name;
+        if (isCart(name)) {
+            carts.push_back(dirPath + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(carts.begin(), carts.end());
+
+    if (carts.empty()) {
+        printf("no carts found in %s\n", dirPath.c_str());
+        return 1;
+    }
+
+    //workers take the next cart until there are none left, results keep the
+    //sorted order so runs can be diffed
+    std::vector<crawlResult> results(carts.size());
+    std::atomic<size_t> nextCart(0);
+    std::atomic<size_t> finished(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = nextCart++) < carts.size()) {
+            results[i] = crawlCart(carts[i], options, script);
+            fprintf(stderr, "[%zu/%zu] %s %s\n", ++finished, carts.size(), carts[i].c_str(),
+                results[i].error == "" ? "ok" : results[i].error.c_str());
+        }
+    };
+
+    auto const start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::min(options.jobs, (int)carts.size()); i++) {
+        workers.push_back(std::thread(worker));
+    }
+    for (auto &thread : workers) {
+        thread.join();
+    }
+    double const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FILE* out = stdout;
+    if (options.outPath != "") {
+        out = fopen(options.outPath.c_str(), "w");
+        if (!out) {
+            printf("unable to write %s\n", options.outPath.c_str());
+            return 1;
+        }
+    }
+
+    bool const json = options.outPath.length() >= 5 && options.outPath.compare(options.outPath.length() - 5, 5, ".json") == 0;
+    writeResults(out, results, json);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    int failed = 0;
+    for (auto const &result : results) {
+        if (result.error != "") {
+            failed++;
+        }
+    }
+    fprintf(stderr, "%zu carts, %d with errors, %.2fs on %d jobs\n", carts.size(), failed, elapsed, options.jobs);
+
+    return 0;
+}
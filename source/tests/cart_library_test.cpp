@@ -0,0 +1,233 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <utime.h>
+#include <unistd.h>
+
+#include "cart_library_test.h"
+#include "../cartLibrary.h"
+
+#define CART_LIBRARY_TEST_DIR "cart_library_test"
+#define CART_LIBRARY_TEST_MTIME 1600000000
+
+//the two titles are the same length, so swapping one for the other leaves
+//the size alone
+static const char* alphaCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+-- alpha
+-- by tester
+function _draw() cls(1) end
+__label__
+0123456789abcdef0123456789abcdef
+fedcba9876543210fedcba9876543210
+)";
+
+static const char* omegaCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+-- omega
+-- by tester
+function _draw() cls(1) end
+__label__
+0123456789abcdef0123456789abcdef
+fedcba9876543210fedcba9876543210
+)";
+
+static const char* betaCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+-- beta
+function _draw() cls(2) end
+)";
+
+static const char* longerBetaCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+-- beta two
+function _draw() cls(2) end
+)";
+
+static const char* gammaCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+-- gamma
+function _draw() cls(3) end
+)";
+
+static std::string cartPath(std::string name) {
+    return std::string(CART_LIBRARY_TEST_DIR) + "/" + name;
+}
+
+//refreshes only look at mtimes, so tests pin them instead of waiting for
+//the clock to tick over
+static bool writeCart(std::string name, const char* text, time_t mtime) {
+    struct utimbuf times;
+    times.actime = mtime;
+    times.modtime = mtime;
+
+    return writeTestCart(cartPath(name), text) && utime(cartPath(name).c_str(), &times) == 0;
+}
+
+static void clearCartDirectory() {
+    remove(cartPath("alpha.p8").c_str());
+    remove(cartPath("beta.p8").c_str());
+    remove(cartPath("gamma.p8").c_str());
+    remove(cartPath(".fake08-cartindex").c_str());
+    rmdir(CART_LIBRARY_TEST_DIR);
+}
+
+static bool setUpCartDirectory() {
+    clearCartDirectory();
+    mkdir(CART_LIBRARY_TEST_DIR, 0777);
+
+    return writeCart("alpha.p8", alphaCartText, CART_LIBRARY_TEST_MTIME) &&
+        writeCart("beta.p8", betaCartText, CART_LIBRARY_TEST_MTIME);
+}
+
+//a fresh library for each refresh, so everything it knows came from the index
+static std::vector<CartIndexEntry> refresh(std::vector<uint8_t>* alphaLabel = nullptr) {
+    CartLibrary library(CART_LIBRARY_TEST_DIR);
+    library.Refresh();
+
+    std::vector<CartIndexEntry> entries;
+    for (size_t i = 0; i < library.GetCartCount(); i++) {
+        entries.push_back(*library.GetEntry(i));
+
+        const uint8_t* label = library.GetLabel(i);
+        if (alphaLabel && label && entries.back().Path == cartPath("alpha.p8")) {
+            alphaLabel->assign(label, label + 128 * 64);
+        }
+    }
+
+    return entries;
+}
+
+static const CartIndexEntry* findEntry(std::vector<CartIndexEntry> const &entries, std::string name) {
+    for (auto const &entry : entries) {
+        if (entry.Path == cartPath(name)) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+bool verifyNewCartsAreIndexed(std::string testName) {
+    bool valid = setUpCartDirectory();
+
+    std::vector<uint8_t> label;
+    std::vector<CartIndexEntry> entries = refresh(&label);
+    const CartIndexEntry* alpha = findEntry(entries, "alpha.p8");
+    const CartIndexEntry* beta = findEntry(entries, "beta.p8");
+
+    valid &= entries.size() == 2 && alpha && beta;
+    valid &= alpha && alpha->Title == "alpha" && alpha->Author == "tester" && alpha->HasLabel;
+    valid &= beta && beta->Title == "beta" && beta->Author == "" && !beta->HasLabel;
+    //two pixels to a byte with the left one low, lines run on from each other
+    valid &= label.size() == 128 * 64 && label[0] == 0x10 && label[7] == 0xfe && label[16] == 0xef;
+
+    clearCartDirectory();
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyUnchangedCartsAreReused(std::string testName) {
+    bool valid = setUpCartDirectory();
+
+    std::vector<uint8_t> before;
+    refresh(&before);
+
+    //same size and mtime, so the old title has to come from the index. the
+    //new cart makes the refresh write a new index, streaming the label over
+    valid &= writeCart("alpha.p8", omegaCartText, CART_LIBRARY_TEST_MTIME);
+    valid &= writeCart("gamma.p8", gammaCartText, CART_LIBRARY_TEST_MTIME);
+
+    std::vector<uint8_t> after;
+    std::vector<CartIndexEntry> entries = refresh(&after);
+    const CartIndexEntry* alpha = findEntry(entries, "alpha.p8");
+    const CartIndexEntry* gamma = findEntry(entries, "gamma.p8");
+
+    valid &= entries.size() == 3;
+    valid &= alpha && alpha->Title == "alpha" && alpha->HasLabel;
+    valid &= gamma && gamma->Title == "gamma";
+    valid &= before.size() == 128 * 64 && after == before;
+
+    clearCartDirectory();
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyChangedCartsAreReparsed(std::string testName) {
+    bool valid = setUpCartDirectory();
+
+    std::vector<CartIndexEntry> first = refresh();
+
+    //alpha keeps its size but is newer, beta keeps its mtime but grew
+    valid &= writeCart("alpha.p8", omegaCartText, CART_LIBRARY_TEST_MTIME + 60);
+    valid &= writeCart("beta.p8", longerBetaCartText, CART_LIBRARY_TEST_MTIME);
+
+    std::vector<CartIndexEntry> entries = refresh();
+    const CartIndexEntry* alpha = findEntry(entries, "alpha.p8");
+    const CartIndexEntry* beta = findEntry(entries, "beta.p8");
+    const CartIndexEntry* firstAlpha = findEntry(first, "alpha.p8");
+
+    valid &= entries.size() == 2;
+    valid &= alpha && alpha->Title == "omega" && alpha->Mtime == CART_LIBRARY_TEST_MTIME + 60 && alpha->HasLabel;
+    valid &= alpha && firstAlpha && alpha->Hash != firstAlpha->Hash;
+    valid &= beta && beta->Title == "beta two" && beta->Size == strlen(longerBetaCartText);
+
+    clearCartDirectory();
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyDeletedCartsAreDropped(std::string testName) {
+    bool valid = setUpCartDirectory();
+
+    valid &= refresh().size() == 2;
+
+    remove(cartPath("alpha.p8").c_str());
+
+    std::vector<uint8_t> label;
+    std::vector<CartIndexEntry> entries = refresh(&label);
+
+    valid &= entries.size() == 1;
+    valid &= findEntry(entries, "alpha.p8") == nullptr;
+    valid &= findEntry(entries, "beta.p8") && findEntry(entries, "beta.p8")->Title == "beta";
+    valid &= label.empty();
+
+    //and stays dropped once the index is up to date
+    valid &= refresh().size() == 1;
+
+    clearCartDirectory();
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runCartLibraryTests() {
+    bool valid = true;
+
+    valid &= verifyNewCartsAreIndexed("Cart Library Indexes New Carts");
+    valid &= verifyUnchangedCartsAreReused("Cart Library Reuses Unchanged Carts");
+    valid &= verifyChangedCartsAreReparsed("Cart Library Reparses Changed Carts");
+    valid &= verifyDeletedCartsAreDropped("Cart Library Drops Deleted Carts");
+
+    return valid;
+}
+
+#endif
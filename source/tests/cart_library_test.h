@@ -0,0 +1,24 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+//a refresh with new carts in the directory parses them, labels included
+bool verifyNewCartsAreIndexed(std::string testName);
+
+//carts whose mtime and size didn't change keep what the old index had for
+//them, label included, even when the index is rewritten for another cart
+bool verifyUnchangedCartsAreReused(std::string testName);
+
+//a cart is parsed again when only its mtime changed, or only its size
+bool verifyChangedCartsAreReparsed(std::string testName);
+
+//carts no longer in the directory are dropped from the index
+bool verifyDeletedCartsAreDropped(std::string testName);
+
+bool runCartLibraryTests();
+
+#endif
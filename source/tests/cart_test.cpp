@@ -4,8 +4,13 @@
 #if _TEST
 
 #include <string>
+#include <cstring>
+#include <cstdio>
 
 #include "cart_test.h"
+#include "../stringToDataHelpers.h"
+
+#define TEST_CART_FILENAME "cart_test.p8"
 
 
 
@@ -120,7 +125,25 @@ bool verifyFullCartText(std::string cartText){
 bool verifyCart(Cart* cart){
     bool valid = true;
     valid &= verifyLuaText(cart->LuaString);
-    valid &= verifySpriteSheetText(cart->SpriteSheetString);
+    valid &= verifySpriteSheetData(cart->SpriteSheetData);
+    return valid;
+}
+
+bool verifyP8CartParse(){
+    FILE* file = fopen(TEST_CART_FILENAME, "wb");
+    if (!file) {
+        printTestOuput("P8 Cart Parse", false);
+        return false;
+    }
+    fputs(full_cart_text, file);
+    fclose(file);
+
+    Cart* cart = new Cart(TEST_CART_FILENAME);
+    bool valid = verifyCart(cart);
+    delete cart;
+
+    remove(TEST_CART_FILENAME);
+
     return valid;
 }
 
@@ -206,7 +229,6 @@ function _update()
     r1y0 = r1dy + r1y0
     r1y1 = r1dy + r1y1
 end
-
 )";
 
 bool verifyLuaText(std::string luaText){
@@ -231,8 +253,14 @@ const char* expected_spritesheet_text = R"(e000000000000000000000000770077000077
 00000000000000666600000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000
 )";
 
-bool verifySpriteSheetText(std::string spritesheet) {
-    return assertStringsEqual(expected_spritesheet_text, spritesheet, "Spritesheet Text");
+bool verifySpriteSheetData(const uint8_t* spritesheet) {
+    uint8_t expected[128 * 64] = {0};
+    copy_string_to_sprite_memory(expected, expected_spritesheet_text);
+
+    bool valid = memcmp(expected, spritesheet, sizeof(expected)) == 0;
+    printTestOuput("Spritesheet Data", valid);
+
+    return valid;
 }
 
 #endif
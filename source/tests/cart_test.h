@@ -8,10 +8,15 @@
 
 #include "../cart.h"
 
+extern const char* full_cart_text;
+extern const char* expected_lua_text;
+
 bool verifyFullCartText(std::string cartText);
 
 bool verifyCart(Cart* cart);
+//writes full_cart_text out as a .p8 and loads it back
+bool verifyP8CartParse();
 bool verifyLuaText(std::string luaText);
-bool verifySpriteSheetText(std::string spritesheet);
+bool verifySpriteSheetData(const uint8_t* spritesheet);
 
 #endif
@@ -0,0 +1,80 @@
+//Runs the frame pacer on Linux against CLOCK_MONOTONIC, sleeping with
+//clock_nanosleep on absolute deadlines, and prints how close frames landed.
+//Not part of the console builds, build from the repo root with something like:
+//g++ -std=gnu++17 -O2 -Isource source/framePacer.cpp source/tests/frame_pacer_bench.cpp -o frame_pacer_bench
+//usage: frame_pacer_bench [fps] [seconds] [spin us] [work ms]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../framePacer.h"
+
+static uint64_t linuxNow() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void linuxSleepUntil(uint64_t us) {
+    timespec deadline;
+    deadline.tv_sec = us / 1000000;
+    deadline.tv_nsec = (us % 1000000) * 1000;
+
+    //restarts after signals, the deadline doesn't move
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) != 0) { }
+}
+
+//stands in for a frame's update and draw
+static void busyFor(uint64_t us) {
+    uint64_t const end = linuxNow() + us;
+    while (linuxNow() < end) { }
+}
+
+int main(int argc, char* argv[]) {
+    int fps = argc > 1 ? atoi(argv[1]) : 60;
+    double seconds = argc > 2 ? atof(argv[2]) : 5.0;
+    uint64_t spinUs = argc > 3 ? atoi(argv[3]) : 1000;
+    double workMs = argc > 4 ? atof(argv[4]) : 5.0;
+
+    if (fps <= 0) {
+        printf("usage: %s [fps] [seconds] [spin us] [work ms]\n", argv[0]);
+        return 1;
+    }
+
+    pacerClock clock = {linuxNow, linuxSleepUntil, spinUs};
+    FramePacer pacer(clock);
+    pacer.SetTargetFps(fps);
+
+    int const frames = (int)(seconds * fps);
+    uint64_t const targetUs = 1000000 / fps;
+    uint64_t worstErrorUs = 0;
+
+    pacer.Wait();
+    uint64_t const start = linuxNow();
+    for (int frame = 1; frame <= frames; frame++) {
+        busyFor((uint64_t)(workMs * 1000));
+        pacer.Wait();
+
+        uint64_t const frameUs = pacer.GetStats().lastFrameUs;
+        uint64_t const errorUs = frameUs > targetUs ? frameUs - targetUs : targetUs - frameUs;
+        if (errorUs > worstErrorUs) {
+            worstErrorUs = errorUs;
+        }
+    }
+    double const elapsed = (linuxNow() - start) / 1000000.0;
+
+    framePacerStats stats = pacer.GetStats();
+    printf("%d frames at %dfps in %.4fs (expected %.4fs), spin %dus\n",
+        frames, fps, elapsed, (double)frames / fps, (int)spinUs);
+    printf("average %dus, worst %dus, worst error %dus, %u missed deadlines, %u resyncs\n",
+        (int)stats.averageFrameUs, (int)stats.worstFrameUs, (int)worstErrorUs, stats.missedDeadlines, stats.resyncs);
+
+    for (int i = 0; i < PACER_HISTOGRAM_BUCKETS; i++) {
+        if (stats.histogram[i] > 0) {
+            printf("%2d%sms: %u\n", i, i == PACER_HISTOGRAM_BUCKETS - 1 ? "+" : " ", stats.histogram[i]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "frame_pacer_test.h"
+#include "../framePacer.h"
+#include "../logger.h"
+
+//simulated time. Every look at the clock takes a few microseconds, so
+//spinning on it moves time forward
+static uint64_t fakeNowUs;
+static uint64_t fakeOversleepUs;
+
+#define FAKE_CLOCK_READ_US 5
+
+static uint64_t fakeNow() {
+    fakeNowUs += FAKE_CLOCK_READ_US;
+    return fakeNowUs;
+}
+
+static void fakeSleepUntil(uint64_t us) {
+    if (us + fakeOversleepUs > fakeNowUs) {
+        fakeNowUs = us + fakeOversleepUs;
+    }
+}
+
+static FramePacer* newFakePacer(int fps, uint64_t spinUs, uint64_t oversleepUs) {
+    fakeNowUs = 1000000;
+    fakeOversleepUs = oversleepUs;
+
+    pacerClock clock = {fakeNow, fakeSleepUntil, spinUs};
+    FramePacer* pacer = new FramePacer(clock);
+    pacer->SetTargetFps(fps);
+
+    return pacer;
+}
+
+bool verifyPacerSchedule(int fps, uint64_t spinUs, uint64_t oversleepUs, std::string testName) {
+    FramePacer* pacer = newFakePacer(fps, spinUs, oversleepUs);
+    uint64_t const frameUs = 1000000 / fps;
+
+    srand(41 + fps);
+    pacer->Wait();
+    uint64_t const start = fakeNowUs;
+
+    int const frames = fps * 10;
+    //late by whatever the sleep overshot, plus a few clock reads
+    uint64_t const allowedUs = (oversleepUs > spinUs ? oversleepUs : 0) + 4 * FAKE_CLOCK_READ_US;
+
+    bool valid = true;
+    for (int frame = 1; frame <= frames; frame++) {
+        //a frame's work takes 20 to 80 percent of its time
+        fakeNowUs += frameUs / 5 + rand() % (frameUs * 3 / 5);
+        pacer->Wait();
+
+        uint64_t const deadline = start + (uint64_t)frame * 1000000 / fps;
+        if (fakeNowUs < deadline || fakeNowUs > deadline + allowedUs) {
+            Logger::Write("%s: frame %d started at %d, deadline %d\n", testName.c_str(), frame, (int)(fakeNowUs - start), (int)(deadline - start));
+            valid = false;
+            break;
+        }
+    }
+
+    framePacerStats stats = pacer->GetStats();
+    valid &= stats.frames == (uint32_t)frames && stats.missedDeadlines == 0 && stats.resyncs == 0;
+    valid &= stats.histogram[frameUs / PACER_BUCKET_US] > 0;
+
+    delete pacer;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyPacerResync(std::string testName) {
+    FramePacer* pacer = newFakePacer(60, 1000, 300);
+    uint64_t const frameUs = 1000000 / 60;
+
+    pacer->Wait();
+    for (int frame = 0; frame < 60; frame++) {
+        fakeNowUs += frameUs / 2;
+        pacer->Wait();
+    }
+
+    //a cart load
+    fakeNowUs += 500000;
+    pacer->Wait();
+    uint64_t const resumed = fakeNowUs;
+
+    framePacerStats stats = pacer->GetStats();
+    bool valid = stats.missedDeadlines == 1 && stats.resyncs == 1 && stats.worstFrameUs >= 500000;
+
+    //the next frame gets its full length instead of being rushed
+    fakeNowUs += frameUs / 2;
+    pacer->Wait();
+    valid &= fakeNowUs >= resumed + frameUs && fakeNowUs < resumed + frameUs + 100;
+    valid &= pacer->GetStats().histogram[PACER_HISTOGRAM_BUCKETS - 1] == 1;
+
+    delete pacer;
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runFramePacerTests() {
+    bool valid = true;
+
+    valid &= verifyPacerSchedule(30, 1000, 0, "Frame Pacer 30fps");
+    valid &= verifyPacerSchedule(60, 1000, 0, "Frame Pacer 60fps");
+    valid &= verifyPacerSchedule(60, 1000, 700, "Frame Pacer Spins Out Late Wakeups");
+    valid &= verifyPacerSchedule(60, 0, 700, "Frame Pacer Late Wakeups Don't Drift");
+    valid &= verifyPacerResync("Frame Pacer Resyncs After Stall");
+
+    return valid;
+}
+
+#endif
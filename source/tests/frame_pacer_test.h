@@ -0,0 +1,20 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+//paces frames of random length against a simulated clock whose sleeps wake
+//oversleepUs late. Every frame should start on its deadline, give or take
+//the oversleep when it is more than the pacer spins for, without drifting
+bool verifyPacerSchedule(int fps, uint64_t spinUs, uint64_t oversleepUs, std::string testName);
+
+//a long stall is one missed deadline, then pacing starts over from there
+//instead of running frames back to back to catch up
+bool verifyPacerResync(std::string testName);
+
+bool runFramePacerTests();
+
+#endif
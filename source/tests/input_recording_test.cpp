@@ -0,0 +1,175 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "input_recording_test.h"
+#include "../vm.h"
+#include "../inputRecording.h"
+#include "../frameHash.h"
+#include "../logger.h"
+
+#define RECORDING_TEST_FRAMES 200
+
+//steered with the buttons past rnd() rocks. The rocks are table keys, so
+//the order they are drawn in depends on how lua hashes them
+static const char* steeringCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+px = 64
+rocks = {}
+score = 0
+function _update()
+	if btn(0) then px -= 2 end
+	if btn(1) then px += 2 end
+	if btnp(5) then score += 10 end
+	if rnd(1) < 0.2 then rocks[{x = rnd(128), y = 0}] = true end
+	for r in pairs(rocks) do
+		r.y += 2
+		if r.y > 128 then rocks[r] = nil score += 1 end
+	end
+end
+function _draw()
+	cls(1)
+	local i = 0
+	for r in pairs(rocks) do
+		i += 1
+		circfill(r.x, r.y, 2, 4 + i % 12)
+	end
+	rectfill(px - 4, 120, px + 4, 124, 12)
+	print(score, 2, 2, 7)
+end
+)";
+
+//same cart, but the rocks fall a little faster
+static const char* changedCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+px = 64
+rocks = {}
+score = 0
+function _update()
+	if btn(0) then px -= 2 end
+	if btn(1) then px += 2 end
+	if btnp(5) then score += 10 end
+	if rnd(1) < 0.2 then rocks[{x = rnd(128), y = 0}] = true end
+	for r in pairs(rocks) do
+		r.y += 3
+		if r.y > 128 then rocks[r] = nil score += 1 end
+	end
+end
+function _draw()
+	cls(1)
+	local i = 0
+	for r in pairs(rocks) do
+		i += 1
+		circfill(r.x, r.y, 2, 4 + i % 12)
+	end
+	rectfill(px - 4, 120, px + 4, 124, 12)
+	print(score, 2, 2, 7)
+end
+)";
+
+static uint8_t testButtons(int frame) {
+    uint8_t buttons = (frame / 20) % 2 == 0 ? 1 : 2;
+    if (frame % 13 == 0) {
+        buttons |= 32;
+    }
+    return buttons;
+}
+
+//runs a session the way main does and returns what it drew
+static std::vector<uint64_t> recordSession(std::string recordingFile) {
+    std::vector<uint64_t> hashes;
+
+    Vm* vm = new Vm();
+    vm->SetRngSeed(48);
+    InputRecorder recorder(vm, recordingFile);
+
+    vm->LoadCart("recording_test_cart.p8");
+    //as if the last frame run had loaded it
+    recorder.Capture(0, 0);
+
+    uint8_t lastHeld = 0;
+    for (int i = 0; i < RECORDING_TEST_FRAMES; i++) {
+        uint8_t const held = testButtons(i);
+        uint8_t const down = held & ~lastHeld;
+        lastHeld = held;
+
+        vm->UpdateAndDraw(down, held);
+        recorder.Capture(down, held);
+        hashes.push_back(hashFrame(vm->GetPicoInteralFb(), vm->GetScreenPaletteMap(), vm->GetPaletteColors()));
+    }
+    recorder.Stop();
+
+    delete vm;
+
+    return hashes;
+}
+
+bool verifyRecordingReplays(std::string testName) {
+    bool valid = writeTestCart("recording_test_cart.p8", steeringCartText);
+
+    std::vector<uint64_t> recorded = recordSession("recording_test.f8input");
+
+    InputRecording recording;
+    valid &= recording.Load("recording_test.f8input");
+    valid &= recording.FrameCount() == RECORDING_TEST_FRAMES;
+    valid &= recording.RngSeed == 48;
+
+    std::vector<uint64_t> trace;
+    Vm* vm = new Vm();
+    replayResult result = replayRecording(vm, recording, 0, &trace);
+    delete vm;
+
+    valid &= result.error == "";
+    valid &= result.frames == RECORDING_TEST_FRAMES;
+    valid &= result.firstMismatch == -1;
+    valid &= trace == recorded;
+
+    remove("recording_test_cart.p8");
+    remove("recording_test.f8input");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyReplayFindsDivergence(std::string testName) {
+    bool valid = writeTestCart("recording_test_cart.p8", steeringCartText);
+
+    recordSession("recording_test.f8input");
+
+    valid &= writeTestCart("recording_test_cart.p8", changedCartText);
+
+    InputRecording recording;
+    valid &= recording.Load("recording_test.f8input");
+
+    Vm* vm = new Vm();
+    replayResult result = replayRecording(vm, recording, 0, nullptr);
+    delete vm;
+
+    //the first kept hash is already different
+    valid &= result.firstMismatch == RECORDING_HASH_INTERVAL - 1;
+
+    remove("recording_test_cart.p8");
+    remove("recording_test.f8input");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runInputRecordingTests() {
+    bool valid = true;
+
+    valid &= verifyRecordingReplays("Recording Replays");
+    valid &= verifyReplayFindsDivergence("Replay Finds Divergence");
+
+    return valid;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+//a recorded session saved to a file and replayed on a new vm draws the same
+//frame hashes it drew while recording
+bool verifyRecordingReplays(std::string testName);
+
+//replaying on a cart that changed since is caught at the first kept hash
+//that doesn't match
+bool verifyReplayFindsDivergence(std::string testName);
+
+bool runInputRecordingTests();
+
+#endif
@@ -0,0 +1,80 @@
+//Throughput benchmark for the utf8 <-> p8scii conversion over a directory of
+//.p8 carts. Not part of the console builds, build from the repo root with something like:
+//g++ -std=gnu++17 -O2 -Isource source/emojiconversion.cpp source/filehelpers.cpp source/tests/p8scii_bench.cpp -o p8scii_bench
+//usage: p8scii_bench <cart dir> [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "../emojiconversion.h"
+#include "../filehelpers.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("usage: %s <cart dir> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::string dirPath = argv[1];
+    int iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+    std::vector<std::string> corpus;
+    DIR* dir = opendir(dirPath.c_str());
+    if (!dir) {
+        printf("unable to open %s\n", dirPath.c_str());
+        return 1;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        std::string name = ent->d_name;
+        if (name.length() < 3 || name.compare(name.length() - 3, 3, ".p8") != 0) {
+            continue;
+        }
+
+        corpus.push_back(get_file_contents(dirPath + "/" + name));
+    }
+    closedir(dir);
+
+    if (corpus.empty()) {
+        printf("no .p8 carts found in %s\n", dirPath.c_str());
+        return 1;
+    }
+
+    std::vector<std::string> converted(corpus.size());
+    size_t utf8Bytes = 0;
+    size_t p8sciiBytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (size_t c = 0; c < corpus.size(); c++) {
+            converted[c].clear();
+            convert_emojis(corpus[c], converted[c]);
+            utf8Bytes += corpus[c].length();
+        }
+    }
+    auto mid = std::chrono::steady_clock::now();
+
+    std::string back;
+    for (int i = 0; i < iterations; i++) {
+        for (auto& text : converted) {
+            back.clear();
+            p8scii_to_utf8(text, back);
+            p8sciiBytes += text.length();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double toP8scii = std::chrono::duration<double>(mid - start).count();
+    double toUtf8 = std::chrono::duration<double>(end - mid).count();
+    printf("%d carts, %d iterations\n", (int)corpus.size(), iterations);
+    printf("utf8 -> p8scii %.2f MB/s\n", utf8Bytes / toP8scii / (1024 * 1024));
+    printf("p8scii -> utf8 %.2f MB/s\n", p8sciiBytes / toUtf8 / (1024 * 1024));
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+//Throughput benchmark for the code decompressors over a directory of .p8.png
+//carts. Not part of the console builds, build from the repo root with something like:
+//g++ -std=gnu++17 -O2 -Isource -Ilibs/lodepng source/pxa.cpp source/pngCartDecoder.cpp source/logger.cpp libs/lodepng/lodepng.cpp source/tests/pxa_bench.cpp -o pxa_bench
+//usage: pxa_bench <cart dir> [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "../pngCartDecoder.h"
+#include "../pxa.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("usage: %s <cart dir> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::string dirPath = argv[1];
+    int iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+    std::vector<std::vector<uint8_t>> corpus;
+    DIR* dir = opendir(dirPath.c_str());
+    if (!dir) {
+        printf("unable to open %s\n", dirPath.c_str());
+        return 1;
+    }
+
+    struct dirent* ent;
+    static uint8_t cartData[PNG_CART_DATA_SIZE];
+    while ((ent = readdir(dir)) != nullptr) {
+        std::string name = ent->d_name;
+        if (name.length() < 4 || name.compare(name.length() - 4, 4, ".png") != 0) {
+            continue;
+        }
+
+        std::string error;
+        if (!decodePngCart(dirPath + "/" + name, cartData, nullptr, error)) {
+            continue;
+        }
+
+        const uint8_t* code = cartData + 0x4300;
+        if (pxa_is_compressed(code, 0x3d00) || legacy_is_compressed(code, 0x3d00)) {
+            corpus.push_back(std::vector<uint8_t>(code, code + 0x3d00));
+        }
+    }
+    closedir(dir);
+
+    if (corpus.empty()) {
+        printf("no compressed png carts found in %s\n", dirPath.c_str());
+        return 1;
+    }
+
+    std::string out;
+    size_t inBytes = 0;
+    size_t outBytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (auto& code : corpus) {
+            if (pxa_is_compressed(code.data(), code.size())) {
+                pxa_decompress(code.data(), code.size(), out);
+                inBytes += code[6] * 256 + code[7];
+            }
+            else {
+                legacy_decompress(code.data(), code.size(), out);
+                inBytes += code.size();
+            }
+            outBytes += out.size();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%d carts, %d iterations: %.3f s\n", (int)corpus.size(), iterations, seconds);
+    printf("input %.2f MB/s, output %.2f MB/s\n",
+        inBytes / seconds / (1024 * 1024), outBytes / seconds / (1024 * 1024));
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+//libFuzzer target for the code decompressors. Not part of the console builds,
+//build from the repo root with something like:
+//clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address -Ilibs/lodepng source/pxa.cpp source/tests/pxa_fuzz.cpp -o pxa_fuzz
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "../pxa.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    std::string out;
+
+    //let the fuzzer reach both decoders past the magic bytes
+    if (size >= PXA_HEADER_SIZE && (data[0] & 1)) {
+        uint8_t buf[0x3d00] = {0, 'p', 'x', 'a'};
+        size_t len = size < sizeof(buf) ? size : sizeof(buf);
+        for (size_t i = 4; i < len; i++) {
+            buf[i] = data[i];
+        }
+        pxa_decompress(buf, len, out);
+    }
+    else if (size >= PXA_HEADER_SIZE) {
+        uint8_t buf[0x3d00] = {':', 'c', ':', 0};
+        size_t len = size < sizeof(buf) ? size : sizeof(buf);
+        for (size_t i = 4; i < len; i++) {
+            buf[i] = data[i];
+        }
+        legacy_decompress(buf, len, out);
+    }
+
+    size_t declared = size >= 6 ? data[4] * 256 + data[5] : 0;
+    if (out.size() > declared) {
+        __builtin_trap();
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+#include "lodepng.h"
+
+#include "pxa_test.h"
+#include "cart_test.h"
+#include "../pxa.h"
+#include "../pngCartDecoder.h"
+#include "../cart.h"
+#include "../cartPatcher.h"
+
+#define GENERATED_CART_FILENAME "pxa_test.p8.png"
+
+bool verifyPxaRoundTrip(std::string text, std::string testName) {
+    bool valid = true;
+
+    for (int effort = 0; effort <= 9; effort++) {
+        std::vector<uint8_t> compressed;
+        std::string decompressed;
+
+        valid &= pxa_compress(text, compressed, effort) &&
+            pxa_decompress(compressed.data(), compressed.size(), decompressed) &&
+            decompressed == text;
+    }
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyLegacyRoundTrip(std::string text, std::string testName) {
+    bool valid = true;
+
+    for (int effort = 0; effort <= 9; effort++) {
+        std::vector<uint8_t> compressed;
+        std::string decompressed;
+
+        valid &= legacy_compress(text, compressed, effort) &&
+            legacy_decompress(compressed.data(), compressed.size(), decompressed) &&
+            decompressed == text;
+    }
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+//hides each cart byte in the low 2 bits of a pixel, the same way pico 8 does
+static bool writePngCart(const uint8_t* cartData, std::string filename) {
+    std::vector<unsigned char> image(PNG_CART_WIDTH * PNG_CART_HEIGHT * 4);
+
+    for (size_t i = 0; i < PNG_CART_DATA_SIZE; i++) {
+        unsigned char* px = &image[i * 4];
+        uint8_t byte = cartData[i];
+        px[0] = 0xfc | ((byte >> 4) & 3);
+        px[1] = 0xfc | ((byte >> 2) & 3);
+        px[2] = 0xfc | (byte & 3);
+        px[3] = 0xfc | ((byte >> 6) & 3);
+    }
+
+    return lodepng::encode(filename, image, PNG_CART_WIDTH, PNG_CART_HEIGHT) == 0;
+}
+
+bool verifyGeneratedPngCart(std::string text, bool legacy, std::string testName) {
+    std::vector<uint8_t> compressed;
+    bool valid = legacy ? legacy_compress(text, compressed) : pxa_compress(text, compressed);
+    valid &= compressed.size() <= sizeof(Cart::CartLuaData);
+
+    uint8_t cartData[PNG_CART_DATA_SIZE] = {0};
+    if (valid) {
+        //something recognisable in the sprite sheet to check the other sections survive
+        for (int i = 0; i < 0x2000; i++) {
+            cartData[i] = (uint8_t)(i * 7);
+        }
+        memcpy(&cartData[0x4300], compressed.data(), compressed.size());
+        cartData[0x8000] = 18;
+
+        valid = writePngCart(cartData, GENERATED_CART_FILENAME);
+    }
+
+    if (valid) {
+        Cart* cart = new Cart(GENERATED_CART_FILENAME);
+
+        std::string code;
+        bool decompressed = legacy ?
+            legacy_decompress(cart->CartLuaData, sizeof(cart->CartLuaData), code) :
+            pxa_decompress(cart->CartLuaData, sizeof(cart->CartLuaData), code);
+
+        valid = cart->LoadError == "" &&
+            memcmp(cart->SpriteSheetData, cartData, sizeof(cart->SpriteSheetData)) == 0 &&
+            memcmp(cart->CartLuaData, compressed.data(), compressed.size()) == 0 &&
+            decompressed && code == text &&
+            cart->LuaString == getPatchedLua(text);
+
+        delete cart;
+        remove(GENERATED_CART_FILENAME);
+    }
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runPxaTests() {
+    std::string lua = expected_lua_text;
+
+    //every byte value pxa can store, in an order that defeats back references
+    std::string bytes;
+    for (int i = 1; i < 256; i++) {
+        bytes += (char)(i * 97);
+    }
+
+    bool valid = true;
+    valid &= verifyPxaRoundTrip("", "Pxa Empty Round Trip");
+    valid &= verifyPxaRoundTrip(lua, "Pxa Lua Round Trip");
+    valid &= verifyPxaRoundTrip(bytes, "Pxa Byte Values Round Trip");
+    valid &= verifyPxaRoundTrip(std::string(5000, 'a'), "Pxa Long Run Round Trip");
+    valid &= verifyLegacyRoundTrip(lua, "Legacy Lua Round Trip");
+    valid &= verifyLegacyRoundTrip(bytes + '\0' + bytes, "Legacy Byte Values Round Trip");
+    valid &= verifyGeneratedPngCart(lua, false, "Pxa Png Cart");
+    valid &= verifyGeneratedPngCart(lua, true, "Legacy Png Cart");
+
+    return valid;
+}
+
+#endif
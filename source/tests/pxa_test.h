@@ -0,0 +1,17 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+bool verifyPxaRoundTrip(std::string text, std::string testName);
+bool verifyLegacyRoundTrip(std::string text, std::string testName);
+
+//writes a .p8.png cart with the compressed text as its code and loads it back
+bool verifyGeneratedPngCart(std::string text, bool legacy, std::string testName);
+
+bool runPxaTests();
+
+#endif
@@ -0,0 +1,190 @@
+//Plays an input recording back headlessly as fast as the vm can go and
+//reports how long it took and whether every frame still matches the hashes
+//kept when it was recorded. Useful as a repeatable benchmark and to
+//reproduce bugs from a recording someone sent in. Not part of the console
+//builds. Build lua's library first (make -C libs/lua-5.3.2/src liblua.a) then
+//from the repo root something like:
+//g++ -std=gnu++17 -O2 -funsigned-char -Isource -Ilibs/lodepng -Ilibs/utf8-util -Ilibs/lua-5.3.2/src $(ls source/*.cpp | grep -v main.cpp) libs/lodepng/lodepng.cpp source/tests/replay.cpp libs/lua-5.3.2/src/liblua.a -o replay -lpthread
+//usage: replay <recording> [-c cart] [-n frames] [-t trace out] [-r runs] [-a api stats out] [-p profile out]
+//-c plays the recording on a cart at another path, -t writes the hash of
+//every frame one per line, -r repeats the replay and reports each run.
+//-a profiles the api calls of the first run and writes them as csv, one line
+//per function called each frame, then lists the costliest ones. Timing the
+//calls slows the replay down, so leave it off for benchmarks. -p samples the
+//lua stacks of the first run and writes them collapsed, ready for
+//flamegraph.pl or speedscope
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../vm.h"
+#include "../host.h"
+#include "../inputRecording.h"
+#include "../apiProfiler.h"
+#include "../luaProfiler.h"
+
+//framePresenter.cpp is linked in with the rest of the vm but nothing is ever
+//drawn here
+void Host::drawFrame(uint8_t* picoFb, uint8_t* screenPaletteMap, Color* paletteColors) { }
+hostThread* Host::startPresenterThread(void (*entry)(void*), void* arg) { return nullptr; }
+void Host::joinPresenterThread(hostThread* thread) { }
+
+static void usage(const char* name) {
+    printf("usage: %s <recording> [-c cart] [-n frames] [-t trace out] [-r runs] [-a api stats out] [-p profile out]\n", name);
+}
+
+static void printApiTotals(ApiProfiler* profiler) {
+    std::vector<apiCallStats> totals = profiler->GetTotals();
+    std::stable_sort(totals.begin(), totals.end(), [](const apiCallStats &a, const apiCallStats &b) {
+        return a.ns > b.ns;
+    });
+
+    uint32_t const frames = profiler->GetFrames();
+    printf("api calls per frame over %u frames:\n", frames);
+    for (auto const &function : totals) {
+        if (function.calls == 0) {
+            continue;
+        }
+        printf("  %-12s %10.1f calls %10.1f us\n", function.name,
+            (double)function.calls / frames, function.ns / 1000.0 / frames);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    InputRecording recording;
+    if (!recording.Load(argv[1])) {
+        printf("unable to load recording %s\n", argv[1]);
+        return 1;
+    }
+
+    int maxFrames = 0;
+    int runs = 1;
+    std::string tracePath;
+    std::string apiStatsPath;
+    std::string profilePath;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (arg == "-c") {
+            recording.CartFilename = argv[++i];
+        }
+        else if (arg == "-n") {
+            maxFrames = atoi(argv[++i]);
+        }
+        else if (arg == "-t") {
+            tracePath = argv[++i];
+        }
+        else if (arg == "-r") {
+            runs = atoi(argv[++i]);
+        }
+        else if (arg == "-a") {
+            apiStatsPath = argv[++i];
+        }
+        else if (arg == "-p") {
+            profilePath = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%s: %d frames, seed %08x\n", recording.CartFilename.c_str(), recording.FrameCount(), recording.RngSeed);
+
+    bool matched = true;
+    std::vector<uint64_t> firstTrace;
+    for (int run = 0; run < runs; run++) {
+        std::vector<uint64_t> trace;
+
+        Vm* vm = new Vm();
+        ApiProfiler* profiler = vm->GetApiProfiler();
+
+        FILE* apiStats = nullptr;
+        if (run == 0 && apiStatsPath != "") {
+            apiStats = fopen(apiStatsPath.c_str(), "w");
+            if (!apiStats) {
+                printf("unable to write %s\n", apiStatsPath.c_str());
+                return 1;
+            }
+            fprintf(apiStats, "frame,function,calls,us\n");
+            profiler->SetEnabled(true);
+        }
+
+        LuaProfiler* luaProfiler = vm->GetLuaProfiler();
+        luaProfiler->SetEnabled(run == 0 && profilePath != "");
+
+        replayResult result = replayRecording(vm, recording, maxFrames, &trace, [&](int frame) {
+            if (!apiStats) {
+                return;
+            }
+            for (auto const &function : profiler->GetLastFrame()) {
+                if (function.calls > 0) {
+                    fprintf(apiStats, "%d,%s,%u,%.3f\n", frame, function.name, function.calls, function.ns / 1000.0);
+                }
+            }
+        });
+
+        if (apiStats) {
+            fclose(apiStats);
+            printApiTotals(profiler);
+        }
+        if (luaProfiler->IsEnabled()) {
+            if (!luaProfiler->WriteCollapsed(profilePath)) {
+                printf("unable to write %s\n", profilePath.c_str());
+                return 1;
+            }
+            printf("%u samples in %d stacks written to %s\n", luaProfiler->GetSamples(),
+                (int)luaProfiler->GetStacks().size(), profilePath.c_str());
+        }
+        delete vm;
+
+        if (result.error != "") {
+            printf("error after %d frames: %s\n", result.frames, result.error.c_str());
+            return 1;
+        }
+
+        printf("run %d: %d frames in %.3fs, %.1f fps, final hash %016llx", run + 1, result.frames,
+            result.seconds, result.seconds > 0 ? result.frames / result.seconds : 0.0, (unsigned long long)result.finalHash);
+        if (result.firstMismatch >= 0) {
+            printf(", differs from the recording from frame %d", result.firstMismatch);
+            matched = false;
+        }
+        //replays are deterministic, every run has to draw the same frames
+        if (run > 0 && trace != firstTrace) {
+            printf(", differs from run 1");
+            matched = false;
+        }
+        printf("\n");
+
+        if (run == 0) {
+            firstTrace = trace;
+        }
+    }
+
+    if (tracePath != "") {
+        FILE* out = fopen(tracePath.c_str(), "w");
+        if (!out) {
+            printf("unable to write %s\n", tracePath.c_str());
+            return 1;
+        }
+        for (size_t i = 0; i < firstTrace.size(); i++) {
+            fprintf(out, "%zu %016llx\n", i, (unsigned long long)firstTrace[i]);
+        }
+        fclose(out);
+    }
+
+    return matched ? 0 : 2;
+}
@@ -0,0 +1,169 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "rewind_test.h"
+#include "../vm.h"
+#include "../rewindBuffer.h"
+#include "../frameHash.h"
+#include "../logger.h"
+
+#define REWIND_TEST_FRAMES 120
+#define REWIND_TEST_KEYFRAME_INTERVAL 30
+
+//moves with the buttons and scatters rnd() pixels, so resuming has to get
+//both the input and the generator right
+static const char* walkerCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+x = 64
+y = 64
+trail = {}
+function _update()
+	if btn(0) then x -= 1 end
+	if btn(1) then x += 1 end
+	if btnp(4) then y += 4 end
+	add(trail, {x = x + rnd(8), y = y + rnd(8)})
+	if #trail > 20 then del(trail, trail[1]) end
+end
+function _draw()
+	cls(0)
+	for p in all(trail) do
+		pset(p.x, p.y, 10)
+	end
+	circfill(x, y, 3, 8)
+end
+)";
+
+static uint8_t testInput(int frame) {
+    return (frame / 7) % 3 == 0 ? 1 : (frame % 11 == 0 ? 16 : 2);
+}
+
+static uint64_t currentHash(Vm* vm) {
+    return hashFrame(vm->GetPicoInteralFb(), vm->GetScreenPaletteMap(), vm->GetPaletteColors());
+}
+
+//runs frames from the vm's current frame count, capturing each one
+static std::vector<uint64_t> runFrames(Vm* vm, RewindBuffer* rewind, int frames) {
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < frames; i++) {
+        uint8_t const held = testInput(vm->GetFrameCount());
+        vm->UpdateAndDraw(held, held);
+        if (rewind) {
+            rewind->Capture(held, held);
+        }
+        hashes.push_back(currentHash(vm));
+    }
+
+    return hashes;
+}
+
+static Vm* newRewindVm() {
+    Vm* vm = new Vm();
+    vm->SetRngSeed(47);
+    vm->LoadCart("rewind_test_walker.p8");
+
+    return vm;
+}
+
+bool verifyRewindShowsPastFrames(std::string testName) {
+    bool valid = writeTestCart("rewind_test_walker.p8", walkerCartText);
+
+    Vm* vm = newRewindVm();
+    RewindBuffer rewind(vm, 4 * 1024 * 1024, REWIND_TEST_KEYFRAME_INTERVAL);
+    std::vector<uint64_t> hashes = runFrames(vm, &rewind, REWIND_TEST_FRAMES);
+
+    valid &= rewind.FramesAvailable() == REWIND_TEST_FRAMES;
+
+    Color* paletteColors = vm->GetPaletteColors();
+    for (int back = 1; valid && back < REWIND_TEST_FRAMES; back++) {
+        valid &= rewind.StepBack();
+        valid &= hashFrame(rewind.GetShownFb(), rewind.GetShownScreenPaletteMap(), paletteColors) == hashes[REWIND_TEST_FRAMES - 1 - back];
+    }
+    valid &= !rewind.StepBack();
+
+    delete vm;
+    remove("rewind_test_walker.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyRewindResumes(std::string testName) {
+    bool valid = writeTestCart("rewind_test_walker.p8", walkerCartText);
+
+    Vm* vm = newRewindVm();
+    std::vector<uint64_t> expected = runFrames(vm, nullptr, REWIND_TEST_FRAMES);
+    delete vm;
+
+    //back to a frame between keyframes, then to a keyframe, then to the
+    //first keyframe through the ones packed after it
+    int const resumeAt[] = {REWIND_TEST_FRAMES / 2 + 7, REWIND_TEST_KEYFRAME_INTERVAL, 5};
+    vm = newRewindVm();
+    RewindBuffer rewind(vm, 4 * 1024 * 1024, REWIND_TEST_KEYFRAME_INTERVAL);
+    runFrames(vm, &rewind, REWIND_TEST_FRAMES);
+
+    for (int frame : resumeAt) {
+        int const back = (rewind.FramesAvailable() - 1) - frame;
+        for (int i = 0; valid && i < back; i++) {
+            valid &= rewind.StepBack();
+        }
+        valid &= rewind.Resume();
+        valid &= vm->GetFrameCount() == frame + 1;
+        valid &= currentHash(vm) == expected[frame];
+
+        std::vector<uint64_t> after = runFrames(vm, &rewind, REWIND_TEST_FRAMES - 1 - frame);
+        valid &= std::vector<uint64_t>(expected.begin() + frame + 1, expected.end()) == after;
+    }
+
+    delete vm;
+    remove("rewind_test_walker.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyRewindStaysInBudget(std::string testName) {
+    bool valid = writeTestCart("rewind_test_walker.p8", walkerCartText);
+
+    size_t const budget = 512 * 1024;
+    Vm* vm = newRewindVm();
+    RewindBuffer rewind(vm, budget, REWIND_TEST_KEYFRAME_INTERVAL);
+    runFrames(vm, &rewind, REWIND_TEST_FRAMES * 4);
+
+    rewindStats stats = rewind.GetStats();
+    valid &= stats.bytesUsed <= budget;
+    valid &= stats.frames == REWIND_TEST_FRAMES * 4;
+    //older keyframes are packed against the next one, a whole state only
+    //has room for about two here
+    valid &= rewind.FramesAvailable() >= REWIND_TEST_KEYFRAME_INTERVAL * 4;
+    valid &= rewind.FramesAvailable() < REWIND_TEST_FRAMES * 4;
+
+    Logger::Write("rewind: %d frames kept in %d bytes, capture average %dus, worst %dus, worst keyframe %dus\n",
+        rewind.FramesAvailable(), (int)stats.bytesUsed, (int)stats.averageCaptureUs, (int)stats.worstCaptureUs, (int)stats.worstKeyframeUs);
+
+    delete vm;
+    remove("rewind_test_walker.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runRewindTests() {
+    bool valid = true;
+
+    valid &= verifyRewindShowsPastFrames("Rewind Shows Past Frames");
+    valid &= verifyRewindResumes("Rewind Resumes");
+    valid &= verifyRewindStaysInBudget("Rewind Stays In Budget");
+
+    return valid;
+}
+
+#endif
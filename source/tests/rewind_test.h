@@ -0,0 +1,23 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+//stepping back shows each earlier frame as it was drawn, straight from the
+//deltas without running anything
+bool verifyRewindShowsPastFrames(std::string testName);
+
+//resuming from a rewound frame puts the vm exactly where it was, so the
+//same input afterwards draws the same frames
+bool verifyRewindResumes(std::string testName);
+
+//a small budget keeps dropping the oldest keyframes without losing the
+//newest frames, and holds more keyframes than whole states would fit
+bool verifyRewindStaysInBudget(std::string testName);
+
+bool runRewindTests();
+
+#endif
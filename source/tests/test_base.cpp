@@ -5,6 +5,7 @@
 
 #include <string>
 #include <sstream>
+#include <cstdio>
 
 #include "../logger.h"
 
@@ -39,4 +40,15 @@ void printTestOuput(std::string testName, bool success) {
         printf(output.str().c_str());
     }
 }
+
+bool writeTestCart(std::string filename, const char* text) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    fputs(text, file);
+    fclose(file);
+
+    return true;
+}
 #endif
\ No newline at end of file
@@ -14,4 +14,7 @@ bool assertStringsEqual(std::string expected, std::string actual, std::string te
 
 void printTestOuput(std::string testName, bool success);
 
+//writes a .p8 cart for a test to load, tests remove them when they finish
+bool writeTestCart(std::string filename, const char* text);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,467 @@
+#include "test_base.h"
+
+#if _TEST
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include "vm_test.h"
+#include "../vm.h"
+#include "../apiProfiler.h"
+#include "../luaProfiler.h"
+#include "../frameHash.h"
+#include "../logger.h"
+#include "../filehelpers.h"
+
+#define VM_TEST_FRAMES 60
+
+//draws from rnd() and from inside a coroutine, so both the vm's own state
+//and the api context seen by coroutines are exercised
+static const char* circlesCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+local t = 0
+local drawer = nil
+function _update()
+	t += 1
+	drawer = cocreate(function()
+		for i = 0, 7 do
+			circfill(rnd(128), rnd(128), 4 + i, 8 + i % 8)
+			yield()
+		end
+	end)
+end
+function _draw()
+	cls(1)
+	while costatus(drawer) != "dead" do
+		coresume(drawer)
+	end
+	print(t, 2, 2, 7)
+end
+)";
+
+static const char* rectsCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+local t = 0
+function _update()
+	t += 1
+end
+function _draw()
+	cls(0)
+	for i = 0, 15 do
+		rectfill(i * 8, (t + i * 5) % 128, i * 8 + 6, (t + i * 5) % 128 + 6, i)
+	end
+	pal(7, t % 16)
+end
+)";
+
+//errors on its tenth update, after calling a couple of stubbed functions
+static const char* erroringCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+local t = 0
+function _update()
+	t += 1
+	fillp()
+	if t == 10 then
+		local missing = nil
+		missing.field = 1
+	end
+end
+function _draw()
+	cls(2)
+	peek(0)
+end
+)";
+
+//iterates tables keyed by tables, whose order depends on where lua put the
+//keys in its heap
+static const char* tableKeysCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+objs = {}
+function _update()
+	objs[{x = rnd(128), y = rnd(128)}] = true
+end
+function _draw()
+	cls()
+	local i = 0
+	for k in pairs(objs) do
+		i += 1
+		pset(k.x, k.y, i % 16)
+	end
+	rectfill(0, 0, i % 128, 2, 7)
+end
+)";
+
+//time split between a lua loop and an api call, a couple of calls deep,
+//and one quick api call straight from the callback
+static const char* nestedCallsCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+function inner(n)
+	local s = 0
+	for i = 1, 500 do
+		s += i * n
+	end
+	rectfill(0, 0, 127, 127, s % 16)
+end
+function outer()
+	for n = 1, 10 do
+		inner(n)
+	end
+end
+function _draw()
+	outer()
+	pset(0, 0, 7)
+end
+)";
+
+//formats strings whose lengths move on every frame and keeps a few of them
+//around, so the garbage is a different size each frame and what is kept
+//sits between it
+static const char* stringChurnCartText = R"(pico-8 cartridge // http://www.pico-8.com
+version 18
+__lua__
+base = ""
+for i = 1, 10 do
+	base = base.."0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMN"
+end
+kept = {}
+n = 0
+total = 0
+function _update()
+	n += 1
+	for i = 1, 600 do
+		local s = sub(base, 1, 41 + (n * 24 + i % 8) % 440)..i
+		total += #s
+		if i % 20 == 0 then
+			kept[(n * 30 + i / 20) % 32] = s
+		end
+	end
+end
+function _draw()
+	cls()
+	print(total, 2, 2, 7)
+	print(#kept[n % 32], 2, 10, 7)
+end
+)";
+
+static Vm* newTestVm(std::string filename) {
+    Vm* vm = new Vm();
+    vm->SetRngSeed(44);
+    vm->LoadCart(filename);
+
+    return vm;
+}
+
+static uint64_t stepVm(Vm* vm) {
+    vm->UpdateAndDraw(0, 0);
+
+    return hashFrame(vm->GetPicoInteralFb(), vm->GetScreenPaletteMap(), vm->GetPaletteColors());
+}
+
+static std::vector<uint64_t> runAlone(std::string filename) {
+    std::vector<uint64_t> hashes;
+
+    Vm* vm = newTestVm(filename);
+    for (int i = 0; i < VM_TEST_FRAMES; i++) {
+        hashes.push_back(stepVm(vm));
+    }
+    delete vm;
+
+    return hashes;
+}
+
+bool verifyVmsInterleaved(std::string testName) {
+    bool valid = writeTestCart("vm_test_circles.p8", circlesCartText) && writeTestCart("vm_test_rects.p8", rectsCartText);
+
+    std::vector<uint64_t> circles = runAlone("vm_test_circles.p8");
+    std::vector<uint64_t> rects = runAlone("vm_test_rects.p8");
+    valid &= circles != rects;
+
+    //the second vm is created after the first one loaded its cart
+    Vm* first = newTestVm("vm_test_circles.p8");
+    Vm* second = newTestVm("vm_test_rects.p8");
+    for (int i = 0; valid && i < VM_TEST_FRAMES; i++) {
+        valid &= stepVm(first) == circles[i];
+        valid &= stepVm(second) == rects[i];
+    }
+    delete first;
+    delete second;
+
+    remove("vm_test_circles.p8");
+    remove("vm_test_rects.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyVmsOnThreads(int threads, std::string testName) {
+    bool valid = writeTestCart("vm_test_circles.p8", circlesCartText);
+
+    std::vector<uint64_t> expected = runAlone("vm_test_circles.p8");
+
+    std::vector<std::vector<uint64_t>> results(threads);
+    std::vector<std::thread> running;
+    for (int i = 0; i < threads; i++) {
+        running.emplace_back([&results, i] {
+            results[i] = runAlone("vm_test_circles.p8");
+        });
+    }
+    for (std::thread &thread : running) {
+        thread.join();
+    }
+
+    for (int i = 0; i < threads; i++) {
+        valid &= results[i] == expected;
+    }
+
+    remove("vm_test_circles.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyVmCatchesLuaErrors(std::string testName) {
+    bool valid = writeTestCart("vm_test_erroring.p8", erroringCartText);
+
+    Vm* vm = new Vm();
+    valid &= vm->LoadCart("vm_test_erroring.p8");
+    valid &= vm->GetLastError() == "";
+
+    int frames = 0;
+    while (frames < VM_TEST_FRAMES && vm->GetLastError() == "") {
+        vm->UpdateAndDraw(0, 0);
+        frames++;
+    }
+
+    //the failing update is the tenth, its draw never runs
+    valid &= frames == 10;
+    valid &= vm->GetLastError().find("_update") == 0;
+
+    std::map<std::string, uint32_t> calls = vm->GetUnimplementedCalls();
+    valid &= calls["fillp"] == 10 && calls["peek"] == 9;
+
+    //the bios took over and keeps running
+    vm->UpdateAndDraw(0, 0);
+
+    delete vm;
+    remove("vm_test_erroring.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifySaveStateRestoresFrames(std::string testName) {
+    bool valid = writeTestCart("vm_test_circles.p8", circlesCartText) && writeTestCart("vm_test_rects.p8", rectsCartText);
+
+    Vm* vm = newTestVm("vm_test_circles.p8");
+    for (int i = 0; i < VM_TEST_FRAMES / 2; i++) {
+        stepVm(vm);
+    }
+
+    std::vector<uint8_t> state;
+    valid &= vm->SaveState(state);
+
+    std::vector<uint64_t> expected;
+    for (int i = 0; i < VM_TEST_FRAMES / 2; i++) {
+        expected.push_back(stepVm(vm));
+    }
+
+    //straight back, then again after another cart has been running
+    for (int pass = 0; valid && pass < 2; pass++) {
+        valid &= vm->LoadState(state);
+        valid &= vm->GetFrameCount() == VM_TEST_FRAMES / 2;
+        for (int i = 0; valid && i < VM_TEST_FRAMES / 2; i++) {
+            valid &= stepVm(vm) == expected[i];
+        }
+
+        vm->LoadCart("vm_test_rects.p8");
+        stepVm(vm);
+    }
+
+    //the heap can't be moved to another vm
+    Vm* other = newTestVm("vm_test_circles.p8");
+    valid &= !other->LoadState(state);
+    delete other;
+
+    //the heap is saved last and starts with how much of it there is. One
+    //that says otherwise isn't run, the cart starts over instead
+    std::vector<uint8_t> damaged = state;
+    size_t heapStart = 0;
+    for (size_t i = 0; i + sizeof(size_t) <= damaged.size(); i++) {
+        size_t top;
+        memcpy(&top, &damaged[i], sizeof(top));
+        if (top == damaged.size() - i) {
+            heapStart = i;
+            break;
+        }
+    }
+    valid &= heapStart > 0;
+    size_t const badTop = 16;
+    memcpy(&damaged[heapStart], &badTop, sizeof(badTop));
+
+    std::vector<uint64_t> fromStart = runAlone("vm_test_circles.p8");
+    vm->LoadCart("vm_test_rects.p8");
+    valid &= !vm->LoadState(damaged);
+    valid &= vm->GetCartFilename() == "vm_test_circles.p8" && vm->GetFrameCount() == 0;
+    valid &= stepVm(vm) == fromStart[0];
+
+    delete vm;
+    remove("vm_test_circles.p8");
+    remove("vm_test_rects.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyArenaReusesFreedMemory(std::string testName) {
+    bool valid = writeTestCart("vm_test_string_churn.p8", stringChurnCartText);
+
+    Vm* vm = newTestVm("vm_test_string_churn.p8");
+    for (int i = 0; valid && i < VM_TEST_FRAMES * 4; i++) {
+        stepVm(vm);
+        valid &= vm->GetLastError() == "";
+    }
+    valid &= vm->GetCartFilename() == "vm_test_string_churn.p8";
+
+    //only 32 short strings are kept, the state holds what the heap
+    //needs now rather than everything the cart ever had
+    std::vector<uint8_t> state;
+    valid &= vm->SaveState(state);
+    valid &= state.size() < VM_LUA_ARENA_SIZE / 8;
+
+    delete vm;
+    remove("vm_test_string_churn.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+static apiCallStats findCalls(std::vector<apiCallStats> functions, std::string name) {
+    for (auto const &function : functions) {
+        if (name == function.name) {
+            return function;
+        }
+    }
+
+    return apiCallStats{nullptr, 0, 0};
+}
+
+bool verifyApiProfilerCountsCalls(std::string testName) {
+    bool valid = writeTestCart("vm_test_table_keys.p8", tableKeysCartText);
+
+    std::vector<uint64_t> expected = runAlone("vm_test_table_keys.p8");
+
+    Vm* vm = new Vm();
+    ApiProfiler* profiler = vm->GetApiProfiler();
+    profiler->SetEnabled(true);
+    vm->SetRngSeed(44);
+    valid &= vm->LoadCart("vm_test_table_keys.p8");
+    valid &= profiler->IsActive();
+
+    for (int i = 0; i < VM_TEST_FRAMES; i++) {
+        valid &= stepVm(vm) == expected[i];
+    }
+
+    std::vector<apiCallStats> lastFrame = profiler->GetLastFrame();
+    valid &= findCalls(lastFrame, "pset").calls == VM_TEST_FRAMES;
+    valid &= findCalls(lastFrame, "rnd").calls == 2;
+    valid &= findCalls(lastFrame, "circfill").calls == 0;
+    valid &= findCalls(profiler->GetTotals(), "pset").calls == VM_TEST_FRAMES * (VM_TEST_FRAMES + 1) / 2;
+    valid &= profiler->GetFrames() == VM_TEST_FRAMES;
+
+    //the bios isn't profiled and leaves the cart's numbers alone
+    vm->LoadBiosCart();
+    valid &= !profiler->IsActive();
+    vm->UpdateAndDraw(0, 0);
+    valid &= profiler->GetFrames() == VM_TEST_FRAMES;
+
+    delete vm;
+    remove("vm_test_table_keys.p8");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool verifyLuaProfilerSamplesStacks(std::string testName) {
+    bool valid = writeTestCart("vm_test_nested_calls.p8", nestedCallsCartText);
+
+    std::vector<uint64_t> expected = runAlone("vm_test_nested_calls.p8");
+
+    Vm* vm = new Vm();
+    LuaProfiler* profiler = vm->GetLuaProfiler();
+    profiler->SetEnabled(true);
+    vm->SetRngSeed(44);
+    valid &= vm->LoadCart("vm_test_nested_calls.p8");
+    valid &= profiler->IsActive();
+
+    for (int i = 0; i < VM_TEST_FRAMES; i++) {
+        valid &= stepVm(vm) == expected[i];
+    }
+
+    uint64_t luaNs = 0;
+    uint64_t rectfillNs = 0;
+    for (auto const &stack : profiler->GetStacks()) {
+        //stacks are named from the vm callback in
+        valid &= stack.first.find("_draw") == 0;
+
+        std::string const rectfill = ";rectfill";
+        if (stack.first.length() > rectfill.length() &&
+                stack.first.compare(stack.first.length() - rectfill.length(), rectfill.length(), rectfill) == 0) {
+            valid &= stack.first.find("_draw;outer:") == 0 && stack.first.find(";inner:") != std::string::npos;
+            rectfillNs += stack.second;
+        }
+        else if (stack.first != "_draw;pset") {
+            luaNs += stack.second;
+        }
+    }
+    valid &= luaNs > 0 && rectfillNs > 0;
+    //every call is charged to its own stack, however little time it took
+    valid &= profiler->GetStacks()["_draw;pset"] > 0;
+    valid &= profiler->GetSamples() > VM_TEST_FRAMES;
+
+    //the profile goes out when the cart closes, the bios isn't sampled
+    profiler->SetOutputFile("vm_test_nested_calls.folded");
+    vm->LoadBiosCart();
+    valid &= !profiler->IsActive();
+
+    std::vector<unsigned char> folded = get_file_buffer("vm_test_nested_calls.folded");
+    valid &= std::string(folded.begin(), folded.end()).find(";inner:1;rectfill ") != std::string::npos;
+
+    delete vm;
+    remove("vm_test_nested_calls.p8");
+    remove("vm_test_nested_calls.folded");
+
+    printTestOuput(testName, valid);
+
+    return valid;
+}
+
+bool runVmTests() {
+    bool valid = true;
+
+    valid &= verifyVmsInterleaved("Vms Interleaved On One Thread");
+    valid &= verifyVmsOnThreads(4, "Vms On Four Threads");
+    valid &= verifyVmCatchesLuaErrors("Vm Catches Lua Errors");
+    valid &= verifySaveStateRestoresFrames("Save State Restores Frames");
+    valid &= verifyArenaReusesFreedMemory("Arena Reuses Freed Memory");
+    valid &= verifyApiProfilerCountsCalls("Api Profiler Counts Calls");
+    valid &= verifyLuaProfilerSamplesStacks("Lua Profiler Samples Stacks");
+
+    return valid;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#include "test_base.h"
+
+#if _TEST
+
+#pragma once
+
+#include <string>
+
+//two vms running different carts a frame at a time on the same thread each
+//draw exactly what they draw running alone
+bool verifyVmsInterleaved(std::string testName);
+
+//the same cart on several threads at once draws the same frames as on one
+bool verifyVmsOnThreads(int threads, std::string testName);
+
+//a lua error in _update is caught, kept for GetLastError and the bios takes
+//over instead of the error unwinding through the vm
+bool verifyVmCatchesLuaErrors(std::string testName);
+
+//frames after loading a save state are the same ones the cart drew after
+//saving it, even with another cart loaded in between
+bool verifySaveStateRestoresFrames(std::string testName);
+
+//a cart that makes garbage of every size runs as long as what it keeps fits,
+//and saving it only copies the heap it is using
+bool verifyArenaReusesFreedMemory(std::string testName);
+
+//with the api profiler on, every api call is counted per frame and the cart
+//draws the same frames it does without it, even where that depends on
+//where things are in the lua heap
+bool verifyApiProfilerCountsCalls(std::string testName);
+
+//the lua profiler charges time to the stacks that spent it, api functions
+//included, and the cart draws the same frames it does without it
+bool verifyLuaProfilerSamplesStacks(std::string testName);
+
+bool runVmTests();
+
+#endif
@@ -3,6 +3,10 @@
 #include <math.h>
 
 #include <string.h>
+#include <chrono>
+#include <type_traits>
+#include <stdio.h>
+#include <stddef.h>
 
 #include "vm.h"
 #include "graphics.h"
@@ -14,6 +18,8 @@
 #include "p8GlobalLuaFunctions.h"
 #include "hostVmShared.h"
 #include "emojiconversion.h"
+#include "luaArena.h"
+#include "filehelpers.h"
 
 extern "C" {
   #include <lua.h>
@@ -21,6 +27,8 @@ extern "C" {
   #include <lauxlib.h>
 }
 
+static_assert(VM_LUA_ARENA_SIZE <= LUAI_HEAPSPAN, "the lua arena has to fit in LUAI_HEAPSPAN");
+
 Vm::Vm(){
     Logger::Write("getting font string\n");
     auto fontdata = get_font_data();
@@ -35,6 +43,8 @@ Vm::Vm(){
     _memory._gfxState_color = 7;
     _graphics->clip();
     _graphics->pal();
+    //carts start on a black screen, not whatever the last one left there
+    _graphics->cls();
 
     Logger::Write("Creating Input object\n");
     Input* input = new Input();
@@ -43,22 +53,77 @@ Vm::Vm(){
     Audio* audio = new Audio(&_memory);
     _audio = audio;
 
-    //this can probably go away when I'm loading actual carts and just have to expose api to lua
-    Logger::Write("Initializing global api\n");
-    initPicoApi(_graphics, _input, this, _audio);
-    //initGlobalApi(_graphics);
+    _luaArena = new LuaArena(VM_LUA_ARENA_SIZE, LUAI_HEAPSPAN);
+
+    _apiProfiler = new ApiProfiler();
+    _luaProfiler = new LuaProfiler();
+
+    //handed to every lua state this vm creates
+    _apiContext = new picoApiContext{_graphics, _input, this, _audio, _apiProfiler, _luaProfiler};
+
+    _loadedCart = nullptr;
+    _luaState = nullptr;
+    _hasUpdate = false;
+    _hasDraw = false;
+    _picoFrameCount = 0;
+    _cartChangeQueued = false;
+    _lastUpdateUs = 0;
+    _lastDrawUs = 0;
+
+    _cartLibrary = nullptr;
+    _framePacer = nullptr;
+    _framePresenter = nullptr;
 
     _targetFps = 30;
+
+    //pico 8 also starts from a different seed every boot
+    _rngSeed = (uint32_t)std::chrono::system_clock::now().time_since_epoch().count();
 }
 
 Vm::~Vm(){
     CloseCart();
 
+    delete _apiContext;
+    delete _apiProfiler;
+    delete _luaProfiler;
+    delete _luaArena;
     delete _graphics;
     delete _input;
     delete _audio;
 }
 
+static uint32_t toFixedBits(double value) {
+    return (uint32_t)(int64_t)(value * 65536.0);
+}
+
+//pico 8's generator, as worked out for zepto 8
+static uint32_t rndBits(uint32_t state[2], uint32_t range) {
+    state[1] = ((state[1] << 16) | (state[1] >> 16)) + state[0];
+    state[0] += state[1];
+
+    return range ? state[1] % range : 0;
+}
+
+static void srandBits(uint32_t state[2], uint32_t seed) {
+    state[0] = seed ? seed : 0xdeadbeef;
+    state[1] = state[0] ^ 0xbead29ba;
+    for (int i = 0; i < 32; i++) {
+        rndBits(state, 0);
+    }
+}
+
+//only reached for errors outside of a protected call
+static int luaPanic(lua_State* L) {
+    Logger::Write("PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+
+    return 0;
+}
+
+template<lua_CFunction F>
+void Vm::registerApi(const char* name){
+    registerApiFunction<F>(_luaState, name, _apiProfiler);
+}
+
 bool Vm::loadCart(Cart* cart) {
     _picoFrameCount = 0;
 
@@ -78,6 +143,8 @@ bool Vm::loadCart(Cart* cart) {
         return false;
     }
 
+    srandBits(_memory._rngState, _rngSeed);
+
     //reset audio
     for(int i = 0; i < 4; i++) {
         _memory._sfxChannels[i].sfxId = -1;
@@ -103,14 +170,35 @@ bool Vm::loadCart(Cart* cart) {
         _memory.songs[i] = cart->SongData[i];
     }
 
-    // initialize Lua interpreter
-    _luaState = luaL_newstate();
+    // initialize Lua interpreter. Everything it allocates goes in the arena,
+    //which is what lets save states copy the heap
+    _luaArena->Reset();
+    _luaState = lua_newstate(LuaArena::Alloc, _luaArena);
+
+    if (!_luaState) {
+        _cartLoadError = "Unable to create lua state";
+        Logger::Write("%s\n", _cartLoadError.c_str());
+
+        return false;
+    }
+
+    lua_atpanic(_luaState, luaPanic);
+
+    initPicoApi(_luaState, _apiContext);
+
+    //the bios is left alone so it can show the last cart's numbers. The lua
+    //profiler gets api times from the api profiler's wrappers
+    bool const profiled = (_apiProfiler->IsEnabled() || _luaProfiler->IsEnabled()) && cart->Filename != "__FAKE08-BIOS.p8";
+    if (profiled) {
+        _apiProfiler->Start();
+    }
 
     // load Lua base libraries (print / math / etc)
     luaL_openlibs(_luaState);
 
     //load in global lua fuctions for pico 8
-    auto convertedGlobalLuaFunctions = convert_emojis(p8GlobalLuaFunctions);
+    //the globals never change, so they only need converting once
+    static const std::string convertedGlobalLuaFunctions = convert_emojis(p8GlobalLuaFunctions);
     int loadedGlobals = luaL_dostring(_luaState, convertedGlobalLuaFunctions.c_str());
 
     if (loadedGlobals != LUA_OK) {
@@ -123,88 +211,102 @@ bool Vm::loadCart(Cart* cart) {
     }
 
     //graphics
-    lua_register(_luaState, "cls", cls);
-    lua_register(_luaState, "pset", pset);
-    lua_register(_luaState, "pget", pget);
-    lua_register(_luaState, "color", color);
-    lua_register(_luaState, "line", line);
-    lua_register(_luaState, "circ", circ);
-    lua_register(_luaState, "circfill", circfill);
-    lua_register(_luaState, "rect", rect);
-    lua_register(_luaState, "rectfill", rectfill);
-    lua_register(_luaState, "print", print);
-    lua_register(_luaState, "cursor", cursor);
-    lua_register(_luaState, "spr", spr);
-    lua_register(_luaState, "sspr", sspr);
-    lua_register(_luaState, "fget", fget);
-    lua_register(_luaState, "fset", fset);
-    lua_register(_luaState, "sget", sget);
-    lua_register(_luaState, "sset", sset);
-    lua_register(_luaState, "camera", camera);
-    lua_register(_luaState, "clip", clip);
-
-    lua_register(_luaState, "pal", pal);
-    lua_register(_luaState, "palt", palt);
-
-    lua_register(_luaState, "mget", mget);
-    lua_register(_luaState, "mset", mset);
-    lua_register(_luaState, "map", map);
+    registerApi<cls>("cls");
+    registerApi<pset>("pset");
+    registerApi<pget>("pget");
+    registerApi<color>("color");
+    registerApi<line>("line");
+    registerApi<circ>("circ");
+    registerApi<circfill>("circfill");
+    registerApi<rect>("rect");
+    registerApi<rectfill>("rectfill");
+    registerApi<print>("print");
+    registerApi<cursor>("cursor");
+    registerApi<spr>("spr");
+    registerApi<sspr>("sspr");
+    registerApi<fget>("fget");
+    registerApi<fset>("fset");
+    registerApi<sget>("sget");
+    registerApi<sset>("sset");
+    registerApi<camera>("camera");
+    registerApi<clip>("clip");
+
+    registerApi<pal>("pal");
+    registerApi<palt>("palt");
+
+    registerApi<mget>("mget");
+    registerApi<mset>("mset");
+    registerApi<::map>("map");
 
     //stubbed in graphics:
-    lua_register(_luaState, "fillp", fillp);
-    lua_register(_luaState, "flip", flip);
+    registerApi<fillp>("fillp");
+    registerApi<flip>("flip");
 
     //input
-    lua_register(_luaState, "btn", btn);
-    lua_register(_luaState, "btnp", btnp);
+    registerApi<btn>("btn");
+    registerApi<btnp>("btnp");
+
+    registerApi<time>("time");
+    registerApi<time>("t");
 
-    lua_register(_luaState, "time", time);
-    lua_register(_luaState, "t", time);
+    //math
+    registerApi<rnd>("rnd");
+    registerApi<srand>("srand");
 
     //stubbed in audio:
-    lua_register(_luaState, "music", music);
-    lua_register(_luaState, "sfx", sfx);
+    registerApi<music>("music");
+    registerApi<sfx>("sfx");
 
     //stubbed in memory
-    lua_register(_luaState, "cstore", cstore);
-    lua_register(_luaState, "memcpy", api_memcpy);
-    lua_register(_luaState, "memset", api_memset);
-    lua_register(_luaState, "peek", peek);
-    lua_register(_luaState, "poke", poke);
-    lua_register(_luaState, "reload", reload);
+    registerApi<cstore>("cstore");
+    registerApi<api_memcpy>("memcpy");
+    registerApi<api_memset>("memset");
+    registerApi<peek>("peek");
+    registerApi<poke>("poke");
+    registerApi<reload>("reload");
 
     //stubbed in cart data
-    lua_register(_luaState, "cartdata", cartdata);
-    lua_register(_luaState, "dget", dget);
-    lua_register(_luaState, "dset", dset);
+    registerApi<cartdata>("cartdata");
+    registerApi<dget>("dget");
+    registerApi<dset>("dset");
 
     //system
-    lua_register(_luaState, "__listcarts", listcarts);
-    lua_register(_luaState, "__loadcart", loadcart);
-    lua_register(_luaState, "__getbioserror", getbioserror);
-    lua_register(_luaState, "__loadbioscart", loadbioscart);
+    registerApi<cartcount>("__cartcount");
+    registerApi<cartinfo>("__cartinfo");
+    registerApi<drawcartlabel>("__drawcartlabel");
+    registerApi<loadcart>("__loadcart");
+    registerApi<getbioserror>("__getbioserror");
+    registerApi<loadbioscart>("__loadbioscart");
+    registerApi<framestats>("__framestats");
+    registerApi<profiling>("__profiling");
+    registerApi<apistats>("__apistats");
+
+    if (profiled && _luaProfiler->IsEnabled()) {
+        _luaProfiler->Start(_luaState);
+    }
 
     int loadedCart = luaL_dostring(_luaState, cart->LuaString.c_str());
 
     if (loadedCart != LUA_OK) {
         _cartLoadError = "Error loading cart lua";
+        _lastError = p8scii_to_utf8(lua_tostring(_luaState, -1));
         Logger::Write("ERROR loading cart\n");
-        Logger::Write("Error: %s\n", lua_tostring(_luaState, -1));
+        Logger::Write("Error: %s\n", _lastError.c_str());
         lua_pop(_luaState, 1);
 
         return false;
     }
 
 
-    // Push the _init function on the top of the lua stack (or nil if it doesn't exist)
     lua_getglobal(_luaState, "_init");
+    bool hasInit = lua_isfunction(_luaState, -1);
+    lua_pop(_luaState, 1);
 
-    if (lua_isfunction(_luaState, -1)) {
-        lua_call(_luaState, 0, 0);
-    }
+    if (hasInit && !callLuaFunction("_init")) {
+        _cartLoadError = _lastError;
 
-    //pop the _init fuction off the stack now that we're done with it
-    lua_pop(_luaState, 0);
+        return false;
+    }
 
     //check for update, mark correct target fps
     lua_getglobal(_luaState, "_update");
@@ -232,6 +334,8 @@ bool Vm::loadCart(Cart* cart) {
 
     _cartLoadError = "";
 
+    _audio->StartThread();
+
     return true;
 }
 
@@ -243,13 +347,16 @@ void Vm::LoadBiosCart(){
     bool success = loadCart(cart);
 
     if (!success) {
+        delete cart;
         CloseCart();
     }
 }
 
-void Vm::LoadCart(std::string filename){
+bool Vm::LoadCart(std::string filename){
     Logger::Write("Loading cart %s\n", filename.c_str());
     CloseCart();
+    _lastError = "";
+    _unimplementedCalls.clear();
 
     Logger::Write("Calling Cart Constructor\n");
     Cart *cart = new Cart(filename);
@@ -259,10 +366,39 @@ void Vm::LoadCart(std::string filename){
     bool success = loadCart(cart);
 
     if (!success) {
+        if (_lastError == "") {
+            _lastError = _cartLoadError;
+        }
+
+        delete cart;
         CloseCart();
-        //todo: show an error message on the bios?
+        //the bios shows _cartLoadError from its _init
         LoadBiosCart();
     }
+
+    return success;
+}
+
+//calls a global lua function without arguments. Errors are caught and kept
+//instead of unwinding through the vm, the caller decides what to do with them
+bool Vm::callLuaFunction(const char* name){
+    lua_getglobal(_luaState, name);
+
+    _luaProfiler->Enter(name);
+    int const result = lua_pcall(_luaState, 0, 0, 0);
+    _luaProfiler->Leave();
+
+    if (result == LUA_OK) {
+        return true;
+    }
+
+    const char* message = lua_tostring(_luaState, -1);
+    _lastError = string(name) + ": " + (message ? p8scii_to_utf8(message) : "error object is not a string");
+    lua_pop(_luaState, 1);
+
+    Logger::Write("Lua error in %s\n", _lastError.c_str());
+
+    return false;
 }
 
 
@@ -273,32 +409,34 @@ void Vm::UpdateAndDraw(
 {
     _input->SetState(kdown, kheld);
 
-    if (_hasUpdate){
-        // Push the _update function on the top of the lua stack
-        if (_targetFps == 60) {
-            lua_getglobal(_luaState, "_update60");
-        } else {
-            lua_getglobal(_luaState, "_update");
-        }
-
-        //we already checked that its a function, so we should be able to call it
-        lua_call(_luaState, 0, 0);
+    auto const start = std::chrono::steady_clock::now();
 
-        //pop the update fuction off the stack now that we're done with it
-        lua_pop(_luaState, 0);
+    bool ok = true;
+    if (_hasUpdate){
+        ok = callLuaFunction(_targetFps == 60 ? "_update60" : "_update");
     }
 
-    if (_hasDraw) {
-        lua_getglobal(_luaState, "_draw");
+    auto const updated = std::chrono::steady_clock::now();
 
-        lua_call(_luaState, 0, 0);
-        
-        //pop the update fuction off the stack now that we're done with it
-        lua_pop(_luaState, 0);
+    if (ok && _hasDraw) {
+        ok = callLuaFunction("_draw");
     }
 
+    auto const drawn = std::chrono::steady_clock::now();
+    _lastUpdateUs = std::chrono::duration_cast<std::chrono::microseconds>(updated - start).count();
+    _lastDrawUs = std::chrono::duration_cast<std::chrono::microseconds>(drawn - updated).count();
+    _apiProfiler->EndFrame();
+
     _picoFrameCount++;
 
+    //a cart that errors can't carry on, the bios shows what went wrong
+    if (!ok) {
+        _cartLoadError = _lastError;
+        LoadBiosCart();
+
+        return;
+    }
+
     //todo: pause menu here, but for now just load bios
     if (kdown & P8_KEY_PAUSE) {
         QueueCartChange("__FAKE08-BIOS.p8");
@@ -325,10 +463,29 @@ Color* Vm::GetPaletteColors(){
 
 
 void Vm::FillAudioBuffer(void *audioBuffer, size_t offset, size_t size){
-   _audio->FillAudioBuffer(audioBuffer, offset, size);
+   _audio->ReadAudioBuffer((uint32_t*)audioBuffer + offset, size);
+}
+
+audioStats Vm::GetAudioStats(){
+    return _audio->GetStats();
+}
+
+void Vm::SetAudioRingTarget(size_t samples){
+    _audio->SetRingTarget(samples);
 }
 
 void Vm::CloseCart() {
+    //the cart's sound stops with it, and the next cart resets the channels
+    _audio->StopThread();
+    _apiProfiler->Stop();
+    _luaProfiler->Stop();
+
+    audioStats stats = _audio->GetStats();
+    if (stats.underruns > 0 || stats.droppedCommands > 0) {
+        Logger::Write("audio: %u underruns (%u samples), %u dropped commands\n",
+            stats.underruns, stats.underrunSamples, stats.droppedCommands);
+    }
+
     if (_loadedCart){
         Logger::Write("deleting cart\n");
         delete _loadedCart;
@@ -361,14 +518,287 @@ int Vm::GetFrameCount() {
     return _picoFrameCount;
 }
 
-void Vm::SetCartList(vector<string> cartList){
-    _cartList = cartList;
+double Vm::api_rnd(double range) {
+    return (int32_t)rndBits(_memory._rngState, toFixedBits(range)) / 65536.0;
+}
+
+void Vm::api_srand(double seed) {
+    srandBits(_memory._rngState, toFixedBits(seed));
+}
+
+void Vm::SetRngSeed(uint32_t seed) {
+    _rngSeed = seed;
+}
+
+uint32_t Vm::GetRngSeed() {
+    return _rngSeed;
+}
+
+void Vm::SetCartLibrary(CartLibrary* cartLibrary){
+    _cartLibrary = cartLibrary;
 }
 
-vector<string> Vm::GetCartList(){
-    return _cartList;
+CartLibrary* Vm::GetCartLibrary(){
+    return _cartLibrary;
+}
+
+void Vm::SetFramePacer(FramePacer* framePacer){
+    _framePacer = framePacer;
+}
+
+FramePacer* Vm::GetFramePacer(){
+    return _framePacer;
+}
+
+void Vm::SetFramePresenter(FramePresenter* framePresenter){
+    _framePresenter = framePresenter;
+}
+
+FramePresenter* Vm::GetFramePresenter(){
+    return _framePresenter;
+}
+
+ApiProfiler* Vm::GetApiProfiler(){
+    return _apiProfiler;
+}
+
+LuaProfiler* Vm::GetLuaProfiler(){
+    return _luaProfiler;
 }
 
 string Vm::GetBiosError() {
     return _cartLoadError;
 }
+
+string Vm::GetCartFilename() {
+    return _loadedCart ? _loadedCart->Filename : "";
+}
+
+bool Vm::IsBiosLoaded() {
+    return _loadedCart && _loadedCart->Filename == "__FAKE08-BIOS.p8";
+}
+
+string Vm::GetLastError() {
+    return _lastError;
+}
+
+void Vm::RecordUnimplementedCall(const char* name) {
+    _unimplementedCalls[name]++;
+}
+
+std::map<string, uint32_t> Vm::GetUnimplementedCalls() {
+    std::map<string, uint32_t> calls;
+    for (auto const &call : _unimplementedCalls) {
+        calls[call.first] += call.second;
+    }
+
+    return calls;
+}
+
+void Vm::GetLastFrameCost(uint32_t &updateUs, uint32_t &drawUs) {
+    updateUs = _lastUpdateUs;
+    drawUs = _lastDrawUs;
+}
+
+#define SAVE_STATE_MAGIC 0x53533846
+//bump whenever anything saved changes layout
+#define SAVE_STATE_VERSION 2
+
+struct saveStateHeader {
+    uint32_t magic;
+    uint32_t version;
+    //catch builds where the copied structs changed size
+    uint32_t picoRamSize;
+    uint32_t inputSize;
+    //the heap holds pointers to c functions, so it only makes sense in the
+    //build that saved it, loaded where it was then
+    uint32_t buildTime;
+    uint64_t apiFunction;
+    //the heap only makes sense at the address it was saved from, with the
+    //allocator and api context its lua states point at
+    uint64_t arenaBase;
+    uint64_t apiContext;
+    uint64_t allocFunction;
+    uint64_t allocUd;
+    uint64_t luaStateOffset;
+    uint64_t arenaUsed;
+    int32_t frameCount;
+    int32_t targetFps;
+    uint8_t hasUpdate;
+    uint8_t hasDraw;
+    uint32_t cartFilenameLength;
+};
+
+static_assert(std::is_trivially_copyable<PicoRam>::value, "PicoRam is saved as raw bytes");
+static_assert(std::is_trivially_copyable<Input>::value, "Input is saved as raw bytes");
+
+//FNV-1a of when vm.cpp was compiled
+static uint32_t buildTime() {
+    const char* built = __DATE__ " " __TIME__;
+    uint32_t hash = 2166136261u;
+    for (const char* c = built; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void appendBytes(vector<uint8_t> &out, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+bool Vm::SaveState(vector<uint8_t> &state) {
+    //nothing in the bios is worth coming back to
+    if (!_loadedCart || !_luaState || IsBiosLoaded()) {
+        return false;
+    }
+
+    //the mixer owns the channel state while it runs
+    auto const mixer = _audio->HoldMixer();
+
+    saveStateHeader header = {};
+    header.magic = SAVE_STATE_MAGIC;
+    header.version = SAVE_STATE_VERSION;
+    header.picoRamSize = sizeof(PicoRam);
+    header.inputSize = sizeof(Input);
+    header.buildTime = buildTime();
+    header.apiFunction = (uint64_t)(uintptr_t)&cls;
+    header.arenaBase = (uint64_t)(uintptr_t)_luaArena->Base();
+    header.apiContext = (uint64_t)(uintptr_t)_apiContext;
+    void* allocUd = nullptr;
+    header.allocFunction = (uint64_t)(uintptr_t)lua_getallocf(_luaState, &allocUd);
+    header.allocUd = (uint64_t)(uintptr_t)allocUd;
+    header.luaStateOffset = (uint8_t*)_luaState - _luaArena->Base();
+    header.arenaUsed = _luaArena->Used();
+    header.frameCount = _picoFrameCount;
+    header.targetFps = _targetFps;
+    header.hasUpdate = _hasUpdate;
+    header.hasDraw = _hasDraw;
+    header.cartFilenameLength = _loadedCart->Filename.length();
+
+    state.clear();
+    state.reserve(sizeof(header) + header.cartFilenameLength + sizeof(PicoRam) + 128 * 128 + sizeof(Input) + header.arenaUsed);
+    appendBytes(state, &header, sizeof(header));
+    appendBytes(state, _loadedCart->Filename.data(), header.cartFilenameLength);
+    appendBytes(state, &_memory, sizeof(PicoRam));
+    appendBytes(state, _graphics->GetP8FrameBuffer(), 128 * 128);
+    appendBytes(state, _input, sizeof(Input));
+    state.resize(state.size() + header.arenaUsed);
+    _luaArena->Copy(state.data() + state.size() - header.arenaUsed);
+
+    return true;
+}
+
+bool Vm::LoadState(const vector<uint8_t> &state) {
+    saveStateHeader header;
+    if (state.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, state.data(), sizeof(header));
+
+    if (header.magic != SAVE_STATE_MAGIC || header.version != SAVE_STATE_VERSION ||
+            header.picoRamSize != sizeof(PicoRam) || header.inputSize != sizeof(Input)) {
+        Logger::Write("save state is from another version\n");
+        return false;
+    }
+
+    if (header.buildTime != buildTime() || header.apiFunction != (uint64_t)(uintptr_t)&cls) {
+        Logger::Write("save state is from another build\n");
+        return false;
+    }
+
+    if (header.arenaBase != (uint64_t)(uintptr_t)_luaArena->Base() || header.apiContext != (uint64_t)(uintptr_t)_apiContext) {
+        Logger::Write("save state is from another vm\n");
+        return false;
+    }
+
+    size_t const expected = sizeof(header) + header.cartFilenameLength + sizeof(PicoRam) + 128 * 128 + sizeof(Input) + header.arenaUsed;
+    if (state.size() != expected || header.arenaUsed > _luaArena->Size() || header.luaStateOffset >= header.arenaUsed) {
+        Logger::Write("save state is damaged\n");
+        return false;
+    }
+
+    const uint8_t* data = state.data() + sizeof(header);
+    string cartFilename((const char*)data, header.cartFilenameLength);
+    data += header.cartFilenameLength;
+
+    if (!_loadedCart || _loadedCart->Filename != cartFilename) {
+        if (!LoadCart(cartFilename)) {
+            return false;
+        }
+    }
+
+    void* allocUd = nullptr;
+    lua_Alloc const allocFunction = lua_getallocf(_luaState, &allocUd);
+    if (header.allocFunction != (uint64_t)(uintptr_t)allocFunction || header.allocUd != (uint64_t)(uintptr_t)allocUd) {
+        Logger::Write("save state is from a lua state with another allocator\n");
+        return false;
+    }
+
+    //the current state is dropped without lua_close, the copied heap
+    //replaces all of it
+    _audio->StopThread();
+
+    memcpy(&_memory, data, sizeof(PicoRam));
+    data += sizeof(PicoRam);
+    memcpy(_graphics->GetP8FrameBuffer(), data, 128 * 128);
+    data += 128 * 128;
+    memcpy(_input, data, sizeof(Input));
+    data += sizeof(Input);
+    if (!_luaArena->Restore(data, header.arenaUsed)) {
+        Logger::Write("save state heap is damaged, reloading %s\n", cartFilename.c_str());
+        //what's in the arena now isn't a lua state that can be closed
+        _luaState = nullptr;
+        LoadCart(cartFilename);
+
+        return false;
+    }
+
+    _luaState = (lua_State*)(_luaArena->Base() + header.luaStateOffset);
+    //the state came with whatever hook it had when it was saved
+    _luaProfiler->Attach(_luaState);
+    _picoFrameCount = header.frameCount;
+    _targetFps = header.targetFps;
+    _hasUpdate = header.hasUpdate;
+    _hasDraw = header.hasDraw;
+
+    _audio->StartThread();
+
+    return true;
+}
+
+void Vm::CopyMemoryImage(vmMemoryImage* image) {
+    memcpy(image->picoFb, _graphics->GetP8FrameBuffer(), sizeof(image->picoFb));
+
+    //everything before and after the channels the mixer is busy with
+    size_t const channelsStart = offsetof(PicoRam, _musicChannel);
+    size_t const channelsEnd = offsetof(PicoRam, _gfxState_color);
+    uint8_t* ram = (uint8_t*)&image->ram;
+    memcpy(ram, (uint8_t*)&_memory, channelsStart);
+    memset(ram + channelsStart, 0, channelsEnd - channelsStart);
+    memcpy(ram + channelsEnd, (uint8_t*)&_memory + channelsEnd, sizeof(PicoRam) - channelsEnd);
+}
+
+bool Vm::SaveStateFile(string filename) {
+    vector<uint8_t> state;
+    if (!SaveState(state)) {
+        return false;
+    }
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool const written = fwrite(state.data(), 1, state.size(), file) == state.size();
+    fclose(file);
+
+    return written;
+}
+
+bool Vm::LoadStateFile(string filename) {
+    vector<unsigned char> state = get_file_buffer(filename);
+
+    return state.size() > 0 && LoadState(state);
+}
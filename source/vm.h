@@ -2,11 +2,15 @@
 
 #include <vector>
 #include <string>
+#include <map>
 using namespace std;
 
 #include "cart.h"
 #include "Input.h"
 #include "Audio.h"
+#include "cartLibrary.h"
+#include "framePacer.h"
+#include "framePresenter.h"
 
 extern "C" {
   #include <lua.h>
@@ -14,6 +18,22 @@ extern "C" {
   #include <lauxlib.h>
 }
 
+struct picoApiContext;
+class LuaArena;
+class ApiProfiler;
+class LuaProfiler;
+
+//what a frame leaves in memory, for telling frames apart. The mixer's
+//channel state belongs to the audio thread and is left zeroed
+struct vmMemoryImage {
+    uint8_t picoFb[128 * 128];
+    PicoRam ram;
+};
+
+//every lua state the vm creates lives in one block this big: the 2MB pico 8
+//gives carts, plus the interpreter, block headers and room for fragmentation
+#define VM_LUA_ARENA_SIZE (4 * 1024 * 1024)
+
 class Vm {
     PicoRam _memory;
 
@@ -21,10 +41,17 @@ class Vm {
     Graphics* _graphics;
     Audio* _audio;
     lua_State* _luaState;
+    LuaArena* _luaArena;
+    picoApiContext* _apiContext;
+    ApiProfiler* _apiProfiler;
+    LuaProfiler* _luaProfiler;
     Input* _input;
 
     int _targetFps;
 
+    //rnd() seed every cart starts with
+    uint32_t _rngSeed;
+
     int _picoFrameCount;
     bool _hasUpdate;
     bool _hasDraw;
@@ -34,7 +61,21 @@ class Vm {
 
     string _cartLoadError;
 
-    vector<string> _cartList;
+    //the last lua error or failed load, cleared by LoadCart
+    string _lastError;
+    //calls to unimplemented api functions, keyed by the name literal at the
+    //call site
+    std::map<const char*, uint32_t> _unimplementedCalls;
+    uint32_t _lastUpdateUs;
+    uint32_t _lastDrawUs;
+
+    bool callLuaFunction(const char* name);
+    template<lua_CFunction F>
+    void registerApi(const char* name);
+
+    CartLibrary* _cartLibrary;
+    FramePacer* _framePacer;
+    FramePresenter* _framePresenter;
 
     bool loadCart(Cart* cart);
 
@@ -44,7 +85,8 @@ class Vm {
 
     void LoadBiosCart();
 
-    void LoadCart(string filename);
+    //false if the cart couldn't be loaded and the bios was loaded instead
+    bool LoadCart(string filename);
 
     void UpdateAndDraw(
       uint8_t kdown,
@@ -55,6 +97,8 @@ class Vm {
     Color* GetPaletteColors();
 
     void FillAudioBuffer(void *audioBuffer, size_t offset, size_t size);
+    audioStats GetAudioStats();
+    void SetAudioRingTarget(size_t samples);
 
     void CloseCart();
 
@@ -64,8 +108,46 @@ class Vm {
 
     int GetFrameCount();
 
-    void SetCartList(vector<string> cartList);
-    vector<string> GetCartList();
+    //pico 8 rnd() and srand(). Values are 16.16 fixed point like on pico 8,
+    //so a seed always gives the same sequence
+    double api_rnd(double range);
+    void api_srand(double seed);
+    void SetRngSeed(uint32_t seed);
+    uint32_t GetRngSeed();
+
+    void SetCartLibrary(CartLibrary* cartLibrary);
+    CartLibrary* GetCartLibrary();
+    void SetFramePacer(FramePacer* framePacer);
+    FramePacer* GetFramePacer();
+    void SetFramePresenter(FramePresenter* framePresenter);
+    FramePresenter* GetFramePresenter();
+    //counts and times api calls per frame, for carts loaded after it is
+    //enabled
+    ApiProfiler* GetApiProfiler();
+    //samples the cart's lua stacks, for carts loaded after it is enabled
+    LuaProfiler* GetLuaProfiler();
     string GetBiosError();
+    //empty when nothing is loaded
+    string GetCartFilename();
+    bool IsBiosLoaded();
+
+    string GetLastError();
+    void RecordUnimplementedCall(const char* name);
+    std::map<string, uint32_t> GetUnimplementedCalls();
+    //time the last frame spent in _update and _draw
+    void GetLastFrameCost(uint32_t &updateUs, uint32_t &drawUs);
+
+    //Everything the running cart can see: ram, screen, sound, input repeat
+    //counters, the frame count and the whole lua heap. The heap is copied as
+    //is, so a state only loads back into the vm that saved it (or one whose
+    //heap ended up at the same address, like the same build started the
+    //same way on a console). Loading a state for another cart loads that
+    //cart first.
+    bool SaveState(vector<uint8_t> &state);
+    bool LoadState(const vector<uint8_t> &state);
+    bool SaveStateFile(string filename);
+    bool LoadStateFile(string filename);
+
+    void CopyMemoryImage(vmMemoryImage* image);
 };
 
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <mutex>
+
+#include "wavetable.h"
+#include "synth.h"
+
+//the analysed cycle is oversampled so harmonics past the table size don't
+//fold back into the ones that are kept
+#define ANALYSIS_BITS 13
+#define ANALYSIS_SIZE (1 << ANALYSIS_BITS)
+
+#define TABLE_INSTRUMENTS 6
+#define SAMPLE_RATE 22050
+
+static int16_t tables[TABLE_INSTRUMENTS][WAVETABLE_LEVELS][WAVETABLE_SIZE + 1];
+//every Audio shares the tables, whichever is created first builds them
+static std::once_flag tablesBuilt;
+
+static float key_to_freq(float key) {
+    return 440.f * std::exp2((key - 33.f) / 12.f);
+}
+
+//in place radix 2 fft. inverse skips the 1/n scaling
+static void fft(std::vector<float> &re, std::vector<float> &im, bool inverse) {
+    size_t n = re.size();
+
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        double angle = (inverse ? 2.0 : -2.0) * M_PI / len;
+        for (size_t k = 0; k < len / 2; k++) {
+            float wr = (float)std::cos(angle * k);
+            float wi = (float)std::sin(angle * k);
+
+            for (size_t i = k; i < n; i += len) {
+                size_t j = i + len / 2;
+                float tr = re[j] * wr - im[j] * wi;
+                float ti = re[j] * wi + im[j] * wr;
+                re[j] = re[i] - tr;
+                im[j] = im[i] - ti;
+                re[i] += tr;
+                im[i] += ti;
+            }
+        }
+    }
+}
+
+static void buildInstrument(int instrument) {
+    std::vector<float> re(ANALYSIS_SIZE), im(ANALYSIS_SIZE);
+    for (int i = 0; i < ANALYSIS_SIZE; i++) {
+        re[i] = z8::synth::waveform(instrument, (float)i / ANALYSIS_SIZE);
+        im[i] = 0.f;
+    }
+    fft(re, im, false);
+
+    std::vector<float> levelRe(WAVETABLE_SIZE), levelIm(WAVETABLE_SIZE);
+    for (int level = 0; level < WAVETABLE_LEVELS; level++) {
+        //top of the octave with a little headroom for vibrato
+        float topFreq = key_to_freq(12.f * (level + 1) + 1.f);
+        int harmonics = std::min((int)(SAMPLE_RATE / 2 / topFreq), WAVETABLE_SIZE / 2 - 1);
+
+        std::fill(levelRe.begin(), levelRe.end(), 0.f);
+        std::fill(levelIm.begin(), levelIm.end(), 0.f);
+        levelRe[0] = re[0] / ANALYSIS_SIZE;
+        for (int h = 1; h <= harmonics; h++) {
+            levelRe[h] = re[h] / ANALYSIS_SIZE;
+            levelIm[h] = im[h] / ANALYSIS_SIZE;
+            levelRe[WAVETABLE_SIZE - h] = levelRe[h];
+            levelIm[WAVETABLE_SIZE - h] = -levelIm[h];
+        }
+        fft(levelRe, levelIm, true);
+
+        int16_t* table = tables[instrument][level];
+        for (int i = 0; i < WAVETABLE_SIZE; i++) {
+            float value = std::round(levelRe[i] * WAVETABLE_ONE);
+            table[i] = (int16_t)std::clamp(value, -32768.f, 32767.f);
+        }
+        table[WAVETABLE_SIZE] = table[0];
+    }
+}
+
+void wavetable_init() {
+    std::call_once(tablesBuilt, [] {
+        for (int i = 0; i < TABLE_INSTRUMENTS; i++) {
+            buildInstrument(i);
+        }
+    });
+}
+
+const int16_t* wavetable_get(int instrument, float key) {
+    if (instrument == z8::synth::INST_PHASER || instrument < 0 || instrument >= TABLE_INSTRUMENTS) {
+        instrument = z8::synth::INST_TRIANGLE;
+    }
+
+    int level = std::clamp((int)(key / 12.f), 0, WAVETABLE_LEVELS - 1);
+
+    return tables[instrument][level];
+}
+
+uint32_t wavetable_phase_step(float freq, int sampleRate) {
+    return (uint32_t)((double)freq / sampleRate * 4294967296.0);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+//Band limited single cycle tables for the periodic built in instruments.
+//Oscillators keep a 32 bit phase where 1 << 32 is one full cycle, so the top
+//WAVETABLE_BITS bits pick the entry and the bits below them interpolate.
+//There is one table per octave of the pico 8 key range, each holding only
+//the harmonics that stay under nyquist for the highest note of that octave.
+
+#define WAVETABLE_BITS 11
+#define WAVETABLE_SIZE (1 << WAVETABLE_BITS)
+#define WAVETABLE_LEVELS 6
+
+//table values are the synth waveform scaled by this
+#define WAVETABLE_ONE 32767
+
+//builds the tables the first time it is called
+void wavetable_init();
+
+//table for a z8::synth instrument, band limited for notes of the given key.
+//Noise has no table. Phaser is built from two triangle lookups, see
+//wavetable_phaser. Tables hold WAVETABLE_SIZE + 1 entries so interpolation
+//never has to wrap.
+const int16_t* wavetable_get(int instrument, float key);
+
+//phase increment per sample at the given output rate
+uint32_t wavetable_phase_step(float freq, int sampleRate);
+
+inline int32_t wavetable_sample(const int16_t* table, uint32_t phase) {
+    uint32_t idx = phase >> (32 - WAVETABLE_BITS);
+    int32_t frac = (phase >> (32 - WAVETABLE_BITS - 15)) & 0x7fff;
+    int32_t a = table[idx];
+    int32_t b = table[idx + 1];
+    return a + (((b - a) * frac) >> 15);
+}
+
+//The phaser plays a triangle against a copy of itself shifted by a slow
+//triangle that runs at 1/128th of the note frequency (tracked in subPhase).
+//triangle is the table from wavetable_get(INST_TRIANGLE, key).
+inline int32_t wavetable_phaser(const int16_t* triangle, uint32_t phase, uint32_t subPhase) {
+    //half a cycle at most, shift = 0.5 * |2 * sub - 1| cycles
+    uint32_t shift = subPhase < 0x80000000u ? 0x80000000u - subPhase : subPhase - 0x80000000u;
+    int32_t shifted = wavetable_sample(triangle, phase + shift);
+    int32_t straight = wavetable_sample(triangle, phase);
+    return (2 * shifted - 4 * straight - WAVETABLE_ONE) / 6;
+}